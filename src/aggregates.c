@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+
+#include "helpers.h"
+
+#include "aggregates.h"
+#include "bits.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+#define how_many_elements_in_aggregate_block 1024
+
+void extremes_init(extremes_t *extremes) {
+    extremes->min = R_PosInf;
+    extremes->max = R_NegInf;
+    extremes->NAs = 0;
+}
+
+void extremes_merge(extremes_t *into, const extremes_t *from) {
+    if (from->min < into->min) into->min = from->min;
+    if (from->max > into->max) into->max = from->max;
+    into->NAs += from->NAs;
+}
+
+static void extremes_of_integers(const int *values, R_xlen_t size, extremes_t *extremes) {
+    int min = INT_MAX;
+    int max = INT_MIN;
+    R_xlen_t NAs = 0;
+    for (R_xlen_t i = 0; i < size; i++) {
+        int value = values[i];
+        if (value == NA_INTEGER) {
+            NAs++;
+            continue;
+        }
+        if (value < min) min = value;
+        if (value > max) max = value;
+    }
+    if (NAs < size) {
+        extremes_t block = { .min = (double) min, .max = (double) max, .NAs = NAs };
+        extremes_merge(extremes, &block);
+    } else {
+        extremes->NAs += NAs;
+    }
+}
+
+static void extremes_of_doubles(const double *values, R_xlen_t size, extremes_t *extremes) {
+    double min = R_PosInf;
+    double max = R_NegInf;
+    R_xlen_t NAs = 0;
+    for (R_xlen_t i = 0; i < size; i++) {
+        double value = values[i];
+        if (ISNAN(value)) {
+            NAs++;
+            continue;
+        }
+        if (value < min) min = value;
+        if (value > max) max = value;
+    }
+    extremes_t block = { .min = min, .max = max, .NAs = NAs };
+    extremes_merge(extremes, &block);
+}
+
+void extremes_of_region(SEXP/*INTSXP|REALSXP|LGLSXP*/ source, R_xlen_t start, R_xlen_t size, extremes_t *extremes) {
+    SEXPTYPE type = TYPEOF(source);
+    make_sure(type == INTSXP || type == REALSXP || type == LGLSXP, Rf_error,
+              "type of source must be one of INTSXP, REALSXP, or LGLSXP");
+    make_sure(start >= 0 && start + size <= XLENGTH(source), Rf_error, "region must fit within source");
+
+    const void *data = DATAPTR_OR_NULL(source);
+    if (data != NULL) {
+        if (type == REALSXP) {
+            extremes_of_doubles(((const double *) data) + start, size, extremes);
+        } else {
+            extremes_of_integers(((const int *) data) + start, size, extremes);
+        }
+        return;
+    }
+
+    // Sources without a data pointer are read one block at a time.
+    double buffer[how_many_elements_in_aggregate_block];
+    for (R_xlen_t offset = 0; offset < size; offset += how_many_elements_in_aggregate_block) {
+        R_xlen_t block_size = size - offset < how_many_elements_in_aggregate_block
+                            ? size - offset : how_many_elements_in_aggregate_block;
+        if (type == REALSXP) {
+            REAL_GET_REGION(source, start + offset, block_size, buffer);
+            extremes_of_doubles(buffer, block_size, extremes);
+        } else {
+            INTEGER_GET_REGION(source, start + offset, block_size, (int *) buffer);
+            extremes_of_integers((const int *) buffer, block_size, extremes);
+        }
+    }
+}
+
+// Corner cases (NAs without na.rm, no elements left) are left to R, which
+// knows whether to return NA or NaN and when to warn.
+static SEXP extreme_as_sexp(SEXPTYPE type, const extremes_t *extremes, R_xlen_t size, Rboolean narm, double value) {
+    if (extremes->NAs > 0 && !narm) {
+        return NULL;
+    }
+    if (extremes->NAs == size) {
+        return NULL;
+    }
+    return (type == REALSXP) ? ScalarReal(value) : ScalarInteger((int) value);
+}
+
+SEXP extremes_min_as_sexp(SEXPTYPE type, const extremes_t *extremes, R_xlen_t size, Rboolean narm) {
+    return extreme_as_sexp(type, extremes, size, narm, extremes->min);
+}
+
+SEXP extremes_max_as_sexp(SEXPTYPE type, const extremes_t *extremes, R_xlen_t size, Rboolean narm) {
+    return extreme_as_sexp(type, extremes, size, narm, extremes->max);
+}
+
+// Integer sums that do not fit into an integer are left to R, which warns.
+SEXP sum_as_sexp(SEXPTYPE type, double sum, R_xlen_t NAs, Rboolean narm) {
+    if (type == REALSXP) {
+        if (NAs > 0 && !narm) {
+            return NULL;
+        }
+        return ScalarReal(sum);
+    }
+
+    if (NAs > 0 && !narm) {
+        return ScalarInteger(NA_INTEGER);
+    }
+    if (sum > (double) INT_MAX || sum < (double) -INT_MAX) {
+        return NULL;
+    }
+    return ScalarInteger((int) sum);
+}
+
+static void sum_of_integers(const int *values, R_xlen_t size, long double *sum, R_xlen_t *NAs) {
+    for (R_xlen_t i = 0; i < size; i++) {
+        if (values[i] == NA_INTEGER) {
+            (*NAs)++;
+        } else {
+            *sum += values[i];
+        }
+    }
+}
+
+static void sum_of_doubles(const double *values, R_xlen_t size, long double *sum, R_xlen_t *NAs) {
+    for (R_xlen_t i = 0; i < size; i++) {
+        if (ISNAN(values[i])) {
+            (*NAs)++;
+        } else {
+            *sum += values[i];
+        }
+    }
+}
+
+// Sums the non-NA elements of a region and counts its NAs.
+void sum_of_region(SEXP/*INTSXP|REALSXP|LGLSXP*/ source, R_xlen_t start, R_xlen_t size, double *sum, R_xlen_t *NAs) {
+    SEXPTYPE type = TYPEOF(source);
+    make_sure(type == INTSXP || type == REALSXP || type == LGLSXP, Rf_error,
+              "type of source must be one of INTSXP, REALSXP, or LGLSXP");
+    make_sure(start >= 0 && start + size <= XLENGTH(source), Rf_error, "region must fit within source");
+
+    if (bits_sum_of_region(source, start, size, sum, NAs)) {
+        return;
+    }
+
+    long double total = 0;
+    *NAs = 0;
+
+    const void *data = DATAPTR_OR_NULL(source);
+    if (data != NULL) {
+        if (type == REALSXP) {
+            sum_of_doubles(((const double *) data) + start, size, &total, NAs);
+        } else {
+            sum_of_integers(((const int *) data) + start, size, &total, NAs);
+        }
+        *sum = (double) total;
+        return;
+    }
+
+    double buffer[how_many_elements_in_aggregate_block];
+    for (R_xlen_t offset = 0; offset < size; offset += how_many_elements_in_aggregate_block) {
+        R_xlen_t block_size = size - offset < how_many_elements_in_aggregate_block
+                            ? size - offset : how_many_elements_in_aggregate_block;
+        if (type == REALSXP) {
+            REAL_GET_REGION(source, start + offset, block_size, buffer);
+            sum_of_doubles(buffer, block_size, &total, NAs);
+        } else {
+            INTEGER_GET_REGION(source, start + offset, block_size, (int *) buffer);
+            sum_of_integers((const int *) buffer, block_size, &total, NAs);
+        }
+    }
+    *sum = (double) total;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "Rinternals.h"
+
+typedef struct {
+    double   min; // Smallest non-NA element, R_PosInf if there are none.
+    double   max; // Largest non-NA element, R_NegInf if there are none.
+    R_xlen_t NAs;
+} extremes_t;
+
+void extremes_init       (extremes_t *extremes);
+void extremes_merge      (extremes_t *into, const extremes_t *from);
+void extremes_of_region  (SEXP/*INTSXP|REALSXP|LGLSXP*/ source, R_xlen_t start, R_xlen_t size, extremes_t *extremes);
+SEXP extremes_min_as_sexp(SEXPTYPE type, const extremes_t *extremes, R_xlen_t size, Rboolean narm);
+SEXP extremes_max_as_sexp(SEXPTYPE type, const extremes_t *extremes, R_xlen_t size, Rboolean narm);
+SEXP sum_as_sexp         (SEXPTYPE type, double sum, R_xlen_t NAs, Rboolean narm);
+void sum_of_region       (SEXP/*INTSXP|REALSXP|LGLSXP*/ source, R_xlen_t start, R_xlen_t size, double *sum, R_xlen_t *NAs);
@@ -50,15 +50,27 @@ bool bitmap_get(SEXP bitmap, R_xlen_t which_bit) {
 }
 
 R_xlen_t bitmap_count_set_bits(SEXP bitmap) {
+    make_sure(TYPEOF(bitmap) == INTSXP, Rf_error, "bitmap must be a vector of type INTSXP");
+
+    // Bits past the end of the bitmap are never set, so whole words can be counted.
+    const uint32_t *words = bitmap_words(bitmap);
     R_xlen_t set_bits = 0;
-    for (R_xlen_t i = 0; i < TRUELENGTH(bitmap); i++) {
-        if (bitmap_get(bitmap, i)) {
-            set_bits++;
-        }
+    for (R_xlen_t i = 0; i < XLENGTH(bitmap); i++) {
+        set_bits += __builtin_popcount(words[i]);
     }
     return set_bits;
 }
 
+uint32_t *bitmap_words(SEXP/*INTSXP*/ bitmap) {
+    make_sure(TYPEOF(bitmap) == INTSXP, Rf_error, "bitmap must be a vector of type INTSXP");
+    return (uint32_t *) INTEGER(bitmap);
+}
+
+R_xlen_t bitmap_size_in_words(SEXP/*INTSXP*/ bitmap) {
+    make_sure(TYPEOF(bitmap) == INTSXP, Rf_error, "bitmap must be a vector of type INTSXP");
+    return XLENGTH(bitmap);
+}
+
 SEXP/*INTSXP*/ bitmap_clone(SEXP/*INTSXP*/ source) {
 	make_sure(TYPEOF(source) == INTSXP, Rf_error, "source must be a vector of type INTSXP");
 
@@ -96,3 +108,23 @@ R_xlen_t bitmap_index_of_nth_set_bit (SEXP/*INTSXP*/ bitmap, R_xlen_t which_bit)
     Rf_error("Bitmap index out of range.");
     return 0;
 }
+
+void bitmap_set_range(SEXP/*INTSXP*/ bitmap, R_xlen_t start, R_xlen_t size) {
+    make_sure(TYPEOF(bitmap) == INTSXP, Rf_error, "bitmap must be a vector of type INTSXP");
+    make_sure(start >= 0 && start + size <= XTRUELENGTH(bitmap), Rf_error, "range is out of the bitmap");
+
+    uint32_t *words = bitmap_words(bitmap);
+    R_xlen_t  end   = start + size;
+    R_xlen_t  bit   = start;
+
+    // Partial words at either end are set bit by bit, whole words in between at once.
+    for (; bit < end && bit % how_many_bits_in_bitmap_word != 0; bit++) {
+        bitmap_set(bitmap, bit);
+    }
+    for (; bit + how_many_bits_in_bitmap_word <= end; bit += how_many_bits_in_bitmap_word) {
+        words[bit / how_many_bits_in_bitmap_word] = UINT32_MAX;
+    }
+    for (; bit < end; bit++) {
+        bitmap_set(bitmap, bit);
+    }
+}
@@ -2,11 +2,18 @@
 
 #include <R.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#define how_many_bits_in_bitmap_word 32
 
 SEXP/*INTSXP*/  bitmap_new                  (R_xlen_t size_in_bits);
 void            bitmap_set                  (SEXP/*INTSXP*/ bitmap, R_xlen_t which_bit);
 void            bitmap_reset                (SEXP/*INTSXP*/ bitmap, R_xlen_t which_bit);
+void            bitmap_set_range            (SEXP/*INTSXP*/ bitmap, R_xlen_t start, R_xlen_t size);
 bool            bitmap_get                  (SEXP/*INTSXP*/ bitmap, R_xlen_t which_bit);
 SEXP/*INTSXP*/  bitmap_clone                (SEXP/*INTSXP*/ source);
 R_xlen_t        bitmap_count_set_bits       (SEXP/*INTSXP*/ bitmap);
 R_xlen_t        bitmap_index_of_nth_set_bit (SEXP/*INTSXP*/ bitmap, R_xlen_t which_bit);
+
+uint32_t       *bitmap_words                (SEXP/*INTSXP*/ bitmap);
+R_xlen_t        bitmap_size_in_words        (SEXP/*INTSXP*/ bitmap);
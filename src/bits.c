@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Altrep.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "common.h"
+#include "bitmap_sexp.h"
+
+#include "bits.h"
+#include "aggregates.h"
+#include "filters.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// A bit vector is a logical vector packed into bitmaps of the same layout as
+// the ones mosaics use: one bitmap holds the values, and an optional second
+// bitmap marks the NAs. The value bit of an NA is always 0, so TRUE elements
+// can be counted without looking at the NA bitmap. Bit vectors are immutable;
+// writing to one materializes it as an ordinary logical vector.
+static R_altrep_class_t bits_logical_altrep;
+
+#define how_many_elements_in_bits_block 1024
+
+SEXP bits_new(SEXP/*INTSXP*/ values, SEXP/*INTSXP|NILSXP*/ NAs) {
+    make_sure(TYPEOF(values) == INTSXP, Rf_error, "values must be a bitmap");
+    make_sure(NAs == R_NilValue || (TYPEOF(NAs) == INTSXP && XTRUELENGTH(NAs) == XTRUELENGTH(values)),
+              Rf_error, "NAs must be either NULL or a bitmap as long as values");
+
+    if (get_debug_mode()) {
+        Rprintf("bits_new\n");
+        Rprintf("         values: %p\n", values);
+        Rprintf("            NAs: %p\n", NAs);
+        Rprintf("         length: %li\n", XTRUELENGTH(values));
+    }
+
+    SEXP/*LISTSXP*/ data = PROTECT(allocSExp(LISTSXP));
+    SETCAR (data, NAs);        // The NA bitmap, or R_NilValue if there are no NAs
+    SET_TAG(data, R_NilValue); // Starts as R_NilValue, becomes a vector if it the bit vector is written to
+    SETCDR (data, R_NilValue); // Nothing here
+
+    SEXP bits = R_new_altrep(bits_logical_altrep, values, data);
+    UNPROTECT(1);
+    return bits;
+}
+
+static inline SEXP/*INTSXP*/ get_values(SEXP x) {
+    return R_altrep_data1(x);
+}
+
+static inline SEXP/*INTSXP|NILSXP*/ get_NAs(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return CAR(cell);
+}
+
+static inline R_xlen_t get_length(SEXP x) {
+    return XTRUELENGTH(get_values(x));
+}
+
+static inline SEXP get_materialized_data(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell);
+}
+
+static inline void set_materialized_data(SEXP x, SEXP data) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    SET_TAG(cell, data);
+}
+
+static inline bool is_materialized(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell) != R_NilValue;
+}
+
+bool bits_bitmaps(SEXP x, SEXP/*INTSXP*/ *values, SEXP/*INTSXP|NILSXP*/ *NAs) {
+    if (TYPEOF(x) != LGLSXP || !ALTREP(x) || !R_altrep_inherits(x, bits_logical_altrep) || is_materialized(x)) {
+        return false;
+    }
+    *values = get_values(x);
+    *NAs    = get_NAs(x);
+    return true;
+}
+
+// Counts the set bits in positions [start, start + size) of the bitmap.
+static R_xlen_t count_set_bits_in_range(const uint32_t *words, R_xlen_t start, R_xlen_t size) {
+    if (size == 0) {
+        return 0;
+    }
+
+    R_xlen_t first_word = start / how_many_bits_in_bitmap_word;
+    R_xlen_t last_word  = (start + size - 1) / how_many_bits_in_bitmap_word;
+    uint32_t first_mask = UINT32_MAX << (start % how_many_bits_in_bitmap_word);
+    uint32_t last_mask  = UINT32_MAX >> (how_many_bits_in_bitmap_word - 1 - (start + size - 1) % how_many_bits_in_bitmap_word);
+
+    if (first_word == last_word) {
+        return __builtin_popcount(words[first_word] & first_mask & last_mask);
+    }
+
+    R_xlen_t set_bits = __builtin_popcount(words[first_word] & first_mask);
+    for (R_xlen_t i = first_word + 1; i < last_word; i++) {
+        set_bits += __builtin_popcount(words[i]);
+    }
+    return set_bits + __builtin_popcount(words[last_word] & last_mask);
+}
+
+bool bits_sum_of_region(SEXP source, R_xlen_t start, R_xlen_t size, double *sum, R_xlen_t *NAs) {
+    SEXP values = R_NilValue;
+    SEXP NA_bits = R_NilValue;
+    if (!bits_bitmaps(source, &values, &NA_bits)) {
+        return false;
+    }
+
+    *sum = (double) count_set_bits_in_range(bitmap_words(values), start, size);
+    *NAs = (NA_bits == R_NilValue) ? 0 : count_set_bits_in_range(bitmap_words(NA_bits), start, size);
+    return true;
+}
+
+static inline int bit_as_logical(const uint32_t *values, const uint32_t *NAs, R_xlen_t index) {
+    R_xlen_t word = index / how_many_bits_in_bitmap_word;
+    uint32_t mask = ((uint32_t) 1) << (index % how_many_bits_in_bitmap_word);
+    if (NAs != NULL && (NAs[word] & mask)) {
+        return NA_LOGICAL;
+    }
+    return (values[word] & mask) ? TRUE : FALSE;
+}
+
+static R_xlen_t copy_bits_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    R_xlen_t length = get_length(x);
+    R_xlen_t size   = (length - i < n) ? length - i : n;
+
+    const uint32_t *values = bitmap_words(get_values(x));
+    const uint32_t *NAs    = (get_NAs(x) == R_NilValue) ? NULL : bitmap_words(get_NAs(x));
+
+    for (R_xlen_t j = 0; j < size; j++) {
+        buf[j] = bit_as_logical(values, NAs, i + j);
+    }
+    return size;
+}
+
+SEXP bits_duplicate(SEXP x, Rboolean deep) {
+
+    if (get_debug_mode()) {
+        Rprintf("bits_duplicate\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           deep: %i\n", deep);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    SEXP bits = PROTECT(bits_new(get_values(x), get_NAs(x)));
+    if (is_materialized(x)) {
+        SEXP data = get_materialized_data(x);
+        set_materialized_data(bits, deep ? duplicate(data) : data);
+    }
+    UNPROTECT(1);
+    return bits;
+}
+
+static Rboolean bits_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+
+    Rprintf("bits_altrep %s\n", type2char(TYPEOF(x)));
+
+    inspect_subtree(R_altrep_data1(x), pre, deep, pvec);
+    inspect_subtree(R_altrep_data2(x), pre, deep, pvec);
+
+    return FALSE;
+}
+
+static R_xlen_t bits_length(SEXP x) {
+    if (get_debug_mode()) {
+        Rprintf("bits_length\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return get_length(x);
+}
+
+static SEXP materialize(SEXP x) {
+    SEXP data = PROTECT(allocVector(LGLSXP, get_length(x)));
+    copy_bits_region(x, 0, XLENGTH(data), LOGICAL(data));
+    UNPROTECT(1);
+    return data;
+}
+
+static void *bits_dataptr(SEXP x, Rboolean writeable) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("bits_dataptr\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("      writeable: %i\n", writeable);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (!is_materialized(x)) {
+        set_materialized_data(x, materialize(x));
+    }
+
+    SEXP data = get_materialized_data(x);
+    return writeable ? DATAPTR(data) : (void *) DATAPTR_RO(data);
+}
+
+static const void *bits_dataptr_or_null(SEXP x) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("bits_dataptr_or_null\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return is_materialized(x) ? DATAPTR_RO(get_materialized_data(x)) : NULL;
+}
+
+static int bits_logical_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("bits_logical_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return LOGICAL_ELT(get_materialized_data(x), i);
+    }
+
+    const uint32_t *values = bitmap_words(get_values(x));
+    const uint32_t *NAs    = (get_NAs(x) == R_NilValue) ? NULL : bitmap_words(get_NAs(x));
+    return bit_as_logical(values, NAs, i);
+}
+
+static R_xlen_t bits_logical_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("bits_logical_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return copy_region(get_materialized_data(x), i, n, buf);
+    }
+
+    return copy_bits_region(x, i, n, buf);
+}
+
+static SEXP bits_sum(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("bits_sum\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    double   sum = 0;
+    R_xlen_t NAs = 0;
+    bits_sum_of_region(x, 0, get_length(x), &sum, &NAs);
+    return sum_as_sexp(LGLSXP, sum, NAs, narm);
+}
+
+void init_bits_logical_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altlogical_class("bits_logical_altrep", "viewports", dll);
+    bits_logical_altrep = cls;
+
+    R_set_altrep_Duplicate_method(cls, bits_duplicate);
+    R_set_altrep_Inspect_method(cls, bits_inspect);
+    R_set_altrep_Length_method(cls, bits_length);
+
+    R_set_altvec_Dataptr_method(cls, bits_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, bits_dataptr_or_null);
+
+    R_set_altlogical_Elt_method(cls, bits_logical_element);
+    R_set_altlogical_Get_region_method(cls, bits_logical_get_region);
+    R_set_altlogical_Sum_method(cls, bits_sum);
+}
+
+void init_bits_altrep_class(DllInfo * dll) {
+    init_bits_logical_altrep_class(dll);
+}
+
+// Packs the logical vector one block at a time. The NA bitmap is only kept if
+// there turn out to be any NAs.
+SEXP/*LGLSXP*/ create_bits(SEXP/*LGLSXP*/ source) {
+    make_sure(TYPEOF(source) == LGLSXP, Rf_error, "type of source must be LGLSXP");
+
+    SEXP values = R_NilValue;
+    SEXP NAs = R_NilValue;
+    if (bits_bitmaps(source, &values, &NAs)) {
+        return source;
+    }
+
+    R_xlen_t length = XLENGTH(source);
+
+    if (get_debug_mode()) {
+        Rprintf("create bits\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("         length: %li\n", length);
+    }
+
+    values = PROTECT(bitmap_new(length));
+    NAs    = PROTECT(bitmap_new(length));
+    uint32_t *value_words = bitmap_words(values);
+    uint32_t *NA_words    = bitmap_words(NAs);
+    R_xlen_t  how_many_NAs = 0;
+
+    int block[how_many_elements_in_bits_block];
+    for (R_xlen_t offset = 0; offset < length; offset += how_many_elements_in_bits_block) {
+        R_xlen_t block_size = length - offset < how_many_elements_in_bits_block
+                            ? length - offset : how_many_elements_in_bits_block;
+        copy_region(source, offset, block_size, block);
+        for (R_xlen_t i = 0; i < block_size; i++) {
+            R_xlen_t index = offset + i;
+            uint32_t mask  = ((uint32_t) 1) << (index % how_many_bits_in_bitmap_word);
+            if (block[i] == NA_LOGICAL) {
+                NA_words[index / how_many_bits_in_bitmap_word] |= mask;
+                how_many_NAs++;
+            } else if (block[i]) {
+                value_words[index / how_many_bits_in_bitmap_word] |= mask;
+            }
+        }
+    }
+
+    SEXP bits = bits_new(values, how_many_NAs > 0 ? NAs : R_NilValue);
+    UNPROTECT(2);
+    return bits;
+}
+
+// Filters produce bit vectors directly: an element is TRUE if it satisfies
+// all the predicates and FALSE otherwise, NAs included, like which() would.
+SEXP/*LGLSXP*/ create_bits_where(SEXP/*INTSXP|REALSXP|LGLSXP*/ source, SEXP/*STRSXP*/ operators,
+                                 SEXP/*VECSXP*/ operands) {
+    SEXPTYPE source_type = TYPEOF(source);
+    make_sure(source_type == INTSXP || source_type == REALSXP || source_type == LGLSXP, Rf_error,
+              "type of source must be one of INTSXP, REALSXP, or LGLSXP");
+
+    predicate_t *predicates = parse_predicates(source_type, operators, operands);
+
+    if (get_debug_mode()) {
+        Rprintf("create bits where\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("     predicates: %li\n", XLENGTH(operators));
+    }
+
+    SEXP/*INTSXP*/ values = PROTECT(bitmap_new(XLENGTH(source)));
+    evaluate_predicates_into_bitmap(source, predicates, (int) XLENGTH(operators), values);
+    SEXP bits = bits_new(values, R_NilValue);
+    UNPROTECT(1);
+    return bits;
+}
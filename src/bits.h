@@ -0,0 +1,14 @@
+#pragma once
+
+#include "Rinternals.h"
+#include <stdbool.h>
+
+SEXP/*LGLSXP*/ bits_new(SEXP/*INTSXP*/ values, SEXP/*INTSXP|NILSXP*/ NAs);
+bool           bits_bitmaps(SEXP x, SEXP/*INTSXP*/ *values, SEXP/*INTSXP|NILSXP*/ *NAs);
+bool           bits_sum_of_region(SEXP source, R_xlen_t start, R_xlen_t size, double *sum, R_xlen_t *NAs);
+
+SEXP/*LGLSXP*/ create_bits(SEXP/*LGLSXP*/ source);
+SEXP/*LGLSXP*/ create_bits_where(SEXP/*INTSXP|REALSXP|LGLSXP*/ source, SEXP/*STRSXP*/ operators,
+                                 SEXP/*VECSXP*/ operands);
+
+void init_bits_altrep_class(DllInfo *dll);
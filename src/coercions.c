@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Altrep.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "common.h"
+
+#include "coercions.h"
+#include "aggregates.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// A coercion is a view of an integer or logical source as a vector of a wider
+// type: logical as integer, and integer or logical as double. Elements are
+// converted as they are read, so coercing a viewport does not allocate a copy
+// of the selected elements, let alone a converted one.
+//
+// Narrowing coercions (double to integer and so on) are left to R, because
+// they may have to warn about the values they lose, which cannot be deferred
+// until the elements are read.
+static R_altrep_class_t coercion_integer_altrep;
+static R_altrep_class_t coercion_numeric_altrep;
+
+#define how_many_elements_in_coercion_block 1024
+
+static inline R_altrep_class_t class_from_sexp_type(SEXPTYPE type) { // @suppress("No return")
+    switch (type) {
+        case INTSXP:  return coercion_integer_altrep;
+        case REALSXP: return coercion_numeric_altrep;
+        default:      Rf_error("No ALTREP coercion class for vector of type %s", type2str(type));
+    }
+}
+
+static inline bool is_widening(SEXPTYPE from, SEXPTYPE to) {
+    return (from == LGLSXP && (to == INTSXP || to == REALSXP))
+        || (from == INTSXP && to == REALSXP);
+}
+
+static SEXP coercion_new(SEXP source, SEXPTYPE type) {
+    make_sure(is_widening(TYPEOF(source), type), Rf_error,
+              "coercions only widen LGLSXP to INTSXP or REALSXP and INTSXP to REALSXP");
+
+    if (get_debug_mode()) {
+        Rprintf("coercion_new\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("           from: %s\n", type2char(TYPEOF(source)));
+        Rprintf("             to: %s\n", type2char(type));
+    }
+
+    SEXP/*LISTSXP*/ data = PROTECT(allocSExp(LISTSXP));
+    SETCAR (data, source);     // The original vector
+    SET_TAG(data, R_NilValue); // Starts as R_NilValue, becomes a vector if it the coercion is written to
+    SETCDR (data, R_NilValue); // Nothing here
+
+    SEXP coercion = R_new_altrep(class_from_sexp_type(type), R_NilValue, data);
+    UNPROTECT(1);
+    return coercion;
+}
+
+static inline SEXP get_source(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return CAR(cell);
+}
+
+static inline SEXP get_materialized_data(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell);
+}
+
+static inline void set_materialized_data(SEXP x, SEXP data) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    SET_TAG(cell, data);
+}
+
+static inline bool is_materialized(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell) != R_NilValue;
+}
+
+// Integers and logicals share their representation, NA included, so only the
+// conversion to doubles does any work. Blocks of four integers without NAs
+// are converted two at a time, blocks with NAs one at a time.
+static void integers_to_doubles(const int *integers, double *doubles, R_xlen_t size) {
+    R_xlen_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i NAs = _mm_set1_epi32(NA_INTEGER);
+    for (; i + 4 <= size; i += 4) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (integers + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(block, NAs)) == 0) {
+            _mm_storeu_pd(doubles + i,     _mm_cvtepi32_pd(block));
+            _mm_storeu_pd(doubles + i + 2, _mm_cvtepi32_pd(_mm_shuffle_epi32(block, _MM_SHUFFLE(1, 0, 3, 2))));
+            continue;
+        }
+        for (R_xlen_t j = i; j < i + 4; j++) {
+            doubles[j] = (integers[j] == NA_INTEGER) ? NA_REAL : (double) integers[j];
+        }
+    }
+#endif
+
+    for (; i < size; i++) {
+        doubles[i] = (integers[i] == NA_INTEGER) ? NA_REAL : (double) integers[i];
+    }
+}
+
+static R_xlen_t copy_coerced_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    SEXP     source = get_source(x);
+    R_xlen_t length = XLENGTH(source);
+    R_xlen_t size   = (length - i < n) ? length - i : n;
+
+    if (TYPEOF(x) == INTSXP) {
+        return copy_region(source, i, size, buf);
+    }
+
+    const int *data = (const int *) DATAPTR_OR_NULL(source);
+    if (data != NULL) {
+        integers_to_doubles(data + i, (double *) buf, size);
+        return size;
+    }
+
+    // Sources without a data pointer are read one block at a time.
+    int block[how_many_elements_in_coercion_block];
+    for (R_xlen_t offset = 0; offset < size; offset += how_many_elements_in_coercion_block) {
+        R_xlen_t block_size = size - offset < how_many_elements_in_coercion_block
+                            ? size - offset : how_many_elements_in_coercion_block;
+        copy_region(source, i + offset, block_size, block);
+        integers_to_doubles(block, ((double *) buf) + offset, block_size);
+    }
+    return size;
+}
+
+SEXP coercion_duplicate(SEXP x, Rboolean deep) {
+
+    if (get_debug_mode()) {
+        Rprintf("coercion_duplicate\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           deep: %i\n", deep);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    SEXP coercion = PROTECT(coercion_new(get_source(x), TYPEOF(x)));
+    if (is_materialized(x)) {
+        SEXP data = get_materialized_data(x);
+        set_materialized_data(coercion, deep ? duplicate(data) : data);
+    }
+    UNPROTECT(1);
+    return coercion;
+}
+
+static Rboolean coercion_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+
+    Rprintf("coercion_altrep %s from %s\n", type2char(TYPEOF(x)), type2char(TYPEOF(get_source(x))));
+
+    inspect_subtree(R_altrep_data2(x), pre, deep, pvec);
+
+    return FALSE;
+}
+
+static R_xlen_t coercion_length(SEXP x) {
+    if (get_debug_mode()) {
+        Rprintf("coercion_length\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return XLENGTH(get_source(x));
+}
+
+static SEXP materialize(SEXP x) {
+    SEXP data = PROTECT(allocVector(TYPEOF(x), XLENGTH(get_source(x))));
+    copy_coerced_region(x, 0, XLENGTH(data), DATAPTR(data));
+    UNPROTECT(1);
+    return data;
+}
+
+static void *coercion_dataptr(SEXP x, Rboolean writeable) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("coercion_dataptr\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("      writeable: %i\n", writeable);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (!is_materialized(x)) {
+        set_materialized_data(x, materialize(x));
+    }
+
+    SEXP data = get_materialized_data(x);
+    return writeable ? DATAPTR(data) : (void *) DATAPTR_RO(data);
+}
+
+static const void *coercion_dataptr_or_null(SEXP x) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("coercion_dataptr_or_null\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return is_materialized(x) ? DATAPTR_RO(get_materialized_data(x)) : NULL;
+}
+
+static int coercion_integer_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("coercion_integer_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return INTEGER_ELT(get_materialized_data(x), i);
+    }
+
+    return LOGICAL_ELT(get_source(x), i);
+}
+
+static double coercion_numeric_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("coercion_numeric_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return REAL_ELT(get_materialized_data(x), i);
+    }
+
+    SEXP source  = get_source(x);
+    int  element = (TYPEOF(source) == INTSXP) ? INTEGER_ELT(source, i) : LOGICAL_ELT(source, i);
+    return (element == NA_INTEGER) ? NA_REAL : (double) element;
+}
+
+static R_xlen_t coercion_get_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("coercion_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return copy_region(get_materialized_data(x), i, n, buf);
+    }
+
+    return copy_coerced_region(x, i, n, buf);
+}
+
+static R_xlen_t coercion_integer_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    return coercion_get_region(x, i, n, buf);
+}
+
+static R_xlen_t coercion_numeric_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    return coercion_get_region(x, i, n, buf);
+}
+
+// Widening does not change any values, so the aggregates are those of the
+// source, only reported as the wider type.
+static SEXP coercion_sum(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("coercion_sum\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    SEXP source = get_source(x);
+
+    double   sum = 0;
+    R_xlen_t NAs = 0;
+    sum_of_region(source, 0, XLENGTH(source), &sum, &NAs);
+    return sum_as_sexp(TYPEOF(x), sum, NAs, narm);
+}
+
+static SEXP coercion_min(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("coercion_min\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    SEXP source = get_source(x);
+
+    extremes_t extremes;
+    extremes_init(&extremes);
+    extremes_of_region(source, 0, XLENGTH(source), &extremes);
+    return extremes_min_as_sexp(TYPEOF(x), &extremes, XLENGTH(source), narm);
+}
+
+static SEXP coercion_max(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("coercion_max\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    SEXP source = get_source(x);
+
+    extremes_t extremes;
+    extremes_init(&extremes);
+    extremes_of_region(source, 0, XLENGTH(source), &extremes);
+    return extremes_max_as_sexp(TYPEOF(x), &extremes, XLENGTH(source), narm);
+}
+
+// Coercing a logical-as-integer coercion to double goes straight to the
+// logical source.
+static SEXP coercion_coerce(SEXP x, int type) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("coercion_coerce\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           type: %s\n", type2char(type));
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x) || !is_widening(TYPEOF(x), type)) {
+        return NULL;
+    }
+
+    SEXP coercion = PROTECT(coercion_new(get_source(x), (SEXPTYPE) type));
+    SHALLOW_DUPLICATE_ATTRIB(coercion, x);
+    UNPROTECT(1);
+    return coercion;
+}
+
+SEXP coerce_view(SEXP x, int type) {
+    if (!is_widening(TYPEOF(x), (SEXPTYPE) type)) {
+        return NULL;
+    }
+
+    SEXP coercion = PROTECT(coercion_new(x, (SEXPTYPE) type));
+    SHALLOW_DUPLICATE_ATTRIB(coercion, x);
+    UNPROTECT(1);
+    return coercion;
+}
+
+static void init_common_coercion(R_altrep_class_t cls) {
+    R_set_altrep_Duplicate_method(cls, coercion_duplicate);
+    R_set_altrep_Inspect_method(cls, coercion_inspect);
+    R_set_altrep_Length_method(cls, coercion_length);
+    R_set_altrep_Coerce_method(cls, coercion_coerce);
+
+    R_set_altvec_Dataptr_method(cls, coercion_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, coercion_dataptr_or_null);
+}
+
+void init_coercion_integer_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altinteger_class("coercion_integer_altrep", "viewports", dll);
+    coercion_integer_altrep = cls;
+
+    init_common_coercion(cls);
+
+    R_set_altinteger_Elt_method(cls, coercion_integer_element);
+    R_set_altinteger_Get_region_method(cls, coercion_integer_get_region);
+    R_set_altinteger_Min_method(cls, coercion_min);
+    R_set_altinteger_Max_method(cls, coercion_max);
+    R_set_altinteger_Sum_method(cls, coercion_sum);
+}
+
+void init_coercion_numeric_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altreal_class("coercion_numeric_altrep", "viewports", dll);
+    coercion_numeric_altrep = cls;
+
+    init_common_coercion(cls);
+
+    R_set_altreal_Elt_method(cls, coercion_numeric_element);
+    R_set_altreal_Get_region_method(cls, coercion_numeric_get_region);
+    R_set_altreal_Min_method(cls, coercion_min);
+    R_set_altreal_Max_method(cls, coercion_max);
+    R_set_altreal_Sum_method(cls, coercion_sum);
+}
+
+void init_coercion_altrep_class(DllInfo * dll) {
+    init_coercion_integer_altrep_class(dll);
+    init_coercion_numeric_altrep_class(dll);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "Rinternals.h"
+
+// Returns a lazy coercion of x to type, or NULL if R should coerce x itself.
+SEXP coerce_view(SEXP x, int type);
+
+void init_coercion_altrep_class(DllInfo *dll);
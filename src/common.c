@@ -2,6 +2,11 @@
 #include <R.h>
 #include <Rinternals.h>
 
+#include <string.h>
+#include <math.h>
+
+#include "debug.h"
+#include "bitmap_sexp.h"
 #include "common.h"
 
 #define MAKE_SURE
@@ -83,6 +88,46 @@ bool are_numeric_indices_contiguous(SEXP/*REALSXP*/ indices) {
     double previous = NA_REAL;
 
     for (int i = 0; i < size; i++) {
+        double current = REAL_ELT(indices, i);
+        if (ISNAN(current)) {
+            return false;
+        }
+        if (!ISNAN(previous) && previous != current - 1) {
+            return false;
+        }
+        previous = current;
+    }
+
+    return true;
+}
+
+bool are_integer_indices_reverse_contiguous(SEXP/*INTSXP*/ indices) {
+    make_sure(TYPEOF(indices) == INTSXP, Rf_error, "type of indices should be INTSXP");
+
+    R_xlen_t size = XLENGTH(indices);
+    int previous = NA_INTEGER;
+
+    for (R_xlen_t i = 0; i < size; i++) {
+        int current = INTEGER_ELT(indices, i);
+        if (current == NA_INTEGER) {
+            return false;
+        }
+        if (previous != NA_INTEGER && previous != current + 1) {
+            return false;
+        }
+        previous = current;
+    }
+
+    return true;
+}
+
+bool are_numeric_indices_reverse_contiguous(SEXP/*REALSXP*/ indices) {
+    make_sure(TYPEOF(indices) == REALSXP, Rf_error, "type of indices should be REALSXP");
+
+    R_xlen_t size = XLENGTH(indices);
+    double previous = NA_REAL;
+
+    for (R_xlen_t i = 0; i < size; i++) {
         double current = REAL_ELT(indices, i);
         if (ISNAN(current)) {
             return false;
@@ -96,6 +141,18 @@ bool are_numeric_indices_contiguous(SEXP/*REALSXP*/ indices) {
     return true;
 }
 
+// Contiguous indices in descending order, e.g. 10:1.
+bool are_indices_reverse_contiguous(SEXP/*INTSXP | REALSXP*/ indices) {
+    SEXPTYPE type = TYPEOF(indices);
+    make_sure(type == INTSXP || type == REALSXP, Rf_error, "type of indices should be either INTSXP or REALSXP");
+
+    switch (type) {
+        case INTSXP:  return are_integer_indices_reverse_contiguous(indices);
+        case REALSXP: return are_numeric_indices_reverse_contiguous(indices);
+        default:      Rf_error("Slices can be indexed by integer or numeric vectors but found: %d\n", type);
+    }
+}
+
 bool are_indices_contiguous(SEXP/*INTSXP | REALSXP*/ indices) {
     SEXPTYPE type = TYPEOF(indices);
     make_sure(type == INTSXP || type == REALSXP, Rf_error, "type of indices should be either INTSXP or REALSXP");
@@ -154,10 +211,10 @@ bool do_integer_indices_contain_NAs(SEXP/*INTSXP*/ indices) {
     R_xlen_t size = XLENGTH(indices);
     for (int i = 0; i < size; i++) {
         if (INTEGER_ELT(indices, i) == NA_INTEGER) {
-            return false;
+            return true;
         }
     }
-    return true;
+    return false;
 }
 
 bool do_numeric_indices_contain_NAs(SEXP/*REALSXP*/ indices) {
@@ -165,10 +222,10 @@ bool do_numeric_indices_contain_NAs(SEXP/*REALSXP*/ indices) {
     R_xlen_t size = XLENGTH(indices);
     for (int i = 0; i < size; i++) {
         if (ISNAN(REAL_ELT(indices, i))) {
-            return false;
+            return true;
         }
     }
-    return true;
+    return false;
 }
 
 bool do_indices_contain_NAs(SEXP/*INTSXP | REALSXP*/ indices) {
@@ -182,6 +239,50 @@ bool do_indices_contain_NAs(SEXP/*INTSXP | REALSXP*/ indices) {
     }
 }
 
+// Negative indices exclude elements, as they do in R: they cannot be mixed with
+// positive indices or NAs, and zeros among them are ignored.
+bool are_indices_negative(SEXP/*INTSXP | REALSXP*/ indices) {
+    SEXPTYPE type = TYPEOF(indices);
+    make_sure(type == INTSXP || type == REALSXP, Rf_error, "type of indices should be either INTSXP or REALSXP");
+
+    bool any_negative = false;
+    bool any_positive = false;
+    bool any_NA       = false;
+    for (R_xlen_t i = 0; i < XLENGTH(indices); i++) {
+        double index = (type == INTSXP) ? (INTEGER_ELT(indices, i) == NA_INTEGER ? NA_REAL : INTEGER_ELT(indices, i))
+                                        : REAL_ELT(indices, i);
+        if (ISNAN(index))    any_NA       = true;
+        else if (index < 0)  any_negative = true;
+        else if (index >= 1) any_positive = true;
+    }
+
+    if (any_negative && any_positive) {
+        Rf_error("can't mix positive and negative subscripts");
+    }
+    if (any_negative && any_NA) {
+        Rf_error("can't mix NAs and negative subscripts");
+    }
+    return any_negative;
+}
+
+SEXP/*INTSXP*/ exclusion_bitmap(SEXP/*INTSXP | REALSXP*/ indices, R_xlen_t bitmap_size, R_xlen_t start, R_xlen_t size) {
+    SEXPTYPE type = TYPEOF(indices);
+    make_sure(type == INTSXP || type == REALSXP, Rf_error, "type of indices should be either INTSXP or REALSXP");
+
+    SEXP/*INTSXP*/ bitmap = PROTECT(bitmap_new(bitmap_size));
+    bitmap_set_range(bitmap, start, size);
+
+    for (R_xlen_t i = 0; i < XLENGTH(indices); i++) {
+        R_xlen_t index = (type == INTSXP) ? (R_xlen_t) INTEGER_ELT(indices, i) : (R_xlen_t) REAL_ELT(indices, i);
+        if (index < 0 && -index <= size) {
+            bitmap_reset(bitmap, start - index - 1);
+        }
+    }
+
+    UNPROTECT(1);
+    return bitmap;
+}
+
 R_xlen_t get_first_element_as_length(SEXP/*INTSXP | REALSXP*/ indices) {
     SEXPTYPE type = TYPEOF(indices);
     make_sure(type == INTSXP || type == REALSXP, Rf_error, "type of indices should be either INTSXP or REALSXP");
@@ -194,6 +295,31 @@ R_xlen_t get_first_element_as_length(SEXP/*INTSXP | REALSXP*/ indices) {
     }
 }
 
+// Counts, sizes and offsets given by the user are checked before the cast,
+// which is undefined for NA, NaN, infinities and values out of range.
+R_xlen_t get_first_element_as_whole_length(SEXP/*INTSXP | REALSXP*/ value, const char *name) {
+    SEXPTYPE type = TYPEOF(value);
+    make_sure(type == INTSXP || type == REALSXP, Rf_error, "type of %s should be either INTSXP or REALSXP", name);
+    make_sure(XLENGTH(value) > 0, Rf_error, "%s cannot be empty", name);
+
+    if (type == INTSXP) {
+        int element = INTEGER_ELT(value, 0);
+        if (element == NA_INTEGER) {
+            Rf_error("The value of %s cannot be NA", name);
+        }
+        return (R_xlen_t) element;
+    }
+
+    double element = REAL_ELT(value, 0);
+    if (!R_FINITE(element) || element != trunc(element)) {
+        Rf_error("The value of %s must be a finite whole number", name);
+    }
+    if (fabs(element) > (double) R_XLEN_T_MAX) {
+        Rf_error("The value of %s is too large", name);
+    }
+    return (R_xlen_t) element;
+}
+
 void copy_element(SEXP source, R_xlen_t source_index, SEXP target, R_xlen_t target_index) {
     make_sure(TYPEOF(source) == TYPEOF(target), Rf_error, "type of source and target must be the same");
     make_sure(TYPEOF(source) == INTSXP  || TYPEOF(source) == REALSXP || TYPEOF(source) == CPLXSXP
@@ -244,43 +370,190 @@ SEXP copy_data_in_range(SEXP source, R_xlen_t start, R_xlen_t size) {
     return target;
 }
 
+// Gathering from a source much larger than the cache misses the cache and the
+// TLB on almost every element. Above a threshold, indices are instead gathered
+// a chunk at a time: each chunk is radix-partitioned by the high bits of its
+// source indices, and then every partition is gathered in turn, so that
+// consecutive reads stay within one cache-sized range of the source, and the
+// values are scattered into their positions in the target. Chunks are small
+// enough for their part of the target to stay in the cache while scattering.
+//
+// The threshold is the size of the source in bytes. Below a few hundred
+// megabytes the plain loop is faster, since the hardware overlaps its misses
+// well enough.
+static R_xlen_t partitioned_gather_threshold = ((R_xlen_t) 1) << 28;
+
+#define how_many_indices_in_gather_chunk (1 << 18)
+#define how_many_gather_partitions_max   1024
+#define gather_partition_bytes_min       (256 * 1024)
+#define gather_prefetch_distance         16
+
+SEXP/*REALSXP*/ set_gather_threshold(SEXP/*INTSXP|REALSXP*/ threshold) {
+    make_sure(TYPEOF(threshold) == INTSXP || TYPEOF(threshold) == REALSXP, Rf_error,
+              "type of threshold must be either INTSXP or REALSXP");
+    make_sure(XLENGTH(threshold) > 0, Rf_error, "threshold must not be empty");
+
+    double previous = (double) partitioned_gather_threshold;
+    double value = (TYPEOF(threshold) == INTSXP) ? (double) INTEGER_ELT(threshold, 0) : REAL_ELT(threshold, 0);
+    partitioned_gather_threshold = (ISNAN(value) || value > (double) R_XLEN_T_MAX) ? R_XLEN_T_MAX : (R_xlen_t) value;
+    return ScalarReal(previous);
+}
+
+static inline size_t gatherable_element_size(SEXPTYPE type) {
+    switch (type) {
+        case INTSXP:
+        case LGLSXP:  return sizeof(int);
+        case REALSXP: return sizeof(double);
+        case CPLXSXP: return sizeof(Rcomplex);
+        case RAWSXP:  return sizeof(Rbyte);
+        default:      return 0;
+    }
+}
+
+static inline void move_element(char *target, const char *source, size_t element_size) {
+    switch (element_size) {
+        case sizeof(Rbyte):    *((Rbyte *)    target) = *((const Rbyte *)    source); break;
+        case sizeof(int):      *((int *)      target) = *((const int *)      source); break;
+        case sizeof(double):   *((double *)   target) = *((const double *)   source); break;
+        default:               memcpy(target, source, element_size);
+    }
+}
+
+// Reads a region of indices as zero-based positions, with -1 standing for NA.
+static void read_zero_based_indices(SEXP/*INTSXP|REALSXP*/ indices, R_xlen_t start, R_xlen_t size,
+                                    R_xlen_t *positions, void *buffer) {
+    if (TYPEOF(indices) == INTSXP) {
+        int *values = (int *) buffer;
+        INTEGER_GET_REGION(indices, start, size, values);
+        for (R_xlen_t i = 0; i < size; i++) {
+            positions[i] = (values[i] == NA_INTEGER) ? -1 : ((R_xlen_t) values[i]) - 1;
+        }
+    } else {
+        double *values = (double *) buffer;
+        REAL_GET_REGION(indices, start, size, values);
+        for (R_xlen_t i = 0; i < size; i++) {
+            positions[i] = ISNAN(values[i]) ? -1 : ((R_xlen_t) values[i]) - 1;
+        }
+    }
+}
+
+static bool gather_partitioned(SEXP source, SEXP/*INTSXP|REALSXP*/ indices, SEXP target) {
+    size_t element_size = gatherable_element_size(TYPEOF(source));
+    if (element_size == 0) {
+        return false;
+    }
+
+    R_xlen_t size          = XLENGTH(indices);
+    R_xlen_t source_length = XLENGTH(source);
+    if (size == 0 || (R_xlen_t) (source_length * element_size) < partitioned_gather_threshold) {
+        return false;
+    }
+    const char *source_data = (const char *) DATAPTR_OR_NULL(source);
+    if (source_data == NULL) {
+        return false;
+    }
+
+    // Partitions are no smaller than a cache-sized range of the source, and
+    // there are no more of them than the TLB can cover while scattering.
+    int shift = 0;
+    while ((((R_xlen_t) 1) << shift) * element_size < gather_partition_bytes_min) {
+        shift++;
+    }
+    while ((source_length >> shift) >= how_many_gather_partitions_max) {
+        shift++;
+    }
+    R_xlen_t how_many_partitions = (source_length >> shift) + 1;
+
+    R_xlen_t  chunk_size = (size < how_many_indices_in_gather_chunk) ? size : how_many_indices_in_gather_chunk;
+    R_xlen_t *positions  = (R_xlen_t *) R_alloc(chunk_size, sizeof(R_xlen_t));
+    R_xlen_t *sources    = (R_xlen_t *) R_alloc(chunk_size, sizeof(R_xlen_t));
+    int      *targets    = (int *)      R_alloc(chunk_size, sizeof(int));
+    double   *buffer     = (double *)   R_alloc(chunk_size, sizeof(double));
+    R_xlen_t *offsets    = (R_xlen_t *) R_alloc(how_many_partitions + 1, sizeof(R_xlen_t));
+
+    char *target_data = (char *) DATAPTR(target);
+
+    if (get_debug_mode()) {
+        Rprintf("gather_partitioned\n");
+        Rprintf("           size: %li\n", size);
+        Rprintf("     partitions: %li\n", how_many_partitions);
+        Rprintf("          shift: %i\n", shift);
+    }
+
+    for (R_xlen_t chunk_start = 0; chunk_start < size; chunk_start += chunk_size) {
+        R_xlen_t chunk_length = (size - chunk_start < chunk_size) ? size - chunk_start : chunk_size;
+        read_zero_based_indices(indices, chunk_start, chunk_length, positions, buffer);
+
+        // Count, then place, the indices of every partition; NAs are written
+        // out straight away.
+        memset(offsets, 0, (how_many_partitions + 1) * sizeof(R_xlen_t));
+        for (R_xlen_t i = 0; i < chunk_length; i++) {
+            if (positions[i] < 0) {
+                fill_with_NA(TYPEOF(target), target_data, chunk_start + i, 1);
+            } else {
+                offsets[(positions[i] >> shift) + 1]++;
+            }
+        }
+        for (R_xlen_t partition = 0; partition < how_many_partitions; partition++) {
+            offsets[partition + 1] += offsets[partition];
+        }
+        for (R_xlen_t i = 0; i < chunk_length; i++) {
+            if (positions[i] >= 0) {
+                R_xlen_t slot = offsets[positions[i] >> shift]++;
+                sources[slot] = positions[i];
+                targets[slot] = (int) i;
+            }
+        }
+
+        // After placing, every offset points at the end of its partition, so
+        // the partitions lie one after another from 0 to the last offset.
+        R_xlen_t placed = offsets[how_many_partitions - 1];
+        char *chunk_target = target_data + chunk_start * element_size;
+        for (R_xlen_t slot = 0; slot < placed; slot++) {
+            if (slot + gather_prefetch_distance < placed) {
+                __builtin_prefetch(source_data + sources[slot + gather_prefetch_distance] * element_size, 0, 0);
+            }
+            move_element(chunk_target + ((R_xlen_t) targets[slot]) * element_size,
+                         source_data + sources[slot] * element_size, element_size);
+        }
+    }
+
+    return true;
+}
+
 SEXP copy_data_at_indices(SEXP source, SEXP/*INTSXP | REALSXP*/ indices) {
 
     SEXPTYPE type = TYPEOF(indices);
     make_sure(type == INTSXP || type == REALSXP, Rf_error, "type of indices should be either INTSXP or REALSXP");
 
     R_xlen_t size = XLENGTH(indices);
-    SEXP target = allocVector(TYPEOF(source), size);
+    SEXP target = PROTECT(allocVector(TYPEOF(source), size));
 
-    switch (type) {
-        case INTSXP:  {
-            for (R_xlen_t i = 0; i < size; i++) {
-                int index = INTEGER_ELT(indices, i);
-                if (index == NA_INTEGER) {
-                	set_element_to_NA(target, i);
-                } else {
-                	copy_element(source, ((R_xlen_t) index) - 1, target, i);
-                }
-            }
-            break;
-        }
+    if (gather_partitioned(source, indices, target)) {
+        UNPROTECT(1);
+        return target;
+    }
 
-        case REALSXP: {
-            for (R_xlen_t i = 0; i < size; i++) {
-                double index = REAL_ELT(indices, i);
-                if (ISNAN(index)) {
-                  	set_element_to_NA(target, i);
-                } else {
-                    copy_element(source, ((R_xlen_t) index) - 1, target, i);
-                }
+    // Indices are read a chunk at a time, so that packed or run-encoded
+    // indices are decoded a block at a time rather than once per element.
+    R_xlen_t  chunk_size = (size < how_many_indices_in_gather_chunk) ? size : how_many_indices_in_gather_chunk;
+    R_xlen_t *positions  = (R_xlen_t *) R_alloc(chunk_size, sizeof(R_xlen_t));
+    double   *buffer     = (double *)   R_alloc(chunk_size, sizeof(double));
+
+    for (R_xlen_t chunk_start = 0; chunk_start < size; chunk_start += chunk_size) {
+        R_xlen_t chunk_length = (size - chunk_start < chunk_size) ? size - chunk_start : chunk_size;
+        read_zero_based_indices(indices, chunk_start, chunk_length, positions, buffer);
+
+        for (R_xlen_t i = 0; i < chunk_length; i++) {
+            if (positions[i] < 0) {
+                set_element_to_NA(target, chunk_start + i);
+            } else {
+                copy_element(source, positions[i], target, chunk_start + i);
             }
-            break;
         }
-
-        default:
-        	Rf_error("Unsupported vector type: %d\n", type);
     }
 
+    UNPROTECT(1);
     return target;
 }
 
@@ -357,3 +630,42 @@ SEXP/*REALSXP*/ screen_indices(SEXP/*INTSXP|REALSXP*/ original, R_xlen_t size) {
 
 	return translated;
 }
+
+R_xlen_t copy_region(SEXP source, R_xlen_t start, R_xlen_t size, void *buffer) {
+    switch (TYPEOF(source)) {
+        case INTSXP:  return INTEGER_GET_REGION(source, start, size, (int *)      buffer);
+        case REALSXP: return REAL_GET_REGION   (source, start, size, (double *)   buffer);
+        case LGLSXP:  return LOGICAL_GET_REGION(source, start, size, (int *)      buffer);
+        case CPLXSXP: return COMPLEX_GET_REGION(source, start, size, (Rcomplex *) buffer);
+        case RAWSXP:  return RAW_GET_REGION    (source, start, size, (Rbyte *)    buffer);
+        default:      Rf_error("Unsupported vector type: %d\n", TYPEOF(source));
+    }
+}
+
+void fill_with_NA(SEXPTYPE type, void *buffer, R_xlen_t start, R_xlen_t size) {
+    switch (type) {
+        case INTSXP:
+        case LGLSXP: {
+            int *integers = (int *) buffer;
+            for (R_xlen_t i = start; i < start + size; i++) integers[i] = NA_INTEGER;
+            break;
+        }
+        case REALSXP: {
+            double *doubles = (double *) buffer;
+            for (R_xlen_t i = start; i < start + size; i++) doubles[i] = NA_REAL;
+            break;
+        }
+        case CPLXSXP: {
+            Rcomplex NA_CPLX = { NA_REAL, NA_REAL };
+            Rcomplex *complexes = (Rcomplex *) buffer;
+            for (R_xlen_t i = start; i < start + size; i++) complexes[i] = NA_CPLX;
+            break;
+        }
+        case RAWSXP: {
+            memset(((Rbyte *) buffer) + start, 0, size);
+            break;
+        }
+        default:
+            Rf_error("Unsupported vector type: %d\n", type);
+    }
+}
@@ -15,10 +15,15 @@ viewport_type_t recommend_vieport_type_for_indices(SEXP/*INTSXP | REALSXP*/ indi
 
 bool are_indices_in_range  (SEXP/*INTSXP | REALSXP*/ indices, R_xlen_t min, R_xlen_t max);
 bool are_indices_contiguous(SEXP/*INTSXP | REALSXP*/ indices);
+bool are_indices_reverse_contiguous(SEXP/*INTSXP | REALSXP*/ indices);
 bool are_indices_monotonic (SEXP/*INTSXP | REALSXP*/ indices);
 bool do_indices_contain_NAs(SEXP/*INTSXP | REALSXP*/ indices);
+bool are_indices_negative  (SEXP/*INTSXP | REALSXP*/ indices);
+
+SEXP/*INTSXP*/ exclusion_bitmap(SEXP/*INTSXP | REALSXP*/ indices, R_xlen_t bitmap_size, R_xlen_t start, R_xlen_t size);
 
 R_xlen_t get_first_element_as_length(SEXP/*INTSXP | REALSXP*/ indices);
+R_xlen_t get_first_element_as_whole_length(SEXP/*INTSXP | REALSXP*/ value, const char *name);
 
 void 	        copy_element		 (SEXP source, R_xlen_t source_index, SEXP target, R_xlen_t target_index);
 void 	        set_element_to_NA	 (SEXP target, R_xlen_t target_index);
@@ -26,3 +31,6 @@ SEXP 	        copy_data_at_mask	 (SEXP source, SEXP/*LGLSXP*/ mask);
 SEXP 	        copy_data_at_indices (SEXP source, SEXP/*INTSXP | REALSXP*/ indices);
 SEXP 	 	    copy_data_in_range	 (SEXP source, R_xlen_t start, R_xlen_t size);
 SEXP/*REALSXP*/ screen_indices       (SEXP/*INTSXP|REALSXP*/ original, R_xlen_t size);
+R_xlen_t        copy_region          (SEXP source, R_xlen_t start, R_xlen_t size, void *buffer);
+void            fill_with_NA         (SEXPTYPE type, void *buffer, R_xlen_t start, R_xlen_t size);
+SEXP/*REALSXP*/ set_gather_threshold (SEXP/*INTSXP|REALSXP*/ threshold);
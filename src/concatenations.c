@@ -0,0 +1,618 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Altrep.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "common.h"
+
+#include "concatenations.h"
+#include "coercions.h"
+#include "slices.h"
+#include "aggregates.h"
+#include "zonemaps.h"
+#include "prefixsums.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// A concatenation is a view of several same-typed sources (chunks) one after
+// another. Next to the list of chunks it keeps a table of offsets: the i-th
+// offset is the position of the first element of the i-th chunk, and the last
+// offset is the length of the concatenation. Elements are found by a binary
+// search through the offsets.
+static R_altrep_class_t concatenation_integer_altrep;
+static R_altrep_class_t concatenation_numeric_altrep;
+static R_altrep_class_t concatenation_logical_altrep;
+static R_altrep_class_t concatenation_complex_altrep;
+static R_altrep_class_t concatenation_raw_altrep;
+
+static inline R_altrep_class_t class_from_sexp_type(SEXPTYPE type) { // @suppress("No return")
+    switch (type) {
+        case INTSXP:  return concatenation_integer_altrep;
+        case REALSXP: return concatenation_numeric_altrep;
+        case LGLSXP:  return concatenation_logical_altrep;
+        case CPLXSXP: return concatenation_complex_altrep;
+        case RAWSXP:  return concatenation_raw_altrep;
+        default:      Rf_error("No ALTREP concatenation class for vector of type %s", type2str(type));
+    }
+}
+
+SEXP concatenation_new(SEXP/*VECSXP*/ chunks) {
+    make_sure(TYPEOF(chunks) == VECSXP, Rf_error, "chunks must be a VECSXP");
+    make_sure(XLENGTH(chunks) > 0, Rf_error, "there must be at least one chunk");
+
+    R_xlen_t how_many_chunks = XLENGTH(chunks);
+    SEXPTYPE type = TYPEOF(VECTOR_ELT(chunks, 0));
+
+    if (get_debug_mode()) {
+        Rprintf("concatenation_new\n");
+        Rprintf("         chunks: %p\n", chunks);
+        Rprintf("          count: %li\n", how_many_chunks);
+    }
+
+    SEXP/*REALSXP*/ offsets = PROTECT(allocVector(REALSXP, how_many_chunks + 1));
+    R_xlen_t offset = 0;
+    for (R_xlen_t i = 0; i < how_many_chunks; i++) {
+        SEXP chunk = VECTOR_ELT(chunks, i);
+        make_sure(TYPEOF(chunk) == type, Rf_error, "all chunks must be of the same type");
+        SET_REAL_ELT(offsets, i, (double) offset);
+        offset += XLENGTH(chunk);
+    }
+    SET_REAL_ELT(offsets, how_many_chunks, (double) offset);
+
+    SEXP/*LISTSXP*/ data = PROTECT(allocSExp(LISTSXP));
+    SETCAR (data, chunks);     // The original vectors
+    SET_TAG(data, R_NilValue); // Starts as R_NilValue, becomes a vector if it the concatenation is written to
+    SETCDR (data, R_NilValue); // Nothing here
+
+    SEXP concatenation = R_new_altrep(class_from_sexp_type(type), offsets, data);
+    UNPROTECT(2);
+    return concatenation;
+}
+
+static inline SEXP/*REALSXP*/ get_offsets(SEXP x) {
+    return R_altrep_data1(x);
+}
+
+static inline SEXP/*VECSXP*/ get_chunks(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return CAR(cell);
+}
+
+static inline SEXP get_materialized_data(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell);
+}
+
+static inline void set_materialized_data(SEXP x, SEXP data) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    SET_TAG(cell, data);
+}
+
+static inline bool is_materialized(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell) != R_NilValue;
+}
+
+static inline R_xlen_t how_many_chunks(SEXP x) {
+    return XLENGTH(get_chunks(x));
+}
+
+static inline R_xlen_t chunk_offset(SEXP x, R_xlen_t chunk) {
+    return (R_xlen_t) REAL_ELT(get_offsets(x), chunk);
+}
+
+// The chunk containing the i-th element: the last chunk whose offset is not
+// greater than i. Empty chunks share their offset with the next chunk, so
+// the search always lands on a chunk that is not empty.
+static R_xlen_t find_chunk(SEXP x, R_xlen_t i) {
+    const double *offsets = REAL_RO(get_offsets(x));
+    R_xlen_t lower = 0;
+    R_xlen_t upper = how_many_chunks(x);
+    while (upper - lower > 1) {
+        R_xlen_t middle = lower + (upper - lower) / 2;
+        if ((R_xlen_t) offsets[middle] <= i) {
+            lower = middle;
+        } else {
+            upper = middle;
+        }
+    }
+    return lower;
+}
+
+SEXP concatenation_duplicate(SEXP x, Rboolean deep) {
+
+    if (get_debug_mode()) {
+        Rprintf("concatenation_duplicate\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           deep: %i\n", deep);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    SEXP concatenation = PROTECT(concatenation_new(get_chunks(x)));
+    if (is_materialized(x)) {
+        SEXP data = get_materialized_data(x);
+        set_materialized_data(concatenation, deep ? duplicate(data) : data);
+    }
+    UNPROTECT(1);
+    return concatenation;
+}
+
+static Rboolean concatenation_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+
+    Rprintf("concatenation_altrep %s\n", type2char(TYPEOF(x)));
+
+    inspect_subtree(R_altrep_data1(x), pre, deep, pvec);
+    inspect_subtree(R_altrep_data2(x), pre, deep, pvec);
+
+    return FALSE;
+}
+
+static R_xlen_t concatenation_length(SEXP x) {
+    if (get_debug_mode()) {
+        Rprintf("concatenation_length\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return chunk_offset(x, how_many_chunks(x));
+}
+
+// Copies a region spanning any number of chunks, one region per chunk.
+static R_xlen_t copy_concatenated_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    SEXP/*VECSXP*/ chunks = get_chunks(x);
+    R_xlen_t length = concatenation_length(x);
+    R_xlen_t size   = (length - i < n) ? length - i : n;
+    size_t   element_size = __get_element_size(TYPEOF(x));
+
+    R_xlen_t copied = 0;
+    for (R_xlen_t chunk = find_chunk(x, i); copied < size; chunk++) {
+        R_xlen_t start = i + copied - chunk_offset(x, chunk);
+        R_xlen_t available = chunk_offset(x, chunk + 1) - (i + copied);
+        R_xlen_t count = (size - copied < available) ? size - copied : available;
+        if (count > 0) {
+            copy_region(VECTOR_ELT(chunks, chunk), start, count, (char *) buf + copied * element_size);
+            copied += count;
+        }
+    }
+    return size;
+}
+
+static SEXP materialize(SEXP x) {
+    R_xlen_t size = concatenation_length(x);
+    SEXP data = PROTECT(allocVector(TYPEOF(x), size));
+    copy_concatenated_region(x, 0, size, DATAPTR(data));
+    UNPROTECT(1);
+    return data;
+}
+
+static void *concatenation_dataptr(SEXP x, Rboolean writeable) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("concatenation_dataptr\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("      writeable: %i\n", writeable);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (!is_materialized(x)) {
+        set_materialized_data(x, materialize(x));
+    }
+
+    SEXP data = get_materialized_data(x);
+    return writeable ? DATAPTR(data) : (void *) DATAPTR_RO(data);
+}
+
+static const void *concatenation_dataptr_or_null(SEXP x) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("concatenation_dataptr_or_null\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    if (is_materialized(x)) {
+        return DATAPTR_RO(get_materialized_data(x));
+    }
+
+    // A concatenation of a single chunk is just that chunk.
+    if (how_many_chunks(x) == 1) {
+        return DATAPTR_OR_NULL(VECTOR_ELT(get_chunks(x), 0));
+    }
+
+    return NULL;
+}
+
+static int concatenation_integer_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("concatenation_integer_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return INTEGER_ELT(get_materialized_data(x), i);
+    }
+
+    R_xlen_t chunk = find_chunk(x, i);
+    return INTEGER_ELT(VECTOR_ELT(get_chunks(x), chunk), i - chunk_offset(x, chunk));
+}
+
+static double concatenation_numeric_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("concatenation_numeric_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return REAL_ELT(get_materialized_data(x), i);
+    }
+
+    R_xlen_t chunk = find_chunk(x, i);
+    return REAL_ELT(VECTOR_ELT(get_chunks(x), chunk), i - chunk_offset(x, chunk));
+}
+
+static int concatenation_logical_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("concatenation_logical_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return LOGICAL_ELT(get_materialized_data(x), i);
+    }
+
+    R_xlen_t chunk = find_chunk(x, i);
+    return LOGICAL_ELT(VECTOR_ELT(get_chunks(x), chunk), i - chunk_offset(x, chunk));
+}
+
+static Rcomplex concatenation_complex_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("concatenation_complex_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return COMPLEX_ELT(get_materialized_data(x), i);
+    }
+
+    R_xlen_t chunk = find_chunk(x, i);
+    return COMPLEX_ELT(VECTOR_ELT(get_chunks(x), chunk), i - chunk_offset(x, chunk));
+}
+
+static Rbyte concatenation_raw_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("concatenation_raw_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return RAW_ELT(get_materialized_data(x), i);
+    }
+
+    R_xlen_t chunk = find_chunk(x, i);
+    return RAW_ELT(VECTOR_ELT(get_chunks(x), chunk), i - chunk_offset(x, chunk));
+}
+
+static R_xlen_t concatenation_get_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("concatenation_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return copy_region(get_materialized_data(x), i, n, buf);
+    }
+
+    return copy_concatenated_region(x, i, n, buf);
+}
+
+static R_xlen_t concatenation_integer_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    return concatenation_get_region(x, i, n, buf);
+}
+
+static R_xlen_t concatenation_numeric_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    return concatenation_get_region(x, i, n, buf);
+}
+
+static R_xlen_t concatenation_logical_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    return concatenation_get_region(x, i, n, buf);
+}
+
+static R_xlen_t concatenation_complex_get_region(SEXP x, R_xlen_t i, R_xlen_t n, Rcomplex *buf) {
+    return concatenation_get_region(x, i, n, buf);
+}
+
+static R_xlen_t concatenation_raw_get_region(SEXP x, R_xlen_t i, R_xlen_t n, Rbyte *buf) {
+    return concatenation_get_region(x, i, n, buf);
+}
+
+// Min, Max, and Sum are combined from the results for individual chunks,
+// each of which can be answered from the chunk's own indexes.
+static void concatenation_extremes(SEXP x, extremes_t *extremes) {
+    SEXP/*VECSXP*/ chunks = get_chunks(x);
+
+    extremes_init(extremes);
+    for (R_xlen_t i = 0; i < XLENGTH(chunks); i++) {
+        SEXP chunk = VECTOR_ELT(chunks, i);
+        extremes_t chunk_extremes;
+        extremes_init(&chunk_extremes);
+        if (!zone_map_extremes(chunk, 0, XLENGTH(chunk), &chunk_extremes)) {
+            extremes_of_region(chunk, 0, XLENGTH(chunk), &chunk_extremes);
+        }
+        extremes_merge(extremes, &chunk_extremes);
+    }
+}
+
+static SEXP concatenation_min(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("concatenation_min\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    extremes_t extremes;
+    concatenation_extremes(x, &extremes);
+    return extremes_min_as_sexp(TYPEOF(x), &extremes, concatenation_length(x), narm);
+}
+
+static SEXP concatenation_max(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("concatenation_max\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    extremes_t extremes;
+    concatenation_extremes(x, &extremes);
+    return extremes_max_as_sexp(TYPEOF(x), &extremes, concatenation_length(x), narm);
+}
+
+static SEXP concatenation_sum(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("concatenation_sum\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    SEXP/*VECSXP*/ chunks = get_chunks(x);
+
+    double   sum = 0;
+    R_xlen_t NAs = 0;
+    for (R_xlen_t i = 0; i < XLENGTH(chunks); i++) {
+        SEXP chunk = VECTOR_ELT(chunks, i);
+        double   chunk_sum = 0;
+        R_xlen_t chunk_NAs = 0;
+        SEXP/*VECSXP*/ prefix_sums = prefix_sums_get(chunk);
+        if (prefix_sums == R_NilValue || !prefix_sums_of_region(prefix_sums, 0, XLENGTH(chunk), &chunk_sum, &chunk_NAs)) {
+            sum_of_region(chunk, 0, XLENGTH(chunk), &chunk_sum, &chunk_NAs);
+        }
+        sum += chunk_sum;
+        NAs += chunk_NAs;
+    }
+
+    return sum_as_sexp(TYPEOF(x), sum, NAs, narm);
+}
+
+// A contiguous selection becomes a slice if it falls within a single chunk,
+// and a concatenation of slices of the chunks it spans otherwise.
+static SEXP extract_contiguous(SEXP x, R_xlen_t start, R_xlen_t size) {
+    SEXP/*VECSXP*/ chunks = get_chunks(x);
+
+    R_xlen_t first_chunk = find_chunk(x, start);
+    R_xlen_t last_chunk  = find_chunk(x, start + size - 1);
+
+    if (first_chunk == last_chunk) {
+        return slice_new(VECTOR_ELT(chunks, first_chunk), start - chunk_offset(x, first_chunk), size);
+    }
+
+    SEXP/*VECSXP*/ parts = PROTECT(allocVector(VECSXP, last_chunk - first_chunk + 1));
+    for (R_xlen_t chunk = first_chunk; chunk <= last_chunk; chunk++) {
+        R_xlen_t chunk_start = chunk_offset(x, chunk);
+        R_xlen_t chunk_end   = chunk_offset(x, chunk + 1);
+        R_xlen_t part_start  = (start > chunk_start) ? start : chunk_start;
+        R_xlen_t part_end    = (start + size < chunk_end) ? start + size : chunk_end;
+
+        SEXP chunk_source = VECTOR_ELT(chunks, chunk);
+        SEXP part = (part_start == chunk_start && part_end == chunk_end)
+                  ? chunk_source
+                  : slice_new(chunk_source, part_start - chunk_start, part_end - part_start);
+        SET_VECTOR_ELT(parts, chunk - first_chunk, part);
+    }
+
+    SEXP concatenation = concatenation_new(parts);
+    UNPROTECT(1);
+    return concatenation;
+}
+
+static SEXP concatenation_extract_subset(SEXP x, SEXP indices, SEXP call) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("concatenation_extract_subset\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("        indices: %p\n", indices);
+        Rprintf("           call: %p\n", call);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    // No indices.
+    R_xlen_t size = XLENGTH(indices);
+    if (size == 0) {
+        return allocVector(TYPEOF(x), 0);
+    }
+
+    if (is_materialized(x)) {
+        return copy_data_at_indices(get_materialized_data(x), indices);
+    }
+
+    // Anything else is gathered by R element by element.
+    if (!are_indices_in_range(indices, 1, concatenation_length(x)) || !are_indices_contiguous(indices)) {
+        return NULL;
+    }
+
+    return extract_contiguous(x, get_first_element_as_length(indices) - 1, size);
+}
+
+static SEXP concatenation_coerce(SEXP x, int type) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("concatenation_coerce\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           type: %s\n", type2char(type));
+    }
+
+    return coerce_view(x, type);
+}
+
+static void init_common_concatenation(R_altrep_class_t cls) {
+    R_set_altrep_Duplicate_method(cls, concatenation_duplicate);
+    R_set_altrep_Inspect_method(cls, concatenation_inspect);
+    R_set_altrep_Length_method(cls, concatenation_length);
+    R_set_altrep_Coerce_method(cls, concatenation_coerce);
+
+    R_set_altvec_Dataptr_method(cls, concatenation_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, concatenation_dataptr_or_null);
+    R_set_altvec_Extract_subset_method(cls, concatenation_extract_subset);
+}
+
+void init_concatenation_integer_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altinteger_class("concatenation_integer_altrep", "viewports", dll);
+    concatenation_integer_altrep = cls;
+
+    init_common_concatenation(cls);
+
+    R_set_altinteger_Elt_method(cls, concatenation_integer_element);
+    R_set_altinteger_Get_region_method(cls, concatenation_integer_get_region);
+    R_set_altinteger_Min_method(cls, concatenation_min);
+    R_set_altinteger_Max_method(cls, concatenation_max);
+    R_set_altinteger_Sum_method(cls, concatenation_sum);
+}
+
+void init_concatenation_numeric_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altreal_class("concatenation_numeric_altrep", "viewports", dll);
+    concatenation_numeric_altrep = cls;
+
+    init_common_concatenation(cls);
+
+    R_set_altreal_Elt_method(cls, concatenation_numeric_element);
+    R_set_altreal_Get_region_method(cls, concatenation_numeric_get_region);
+    R_set_altreal_Min_method(cls, concatenation_min);
+    R_set_altreal_Max_method(cls, concatenation_max);
+    R_set_altreal_Sum_method(cls, concatenation_sum);
+}
+
+void init_concatenation_logical_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altlogical_class("concatenation_logical_altrep", "viewports", dll);
+    concatenation_logical_altrep = cls;
+
+    init_common_concatenation(cls);
+
+    R_set_altlogical_Elt_method(cls, concatenation_logical_element);
+    R_set_altlogical_Get_region_method(cls, concatenation_logical_get_region);
+    R_set_altlogical_Sum_method(cls, concatenation_sum);
+}
+
+void init_concatenation_complex_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altcomplex_class("concatenation_complex_altrep", "viewports", dll);
+    concatenation_complex_altrep = cls;
+
+    init_common_concatenation(cls);
+
+    R_set_altcomplex_Elt_method(cls, concatenation_complex_element);
+    R_set_altcomplex_Get_region_method(cls, concatenation_complex_get_region);
+}
+
+void init_concatenation_raw_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altraw_class("concatenation_raw_altrep", "viewports", dll);
+    concatenation_raw_altrep = cls;
+
+    init_common_concatenation(cls);
+
+    R_set_altraw_Elt_method(cls, concatenation_raw_element);
+    R_set_altraw_Get_region_method(cls, concatenation_raw_get_region);
+}
+
+void init_concatenation_altrep_class(DllInfo * dll) {
+    init_concatenation_integer_altrep_class(dll);
+    init_concatenation_numeric_altrep_class(dll);
+    init_concatenation_logical_altrep_class(dll);
+    init_concatenation_complex_altrep_class(dll);
+    init_concatenation_raw_altrep_class(dll);
+}
+
+SEXP create_concatenation(SEXP/*VECSXP*/ chunks) {
+    make_sure(TYPEOF(chunks) == VECSXP, Rf_error, "chunks must be a list");
+
+    if (XLENGTH(chunks) == 0) {
+        Rf_error("At least one vector is needed to create a concatenation");
+    }
+
+    SEXPTYPE type = TYPEOF(VECTOR_ELT(chunks, 0));
+    for (R_xlen_t i = 0; i < XLENGTH(chunks); i++) {
+        if (TYPEOF(VECTOR_ELT(chunks, i)) != type) {
+            Rf_error("All vectors in a concatenation must be of the same type, "
+                     "but vector %li is of type %s rather than %s",
+                     i + 1, type2char(TYPEOF(VECTOR_ELT(chunks, i))), type2char(type));
+        }
+    }
+
+    if (get_debug_mode()) {
+        Rprintf("create concatenation\n");
+        Rprintf("         chunks: %p\n", chunks);
+    }
+
+    return concatenation_new(chunks);
+}
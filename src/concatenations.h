@@ -0,0 +1,9 @@
+#pragma once
+
+#include "Rinternals.h"
+
+SEXP concatenation_new(SEXP/*VECSXP*/ chunks);
+
+SEXP create_concatenation(SEXP/*VECSXP*/ chunks);
+
+void init_concatenation_altrep_class(DllInfo *dll);
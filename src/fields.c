@@ -0,0 +1,454 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Altrep.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "common.h"
+
+#include "fields.h"
+#include "mosaics.h"
+#include "prisms.h"
+#include "coercions.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// A field view shows one field of a sequence of fixed-size binary records
+// kept in a raw vector. Its i-th element is decoded from the bytes starting
+// at first + i * record_size, in the byte order of this machine. The other
+// fields of the records are never read.
+static R_altrep_class_t field_integer_altrep;
+static R_altrep_class_t field_numeric_altrep;
+static R_altrep_class_t field_logical_altrep;
+
+static inline R_altrep_class_t class_from_sexp_type(SEXPTYPE type) { // @suppress("No return")
+    switch (type) {
+        case INTSXP:  return field_integer_altrep;
+        case REALSXP: return field_numeric_altrep;
+        case LGLSXP:  return field_logical_altrep;
+        default:      Rf_error("No ALTREP field class for vector of type %s", type2str(type));
+    }
+}
+
+typedef struct {
+    R_xlen_t first;       // Byte offset of the field in the first record
+    R_xlen_t record_size; // Bytes from one record to the next
+    R_xlen_t count;       // Number of records
+} layout_t;
+
+static SEXP/*REALSXP*/ write_layout(const layout_t *layout) {
+    SEXP/*REALSXP*/ descriptor = allocVector(REALSXP, 3);
+    SET_REAL_ELT(descriptor, 0, (double) layout->first);
+    SET_REAL_ELT(descriptor, 1, (double) layout->record_size);
+    SET_REAL_ELT(descriptor, 2, (double) layout->count);
+    return descriptor;
+}
+
+static void read_layout(SEXP/*REALSXP*/ descriptor, layout_t *layout) {
+    layout->first       = (R_xlen_t) REAL_ELT(descriptor, 0);
+    layout->record_size = (R_xlen_t) REAL_ELT(descriptor, 1);
+    layout->count       = (R_xlen_t) REAL_ELT(descriptor, 2);
+}
+
+static SEXP field_new(SEXP/*RAWSXP*/ source, SEXPTYPE type, const layout_t *layout) {
+    make_sure(TYPEOF(source) == RAWSXP, Rf_error, "type of source must be RAWSXP");
+    make_sure(type == INTSXP || type == REALSXP || type == LGLSXP, Rf_error,
+              "type must be one of INTSXP, REALSXP, or LGLSXP");
+    make_sure(layout->count == 0 || layout->first + (layout->count - 1) * layout->record_size
+                                  + (R_xlen_t) __get_element_size(type) <= XLENGTH(source), Rf_error,
+              "all records must fit within the length of source");
+
+    if (get_debug_mode()) {
+        Rprintf("field_new\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("           type: %s\n", type2char(type));
+        Rprintf("          first: %li\n", layout->first);
+        Rprintf("    record size: %li\n", layout->record_size);
+        Rprintf("          count: %li\n", layout->count);
+    }
+
+    SEXP/*REALSXP*/ descriptor = PROTECT(write_layout(layout));
+
+    SEXP/*LISTSXP*/ data = PROTECT(allocSExp(LISTSXP));
+    SETCAR (data, source);     // The original vector
+    SET_TAG(data, R_NilValue); // Starts as R_NilValue, becomes a vector if it the field is written to
+    SETCDR (data, R_NilValue); // Nothing here
+
+    SEXP field = R_new_altrep(class_from_sexp_type(type), descriptor, data);
+    UNPROTECT(2);
+    return field;
+}
+
+static inline void get_layout(SEXP x, layout_t *layout) {
+    read_layout(R_altrep_data1(x), layout);
+}
+
+static inline SEXP get_source(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return CAR(cell);
+}
+
+static inline SEXP get_materialized_data(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell);
+}
+
+static inline void set_materialized_data(SEXP x, SEXP data) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    SET_TAG(cell, data);
+}
+
+static inline bool is_materialized(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell) != R_NilValue;
+}
+
+// Gathers size fields, stride bytes apart, into the buffer.
+static void gather_fields(const Rbyte *bytes, R_xlen_t stride, size_t element_size, R_xlen_t size, void *buf) {
+    Rbyte *target = (Rbyte *) buf;
+    for (R_xlen_t i = 0; i < size; i++) {
+        memcpy(target + i * element_size, bytes + i * stride, element_size);
+    }
+}
+
+static R_xlen_t copy_field_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    SEXP source = get_source(x);
+
+    layout_t layout;
+    get_layout(x, &layout);
+
+    size_t   element_size = __get_element_size(TYPEOF(x));
+    R_xlen_t size         = (layout.count - i < n) ? layout.count - i : n;
+    R_xlen_t start        = layout.first + i * layout.record_size;
+
+    const Rbyte *bytes = (const Rbyte *) DATAPTR_OR_NULL(source);
+    if (bytes != NULL) {
+        gather_fields(bytes + start, layout.record_size, element_size, size, buf);
+        return size;
+    }
+
+    // Sources without a data pointer are read one field at a time.
+    Rbyte *target = (Rbyte *) buf;
+    for (R_xlen_t j = 0; j < size; j++) {
+        copy_region(source, start + j * layout.record_size, element_size, target + j * element_size);
+    }
+    return size;
+}
+
+SEXP field_duplicate(SEXP x, Rboolean deep) {
+
+    if (get_debug_mode()) {
+        Rprintf("field_duplicate\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           deep: %i\n", deep);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    layout_t layout;
+    get_layout(x, &layout);
+
+    SEXP field = PROTECT(field_new(get_source(x), TYPEOF(x), &layout));
+    if (is_materialized(x)) {
+        SEXP data = get_materialized_data(x);
+        set_materialized_data(field, deep ? duplicate(data) : data);
+    }
+    UNPROTECT(1);
+    return field;
+}
+
+static Rboolean field_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+
+    Rprintf("field_altrep %s\n", type2char(TYPEOF(x)));
+
+    inspect_subtree(R_altrep_data1(x), pre, deep, pvec);
+    inspect_subtree(R_altrep_data2(x), pre, deep, pvec);
+
+    return FALSE;
+}
+
+static R_xlen_t field_length(SEXP x) {
+    if (get_debug_mode()) {
+        Rprintf("field_length\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    layout_t layout;
+    get_layout(x, &layout);
+    return layout.count;
+}
+
+static SEXP materialize(SEXP x) {
+    SEXP data = PROTECT(allocVector(TYPEOF(x), XLENGTH(x)));
+    copy_field_region(x, 0, XLENGTH(data), DATAPTR(data));
+    UNPROTECT(1);
+    return data;
+}
+
+static void *field_dataptr(SEXP x, Rboolean writeable) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("field_dataptr\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("      writeable: %i\n", writeable);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (!is_materialized(x)) {
+        set_materialized_data(x, materialize(x));
+    }
+
+    SEXP data = get_materialized_data(x);
+    return writeable ? DATAPTR(data) : (void *) DATAPTR_RO(data);
+}
+
+static const void *field_dataptr_or_null(SEXP x) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("field_dataptr_or_null\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return is_materialized(x) ? DATAPTR_RO(get_materialized_data(x)) : NULL;
+}
+
+static int field_integer_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("field_integer_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return INTEGER_ELT(get_materialized_data(x), i);
+    }
+
+    int element = 0;
+    copy_field_region(x, i, 1, &element);
+    return element;
+}
+
+static double field_numeric_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("field_numeric_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return REAL_ELT(get_materialized_data(x), i);
+    }
+
+    double element = 0;
+    copy_field_region(x, i, 1, &element);
+    return element;
+}
+
+static int field_logical_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("field_logical_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return LOGICAL_ELT(get_materialized_data(x), i);
+    }
+
+    int element = 0;
+    copy_field_region(x, i, 1, &element);
+    return element;
+}
+
+static R_xlen_t field_get_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("field_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return copy_region(get_materialized_data(x), i, n, buf);
+    }
+
+    return copy_field_region(x, i, n, buf);
+}
+
+static R_xlen_t field_integer_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    return field_get_region(x, i, n, buf);
+}
+
+static R_xlen_t field_numeric_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    return field_get_region(x, i, n, buf);
+}
+
+static R_xlen_t field_logical_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    return field_get_region(x, i, n, buf);
+}
+
+// Contiguous records are a field view of fewer records. Other selections of
+// records are mosaics or prisms over the field view, so the selected fields
+// are still decoded only when they are read.
+static SEXP field_extract_subset(SEXP x, SEXP indices, SEXP call) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("field_extract_subset\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("        indices: %p\n", indices);
+        Rprintf("           call: %p\n", call);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    R_xlen_t size = XLENGTH(indices);
+    if (size == 0) {
+        return allocVector(TYPEOF(x), 0);
+    }
+
+    if (is_materialized(x)) {
+        return copy_data_at_indices(get_materialized_data(x), indices);
+    }
+
+    layout_t layout;
+    get_layout(x, &layout);
+
+    // Out of range indices produce NAs, which R takes care of.
+    if (!are_indices_in_range(indices, 1, layout.count)) {
+        return NULL;
+    }
+
+    if (are_indices_contiguous(indices)) {
+        R_xlen_t first = get_first_element_as_length(indices) - 1;
+        layout_t subset = {
+            .first       = layout.first + first * layout.record_size,
+            .record_size = layout.record_size,
+            .count       = size,
+        };
+        return field_new(get_source(x), TYPEOF(x), &subset);
+    }
+
+    return are_indices_monotonic(indices) ? create_mosaic(x, indices) : create_prism(x, indices);
+}
+
+static SEXP field_coerce(SEXP x, int type) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("field_coerce\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           type: %s\n", type2char(type));
+    }
+
+    return coerce_view(x, type);
+}
+
+static void init_common_field(R_altrep_class_t cls) {
+    R_set_altrep_Duplicate_method(cls, field_duplicate);
+    R_set_altrep_Inspect_method(cls, field_inspect);
+    R_set_altrep_Length_method(cls, field_length);
+    R_set_altrep_Coerce_method(cls, field_coerce);
+
+    R_set_altvec_Dataptr_method(cls, field_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, field_dataptr_or_null);
+    R_set_altvec_Extract_subset_method(cls, field_extract_subset);
+}
+
+void init_field_integer_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altinteger_class("field_integer_altrep", "viewports", dll);
+    field_integer_altrep = cls;
+
+    init_common_field(cls);
+
+    R_set_altinteger_Elt_method(cls, field_integer_element);
+    R_set_altinteger_Get_region_method(cls, field_integer_get_region);
+}
+
+void init_field_numeric_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altreal_class("field_numeric_altrep", "viewports", dll);
+    field_numeric_altrep = cls;
+
+    init_common_field(cls);
+
+    R_set_altreal_Elt_method(cls, field_numeric_element);
+    R_set_altreal_Get_region_method(cls, field_numeric_get_region);
+}
+
+void init_field_logical_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altlogical_class("field_logical_altrep", "viewports", dll);
+    field_logical_altrep = cls;
+
+    init_common_field(cls);
+
+    R_set_altlogical_Elt_method(cls, field_logical_element);
+    R_set_altlogical_Get_region_method(cls, field_logical_get_region);
+}
+
+void init_field_altrep_class(DllInfo * dll) {
+    init_field_integer_altrep_class(dll);
+    init_field_numeric_altrep_class(dll);
+    init_field_logical_altrep_class(dll);
+}
+
+static SEXPTYPE type_from_name(const char *name) { // @suppress("No return")
+    if (strcmp(name, "integer") == 0) return INTSXP;
+    if (strcmp(name, "double")  == 0) return REALSXP;
+    if (strcmp(name, "numeric") == 0) return REALSXP;
+    if (strcmp(name, "logical") == 0) return LGLSXP;
+    Rf_error("Fields can only be integer, double, or logical, but found: %s", name);
+}
+
+SEXP create_field_view(SEXP/*RAWSXP*/ source, SEXP/*INTSXP|REALSXP*/ record_size_sexp,
+                       SEXP/*INTSXP|REALSXP*/ field_offset_sexp, SEXP/*STRSXP*/ type_sexp) {
+    make_sure(TYPEOF(source) == RAWSXP, Rf_error, "type of source must be RAWSXP");
+    make_sure(TYPEOF(type_sexp) == STRSXP && XLENGTH(type_sexp) > 0, Rf_error, "type must be a character vector");
+
+    SEXPTYPE type         = type_from_name(CHAR(STRING_ELT(type_sexp, 0)));
+    R_xlen_t element_size = (R_xlen_t) __get_element_size(type);
+    R_xlen_t record_size  = get_first_element_as_whole_length(record_size_sexp,  "record_size");
+    R_xlen_t field_offset = get_first_element_as_whole_length(field_offset_sexp, "field_offset");
+
+    if (record_size < element_size) {
+        Rf_error("Records must be at least as large as the field");
+    }
+    if (field_offset < 0 || field_offset + element_size > record_size) {
+        Rf_error("The field must fit within the record");
+    }
+
+    // Trailing bytes that do not make up a whole record are ignored.
+    layout_t layout = {
+        .first       = field_offset,
+        .record_size = record_size,
+        .count       = XLENGTH(source) / record_size,
+    };
+
+    if (get_debug_mode()) {
+        Rprintf("create field view\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("           type: %s\n", type2char(type));
+        Rprintf("    record size: %li\n", record_size);
+        Rprintf("   field offset: %li\n", field_offset);
+    }
+
+    return field_new(source, type, &layout);
+}
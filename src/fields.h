@@ -0,0 +1,8 @@
+#pragma once
+
+#include "Rinternals.h"
+
+SEXP create_field_view(SEXP/*RAWSXP*/ source, SEXP/*INTSXP|REALSXP*/ record_size,
+                       SEXP/*INTSXP|REALSXP*/ field_offset, SEXP/*STRSXP*/ type);
+
+void init_field_altrep_class(DllInfo *dll);
@@ -0,0 +1,426 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "bitmap_sexp.h"
+
+#include "filters.h"
+#include "mosaics.h"
+#include "zonemaps.h"
+#include "aggregates.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// Predicates are evaluated one bitmap word at a time: every kernel below reads
+// up to 32 consecutive elements and returns the word of bits selecting them.
+// All comparison operators are first normalized into a closed range, so that
+// there are only a handful of kernels, each a pair of SIMD compares.
+
+static inline uint32_t mask_of_first_bits(int count) {
+    return count >= how_many_bits_in_bitmap_word ? UINT32_MAX : (((uint32_t) 1) << count) - 1;
+}
+
+static inline uint32_t numeric_range_word(const double *values, int count, double lower, double upper) {
+    uint32_t word = 0;
+    int j = 0;
+#ifdef __SSE2__
+    __m128d lowers = _mm_set1_pd(lower);
+    __m128d uppers = _mm_set1_pd(upper);
+    for (; j + 2 <= count; j += 2) {
+        __m128d current = _mm_loadu_pd(values + j);
+        __m128d inside  = _mm_and_pd(_mm_cmpge_pd(current, lowers), _mm_cmple_pd(current, uppers));
+        word |= ((uint32_t) _mm_movemask_pd(inside)) << j;
+    }
+#endif
+    for (; j < count; j++) {
+        word |= ((uint32_t) ((values[j] >= lower) & (values[j] <= upper))) << j;
+    }
+    return word;
+}
+
+static inline uint32_t numeric_NA_word(const double *values, int count) {
+    uint32_t word = 0;
+    int j = 0;
+#ifdef __SSE2__
+    for (; j + 2 <= count; j += 2) {
+        __m128d current = _mm_loadu_pd(values + j);
+        word |= ((uint32_t) _mm_movemask_pd(_mm_cmpunord_pd(current, current))) << j;
+    }
+#endif
+    for (; j < count; j++) {
+        word |= ((uint32_t) (values[j] != values[j])) << j;
+    }
+    return word;
+}
+
+// The range check is done as a single unsigned comparison of the offset from
+// the lower bound. SSE2 has no unsigned comparison, so the sign bits are
+// flipped on both sides and a signed comparison is used instead.
+static inline uint32_t integer_range_word(const int *values, int count, int lower, int upper) {
+    uint32_t width = ((uint32_t) upper) - ((uint32_t) lower);
+    uint32_t word = 0;
+    int j = 0;
+#ifdef __SSE2__
+    __m128i signs  = _mm_set1_epi32(INT_MIN);
+    __m128i lowers = _mm_set1_epi32(lower);
+    __m128i widths = _mm_xor_si128(_mm_set1_epi32((int) width), signs);
+    for (; j + 4 <= count; j += 4) {
+        __m128i current = _mm_loadu_si128((const __m128i *) (values + j));
+        __m128i offsets = _mm_xor_si128(_mm_sub_epi32(current, lowers), signs);
+        __m128i outside = _mm_cmpgt_epi32(offsets, widths);
+        word |= ((uint32_t) (~_mm_movemask_ps(_mm_castsi128_ps(outside)) & 0xF)) << j;
+    }
+#endif
+    for (; j < count; j++) {
+        word |= ((uint32_t) ((((uint32_t) values[j]) - ((uint32_t) lower)) <= width)) << j;
+    }
+    return word;
+}
+
+static inline uint32_t integer_NA_word(const int *values, int count) {
+    uint32_t word = 0;
+    int j = 0;
+#ifdef __SSE2__
+    __m128i NAs = _mm_set1_epi32(NA_INTEGER);
+    for (; j + 4 <= count; j += 4) {
+        __m128i current = _mm_loadu_si128((const __m128i *) (values + j));
+        word |= ((uint32_t) _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(current, NAs)))) << j;
+    }
+#endif
+    for (; j < count; j++) {
+        word |= ((uint32_t) (values[j] == NA_INTEGER)) << j;
+    }
+    return word;
+}
+
+uint32_t evaluate_predicate_on_word(SEXPTYPE type, const void *values, int count, const predicate_t *predicate) {
+    make_sure(count > 0 && count <= how_many_bits_in_bitmap_word, Rf_error, "word must contain between 1 and 32 elements");
+
+    uint32_t in_word = mask_of_first_bits(count);
+
+    if (type == REALSXP) {
+        const double *doubles = (const double *) values;
+        switch (predicate->kind) {
+            case PREDICATE_NOTHING:   return 0;
+            case PREDICATE_RANGE:     return numeric_range_word(doubles, count, predicate->lower, predicate->upper);
+            case PREDICATE_IS_NA:     return numeric_NA_word(doubles, count);
+            case PREDICATE_NOT_NA:    return ~numeric_NA_word(doubles, count) & in_word;
+            case PREDICATE_NOT_RANGE: return ~(numeric_range_word(doubles, count, predicate->lower, predicate->upper)
+                                              | numeric_NA_word(doubles, count)) & in_word;
+        }
+    } else {
+        const int *integers = (const int *) values;
+        switch (predicate->kind) {
+            case PREDICATE_NOTHING:   return 0;
+            case PREDICATE_RANGE:     return integer_range_word(integers, count, predicate->integer_lower, predicate->integer_upper);
+            case PREDICATE_IS_NA:     return integer_NA_word(integers, count);
+            case PREDICATE_NOT_NA:    return ~integer_NA_word(integers, count) & in_word;
+            case PREDICATE_NOT_RANGE: return ~(integer_range_word(integers, count, predicate->integer_lower, predicate->integer_upper)
+                                              | integer_NA_word(integers, count)) & in_word;
+        }
+    }
+
+    make_sure(false, Rf_error, "unreachable");
+    return 0;
+}
+
+// Integers ranges exclude NA_INTEGER (INT_MIN), so that NAs are never selected
+// by a range. A range that becomes empty after rounding selects nothing, and
+// its negation selects everything but NA.
+static void compute_integer_bounds(predicate_t *predicate) {
+    if (predicate->kind != PREDICATE_RANGE && predicate->kind != PREDICATE_NOT_RANGE) {
+        return;
+    }
+
+    double lower = ceil(predicate->lower);
+    double upper = floor(predicate->upper);
+    if (lower < (double) (INT_MIN + 1)) lower = (double) (INT_MIN + 1);
+    if (upper > (double) INT_MAX)       upper = (double) INT_MAX;
+
+    if (lower > upper) {
+        predicate->kind = (predicate->kind == PREDICATE_RANGE) ? PREDICATE_NOTHING : PREDICATE_NOT_NA;
+        return;
+    }
+
+    predicate->integer_lower = (int) lower;
+    predicate->integer_upper = (int) upper;
+}
+
+static double expect_operand(SEXP/*REALSXP*/ operand, R_xlen_t index, const char *operator) {
+    if (TYPEOF(operand) != REALSXP || XLENGTH(operand) <= index) {
+        Rf_error("Operator `%s` expects %li operand(s)", operator, index + 1);
+    }
+    double value = REAL_ELT(operand, index);
+    if (ISNAN(value)) {
+        Rf_error("Operands of operator `%s` cannot be NA", operator);
+    }
+    return value;
+}
+
+predicate_t parse_predicate(SEXPTYPE source_type, const char *operator, SEXP/*REALSXP*/ operand) {
+    predicate_t predicate = { .kind = PREDICATE_RANGE, .lower = R_NegInf, .upper = R_PosInf };
+
+    // Nothing is below -Inf or above Inf, so strict comparisons with these
+    // select nothing, rather than the infinities themselves.
+    if (strcmp(operator, "<") == 0) {
+        double value = expect_operand(operand, 0, operator);
+        if (value == R_NegInf) {
+            predicate.kind = PREDICATE_NOTHING;
+        } else {
+            predicate.upper = nextafter(value, R_NegInf);
+        }
+    } else if (strcmp(operator, "<=") == 0) {
+        predicate.upper = expect_operand(operand, 0, operator);
+    } else if (strcmp(operator, "==") == 0) {
+        predicate.lower = predicate.upper = expect_operand(operand, 0, operator);
+    } else if (strcmp(operator, "!=") == 0) {
+        predicate.kind  = PREDICATE_NOT_RANGE;
+        predicate.lower = predicate.upper = expect_operand(operand, 0, operator);
+    } else if (strcmp(operator, ">=") == 0) {
+        predicate.lower = expect_operand(operand, 0, operator);
+    } else if (strcmp(operator, ">") == 0) {
+        double value = expect_operand(operand, 0, operator);
+        if (value == R_PosInf) {
+            predicate.kind = PREDICATE_NOTHING;
+        } else {
+            predicate.lower = nextafter(value, R_PosInf);
+        }
+    } else if (strcmp(operator, "between") == 0) {
+        predicate.lower = expect_operand(operand, 0, operator);
+        predicate.upper = expect_operand(operand, 1, operator);
+        if (predicate.lower > predicate.upper) {
+            predicate.kind = PREDICATE_NOTHING;
+        }
+    } else if (strcmp(operator, "is.na") == 0) {
+        predicate.kind = PREDICATE_IS_NA;
+    } else {
+        Rf_error("Unknown operator `%s`, expecting one of: < <= == != >= > between is.na", operator);
+    }
+
+    if (source_type != REALSXP) {
+        compute_integer_bounds(&predicate);
+    }
+
+    return predicate;
+}
+
+// Classifies a block of the source summarized by a zone map as one in which a
+// predicate selects no elements, all elements, or possibly some elements.
+block_coverage_t classify_block(SEXPTYPE type, const predicate_t *predicate, const extremes_t *extremes,
+                                R_xlen_t block_size) {
+    bool no_values  = extremes->NAs == block_size;
+    bool no_NAs     = extremes->NAs == 0;
+
+    double lower = (type == REALSXP) ? predicate->lower : (double) predicate->integer_lower;
+    double upper = (type == REALSXP) ? predicate->upper : (double) predicate->integer_upper;
+    bool all_values_inside  = extremes->min >= lower && extremes->max <= upper;
+    bool all_values_outside = extremes->max < lower  || extremes->min > upper;
+
+    switch (predicate->kind) {
+        case PREDICATE_NOTHING:
+            return BLOCK_NONE;
+        case PREDICATE_RANGE:
+            if (no_values || all_values_outside) return BLOCK_NONE;
+            if (no_NAs && all_values_inside)     return BLOCK_ALL;
+            return BLOCK_SOME;
+        case PREDICATE_NOT_RANGE:
+            if (no_values || all_values_inside)  return BLOCK_NONE;
+            if (no_NAs && all_values_outside)    return BLOCK_ALL;
+            return BLOCK_SOME;
+        case PREDICATE_IS_NA:
+            if (no_NAs)    return BLOCK_NONE;
+            if (no_values) return BLOCK_ALL;
+            return BLOCK_SOME;
+        case PREDICATE_NOT_NA:
+            if (no_values) return BLOCK_NONE;
+            if (no_NAs)    return BLOCK_ALL;
+            return BLOCK_SOME;
+    }
+
+    make_sure(false, Rf_error, "unreachable");
+    return BLOCK_SOME;
+}
+
+static R_xlen_t evaluate_predicates_on_zone(SEXP source, const void *data, R_xlen_t zone_start, R_xlen_t zone_size,
+                                            const predicate_t **predicates, int how_many_predicates,
+                                            uint32_t *words) {
+    SEXPTYPE type = TYPEOF(source);
+    size_t element_size = __get_element_size(type);
+    double buffer[how_many_elements_in_filter_block];
+
+    R_xlen_t selected = 0;
+    for (R_xlen_t block_start = zone_start; block_start < zone_start + zone_size;
+         block_start += how_many_elements_in_filter_block) {
+
+        R_xlen_t block_size = zone_start + zone_size - block_start < how_many_elements_in_filter_block
+                            ? zone_start + zone_size - block_start : how_many_elements_in_filter_block;
+
+        // Sources that do not expose a data pointer are read one block at a time.
+        const char *block;
+        if (data != NULL) {
+            block = ((const char *) data) + block_start * element_size;
+        } else if (type == REALSXP) {
+            REAL_GET_REGION(source, block_start, block_size, buffer);
+            block = (const char *) buffer;
+        } else {
+            INTEGER_GET_REGION(source, block_start, block_size, (int *) buffer);
+            block = (const char *) buffer;
+        }
+
+        for (R_xlen_t offset = 0; offset < block_size; offset += how_many_bits_in_bitmap_word) {
+            int count = block_size - offset < how_many_bits_in_bitmap_word
+                      ? (int) (block_size - offset) : how_many_bits_in_bitmap_word;
+            const void *values = block + offset * element_size;
+
+            // Conjunction: later predicates are only evaluated while some bits survive.
+            uint32_t word = evaluate_predicate_on_word(type, values, count, predicates[0]);
+            for (int p = 1; p < how_many_predicates && word != 0; p++) {
+                word &= evaluate_predicate_on_word(type, values, count, predicates[p]);
+            }
+
+            words[(block_start + offset) / how_many_bits_in_bitmap_word] = word;
+            selected += __builtin_popcount(word);
+        }
+    }
+
+    return selected;
+}
+
+static R_xlen_t select_whole_zone(R_xlen_t zone_start, R_xlen_t zone_size, uint32_t *words) {
+    for (R_xlen_t offset = 0; offset < zone_size; offset += how_many_bits_in_bitmap_word) {
+        int count = zone_size - offset < how_many_bits_in_bitmap_word
+                  ? (int) (zone_size - offset) : how_many_bits_in_bitmap_word;
+        words[(zone_start + offset) / how_many_bits_in_bitmap_word] = mask_of_first_bits(count);
+    }
+    return zone_size;
+}
+
+// The bitmap is expected to be empty. If the source has a zone map, the
+// source is processed one zone map block at a time, and predicates that
+// select all elements of a block are not evaluated on it. Blocks where any
+// predicate selects nothing are not read at all, and neither is the source if
+// a predicate can select nothing anywhere.
+R_xlen_t evaluate_predicates_into_bitmap(SEXP/*INTSXP|REALSXP|LGLSXP*/ source,
+                                         const predicate_t *predicates, int how_many_predicates,
+                                         SEXP/*INTSXP*/ bitmap) {
+    SEXPTYPE type = TYPEOF(source);
+    make_sure(type == INTSXP || type == REALSXP || type == LGLSXP, Rf_error,
+              "type of source must be one of INTSXP, REALSXP, or LGLSXP");
+    make_sure(XTRUELENGTH(bitmap) == XLENGTH(source), Rf_error, "bitmap must be the same length as source");
+    make_sure(how_many_predicates > 0, Rf_error, "there must be at least one predicate");
+
+    R_xlen_t size = XLENGTH(source);
+    uint32_t *words = bitmap_words(bitmap);
+    // A predicate that selects nothing makes the whole conjunction empty.
+    for (int p = 0; p < how_many_predicates; p++) {
+        if (predicates[p].kind == PREDICATE_NOTHING) {
+            return 0;
+        }
+    }
+
+    const void *data = DATAPTR_OR_NULL(source);
+
+    SEXP zone_map = zone_map_get(source);
+    R_xlen_t zone_size = (zone_map == R_NilValue) ? how_many_elements_in_filter_block : zone_map_block_size(zone_map);
+
+    const predicate_t **active_predicates =
+        (const predicate_t **) R_alloc(how_many_predicates, sizeof(const predicate_t *));
+
+    R_xlen_t selected = 0;
+    for (R_xlen_t zone_start = 0; zone_start < size; zone_start += zone_size) {
+        R_xlen_t current_zone_size = size - zone_start < zone_size ? size - zone_start : zone_size;
+
+        block_coverage_t coverage = BLOCK_SOME;
+        int how_many_active_predicates = 0;
+
+        if (zone_map == R_NilValue) {
+            for (int p = 0; p < how_many_predicates; p++) {
+                active_predicates[how_many_active_predicates++] = &predicates[p];
+            }
+        } else {
+            extremes_t extremes;
+            zone_map_block(zone_map, zone_start / zone_size, &extremes);
+
+            coverage = BLOCK_ALL;
+            for (int p = 0; p < how_many_predicates; p++) {
+                block_coverage_t predicate_coverage = classify_block(type, &predicates[p], &extremes, current_zone_size);
+                if (predicate_coverage == BLOCK_NONE) {
+                    coverage = BLOCK_NONE;
+                    break;
+                }
+                if (predicate_coverage == BLOCK_SOME) {
+                    coverage = BLOCK_SOME;
+                    active_predicates[how_many_active_predicates++] = &predicates[p];
+                }
+            }
+        }
+
+        switch (coverage) {
+            case BLOCK_NONE: break;
+            case BLOCK_ALL:  selected += select_whole_zone(zone_start, current_zone_size, words); break;
+            case BLOCK_SOME: selected += evaluate_predicates_on_zone(source, data, zone_start, current_zone_size,
+                                                                     active_predicates, how_many_active_predicates,
+                                                                     words);
+                             break;
+        }
+    }
+
+    return selected;
+}
+
+predicate_t *parse_predicates(SEXPTYPE source_type, SEXP/*STRSXP*/ operators, SEXP/*VECSXP*/ operands) {
+    make_sure(TYPEOF(operators) == STRSXP, Rf_error, "type of operators must be STRSXP");
+    make_sure(TYPEOF(operands) == VECSXP, Rf_error, "type of operands must be VECSXP");
+
+    R_xlen_t how_many_predicates = XLENGTH(operators);
+    if (how_many_predicates == 0) {
+        Rf_error("At least one operator is required");
+    }
+    if (XLENGTH(operands) != how_many_predicates) {
+        Rf_error("There must be as many operands as there are operators");
+    }
+
+    predicate_t *predicates = (predicate_t *) R_alloc(how_many_predicates, sizeof(predicate_t));
+    for (R_xlen_t i = 0; i < how_many_predicates; i++) {
+        SEXP operator = STRING_ELT(operators, i);
+        if (operator == NA_STRING) {
+            Rf_error("Operators cannot be NA");
+        }
+        predicates[i] = parse_predicate(source_type, CHAR(operator), VECTOR_ELT(operands, i));
+    }
+    return predicates;
+}
+
+SEXP/*A*/ create_mosaic_where(SEXP/*A*/ source, SEXP/*STRSXP*/ operators, SEXP/*VECSXP*/ operands) {
+    SEXPTYPE source_type = TYPEOF(source);
+    make_sure(source_type == INTSXP || source_type == REALSXP || source_type == LGLSXP, Rf_error,
+              "type of source must be one of INTSXP, REALSXP, or LGLSXP");
+
+    predicate_t *predicates = parse_predicates(source_type, operators, operands);
+
+    if (get_debug_mode()) {
+        Rprintf("create mosaic where\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("     predicates: %li\n", XLENGTH(operators));
+    }
+
+    SEXP/*INTSXP*/ bitmap = PROTECT(bitmap_new(XLENGTH(source)));
+    R_xlen_t how_many_set_bits = evaluate_predicates_into_bitmap(source, predicates, (int) XLENGTH(operators), bitmap);
+    SEXP mosaic = mosaic_new(source, bitmap, how_many_set_bits);
+    UNPROTECT(1);
+    return mosaic;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Rinternals.h"
+#include <stdint.h>
+
+#include "aggregates.h"
+
+#define how_many_elements_in_filter_block 1024
+
+typedef enum {
+    PREDICATE_RANGE,     // lower <= x <= upper
+    PREDICATE_NOT_RANGE, // x is not NA and not within [lower, upper]
+    PREDICATE_IS_NA,
+    PREDICATE_NOT_NA,
+    PREDICATE_NOTHING,
+} predicate_kind_t;
+
+typedef struct {
+    predicate_kind_t kind;
+    double lower;        // Bounds used for REALSXP sources.
+    double upper;
+    int integer_lower;   // Bounds used for INTSXP and LGLSXP sources.
+    int integer_upper;
+} predicate_t;
+
+typedef enum {
+    BLOCK_NONE,
+    BLOCK_SOME,
+    BLOCK_ALL,
+} block_coverage_t;
+
+predicate_t  parse_predicate           (SEXPTYPE source_type, const char *operator, SEXP/*REALSXP*/ operand);
+predicate_t *parse_predicates          (SEXPTYPE source_type, SEXP/*STRSXP*/ operators, SEXP/*VECSXP*/ operands);
+uint32_t     evaluate_predicate_on_word(SEXPTYPE type, const void *values, int count, const predicate_t *predicate);
+block_coverage_t classify_block       (SEXPTYPE type, const predicate_t *predicate, const extremes_t *extremes,
+                                       R_xlen_t block_size);
+R_xlen_t     evaluate_predicates_into_bitmap(SEXP/*INTSXP|REALSXP|LGLSXP*/ source,
+                                             const predicate_t *predicates, int how_many_predicates,
+                                             SEXP/*INTSXP*/ bitmap);
+
+SEXP/*A*/ create_mosaic_where(SEXP/*A*/ source, SEXP/*STRSXP*/ operators, SEXP/*VECSXP*/ operands);
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "bitmap_sexp.h"
+#include "common.h"
+
+#include "frames.h"
+#include "mosaics.h"
+#include "prisms.h"
+#include "packedindices.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// A frame view selects the same rows from every column of a data frame. The
+// selection is built once, as a bitmap if the rows are in increasing order or
+// as a vector of indices otherwise, and every column gets a mosaic or a prism
+// referring to that one selection object.
+//
+// If the columns are themselves views sharing a single selection, as they are
+// when the frame was returned by an earlier frame_view, the new rows are
+// translated through that selection once and the new views are created over
+// the original columns.
+
+typedef enum {
+    SELECTION_NONE,
+    SELECTION_MOSAIC,
+    SELECTION_PRISM,
+} selection_kind_t;
+
+static inline bool is_viewable_type(SEXPTYPE type) {
+    return type == INTSXP || type == REALSXP || type == LGLSXP || type == CPLXSXP || type == RAWSXP;
+}
+
+// Finds out whether all viewable columns are views sharing one selection.
+static selection_kind_t find_shared_selection(SEXP/*VECSXP*/ columns, SEXP *selection) {
+    selection_kind_t kind = SELECTION_NONE;
+    *selection = R_NilValue;
+
+    for (R_xlen_t i = 0; i < XLENGTH(columns); i++) {
+        SEXP column = VECTOR_ELT(columns, i);
+        if (!is_viewable_type(TYPEOF(column))) {
+            continue;
+        }
+
+        SEXP source = R_NilValue;
+        SEXP column_selection = R_NilValue;
+        selection_kind_t column_kind = SELECTION_NONE;
+        if (mosaic_selection(column, &source, &column_selection)) {
+            column_kind = SELECTION_MOSAIC;
+        } else if (prism_selection(column, &source, &column_selection)) {
+            column_kind = SELECTION_PRISM;
+        }
+
+        if (column_kind == SELECTION_NONE) {
+            return SELECTION_NONE;
+        }
+        if (kind == SELECTION_NONE) {
+            kind = column_kind;
+            *selection = column_selection;
+        } else if (kind != column_kind || *selection != column_selection) {
+            return SELECTION_NONE;
+        }
+    }
+
+    return kind;
+}
+
+static SEXP/*REALSXP*/ gather_indices(SEXP/*INTSXP|REALSXP*/ indices, SEXP/*INTSXP|REALSXP*/ rows) {
+    R_xlen_t size = XLENGTH(rows);
+    SEXP/*REALSXP*/ gathered = PROTECT(allocVector(REALSXP, size));
+    for (R_xlen_t i = 0; i < size; i++) {
+        R_xlen_t row = (TYPEOF(rows) == INTSXP) ? INTEGER_ELT(rows, i) : (R_xlen_t) REAL_ELT(rows, i);
+        double index = (TYPEOF(indices) == INTSXP) ? (double) INTEGER_ELT(indices, row - 1)
+                                                   : REAL_ELT(indices, row - 1);
+        SET_REAL_ELT(gathered, i, index);
+    }
+    UNPROTECT(1);
+    return gathered;
+}
+
+SEXP/*VECSXP*/ create_frame_view(SEXP/*VECSXP*/ columns, SEXP/*INTSXP|REALSXP*/ rows, SEXP/*INTSXP|REALSXP*/ length_sexp) {
+    make_sure(TYPEOF(columns) == VECSXP, Rf_error, "columns must be a VECSXP");
+    make_sure(TYPEOF(rows) == INTSXP || TYPEOF(rows) == REALSXP, Rf_error,
+              "type of rows must be either INTSXP or REALSXP");
+    make_sure(TYPEOF(length_sexp) == INTSXP || TYPEOF(length_sexp) == REALSXP, Rf_error,
+              "type of length must be either INTSXP or REALSXP");
+
+    R_xlen_t length = get_first_element_as_length(length_sexp);
+    R_xlen_t size   = XLENGTH(rows);
+
+    if (do_indices_contain_NAs(rows)) {
+        Rf_error("Rows cannot contain NA");
+    }
+    if (size > 0 && !are_indices_in_range(rows, 1, length)) {
+        Rf_error("Rows must be between 1 and the number of rows of the frame");
+    }
+
+    SEXP shared_selection = R_NilValue;
+    selection_kind_t shared_kind = find_shared_selection(columns, &shared_selection);
+
+    if (get_debug_mode()) {
+        Rprintf("create frame view\n");
+        Rprintf("        columns: %li\n", XLENGTH(columns));
+        Rprintf("           rows: %li\n", size);
+        Rprintf("  shared select: %i\n", shared_kind);
+    }
+
+    // Rows selected from views are first translated into rows of their sources.
+    SEXP/*INTSXP|REALSXP*/ indices = rows;
+    SEXP/*INTSXP*/         bitmap  = R_NilValue;
+    PROTECT_INDEX indices_protection;
+    PROTECT_WITH_INDEX(indices, &indices_protection);
+
+    if (shared_kind == SELECTION_PRISM) {
+        indices = gather_indices(shared_selection, rows);
+        REPROTECT(indices, indices_protection);
+    }
+
+    bool monotonic = (size == 0) || are_indices_monotonic(indices);
+    R_xlen_t source_length = length;
+    if (shared_kind == SELECTION_MOSAIC) {
+        SEXP first_source = R_NilValue;
+        for (R_xlen_t i = 0; first_source == R_NilValue; i++) {
+            SEXP ignored = R_NilValue;
+            mosaic_selection(VECTOR_ELT(columns, i), &first_source, &ignored);
+        }
+        source_length = XLENGTH(first_source);
+        if (monotonic) {
+            bitmap = translate_bitmap(first_source, shared_selection, rows);
+        } else {
+            indices = coerceVector(rows, REALSXP);
+            REPROTECT(indices, indices_protection);
+            indices = translate_indices_by_bitmap(indices, shared_selection);
+            REPROTECT(indices, indices_protection);
+        }
+    } else {
+        if (shared_kind == SELECTION_PRISM) {
+            source_length = -1;
+            for (R_xlen_t i = 0; source_length < 0; i++) {
+                SEXP source = R_NilValue;
+                SEXP ignored = R_NilValue;
+                if (prism_selection(VECTOR_ELT(columns, i), &source, &ignored)) {
+                    source_length = XLENGTH(source);
+                }
+            }
+        }
+        if (monotonic) {
+            bitmap = bitmap_new(source_length);
+            convert_indices_to_bitmap(indices, bitmap);
+        }
+    }
+    PROTECT(bitmap);
+
+    // Indices are encoded once here rather than in prism_new, so that all the
+    // prisms still share one selection object.
+    if (!monotonic) {
+        indices = encode_indices(indices, source_length);
+        REPROTECT(indices, indices_protection);
+    }
+
+    SEXP/*VECSXP*/ views = PROTECT(allocVector(VECSXP, XLENGTH(columns)));
+    for (R_xlen_t i = 0; i < XLENGTH(columns); i++) {
+        SEXP column = VECTOR_ELT(columns, i);
+        if (!is_viewable_type(TYPEOF(column))) {
+            SET_VECTOR_ELT(views, i, R_NilValue);
+            continue;
+        }
+
+        SEXP source = column;
+        SEXP ignored = R_NilValue;
+        if (shared_kind == SELECTION_MOSAIC) {
+            mosaic_selection(column, &source, &ignored);
+        } else if (shared_kind == SELECTION_PRISM) {
+            prism_selection(column, &source, &ignored);
+        }
+
+        SEXP view = monotonic ? mosaic_new(source, bitmap, size) : prism_new(source, indices);
+        SET_VECTOR_ELT(views, i, view);
+    }
+
+    UNPROTECT(3);
+    return views;
+}
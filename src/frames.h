@@ -0,0 +1,5 @@
+#pragma once
+
+#include "Rinternals.h"
+
+SEXP/*VECSXP*/ create_frame_view(SEXP/*VECSXP*/ columns, SEXP/*INTSXP|REALSXP*/ rows, SEXP/*INTSXP|REALSXP*/ length);
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+
+#include "debug.h"
+
+#include "indexes.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// Indexes are kept in an attribute of their source, so that they are found
+// without a search and collected together with the source. The attribute
+// holds an external pointer whose tag is a VECSXP with one slot per kind of
+// index.
+//
+// R copies attributes into duplicates of the source and into the results of
+// arithmetic on it, but the contents of those vectors may differ from the
+// source. The external pointer therefore protects the attribute cell of the
+// source it was made for, and an index is only used if it hangs off that
+// same cell: every other vector carrying the attribute has a cell of its own.
+//
+// Indexes describe the source at the time they are built. Writing to the
+// source does not update them, so sources should be indexed again after they
+// are modified in place.
+static SEXP/*SYMSXP*/ index_symbol = NULL;
+
+static SEXP/*SYMSXP*/ get_index_symbol() {
+    if (index_symbol == NULL) {
+        index_symbol = install("viewports.indexes");
+    }
+    return index_symbol;
+}
+
+static SEXP/*LISTSXP*/ find_attribute_cell(SEXP source) {
+    for (SEXP/*LISTSXP*/ cell = ATTRIB(source); cell != R_NilValue; cell = CDR(cell)) {
+        if (TAG(cell) == get_index_symbol()) {
+            return cell;
+        }
+    }
+    return R_NilValue;
+}
+
+static SEXP/*VECSXP*/ find_slots(SEXP source) {
+    SEXP/*LISTSXP*/ cell = find_attribute_cell(source);
+    if (cell == R_NilValue) {
+        return R_NilValue;
+    }
+
+    SEXP/*EXTPTRSXP*/ pointer = CAR(cell);
+    if (TYPEOF(pointer) != EXTPTRSXP || R_ExternalPtrProtected(pointer) != cell) {
+        return R_NilValue;              // Copied over from another vector.
+    }
+    return R_ExternalPtrTag(pointer);
+}
+
+SEXP index_get(SEXP source, index_kind_t kind) {
+    make_sure(kind < how_many_index_kinds, Rf_error, "unknown kind of index");
+
+    SEXP/*VECSXP*/ slots = find_slots(source);
+    if (slots == R_NilValue) {
+        return R_NilValue;
+    }
+    return VECTOR_ELT(slots, kind);
+}
+
+void index_set(SEXP source, index_kind_t kind, SEXP index) {
+    make_sure(kind < how_many_index_kinds, Rf_error, "unknown kind of index");
+
+    if (get_debug_mode()) {
+        Rprintf("index_set\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("           kind: %i\n", kind);
+        Rprintf("          index: %p\n", index);
+    }
+
+    SEXP/*VECSXP*/ slots = find_slots(source);
+    if (slots == R_NilValue) {
+        slots = PROTECT(allocVector(VECSXP, how_many_index_kinds));
+        SEXP/*EXTPTRSXP*/ pointer = PROTECT(R_MakeExternalPtr(NULL, slots, R_NilValue));
+        setAttrib(source, get_index_symbol(), pointer);
+        R_SetExternalPtrProtected(pointer, find_attribute_cell(source));
+        UNPROTECT(2);
+    }
+
+    SET_VECTOR_ELT(slots, kind, index);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "Rinternals.h"
+
+typedef enum {
+    INDEX_ZONE_MAP,
+    INDEX_PREFIX_SUMS,
+    how_many_index_kinds,
+} index_kind_t;
+
+SEXP index_get(SEXP source, index_kind_t kind);                // R_NilValue if there is no such index
+void index_set(SEXP source, index_kind_t kind, SEXP index);
@@ -1,7 +1,27 @@
 #include "debug.h"
+#include "common.h"
 #include "slices.h"
 #include "mosaics.h"
 #include "prisms.h"
+#include "splits.h"
+#include "filters.h"
+#include "zonemaps.h"
+#include "prefixsums.h"
+#include "rolling.h"
+#include "shifts.h"
+#include "reversals.h"
+#include "concatenations.h"
+#include "repetitions.h"
+#include "submatrices.h"
+#include "frames.h"
+#include "coercions.h"
+#include "reinterpretations.h"
+#include "fields.h"
+#include "scalings.h"
+#include "bits.h"
+#include "packedindices.h"
+#include "mosaicindices.h"
+#include "resamplings.h"
 
 #include <R_ext/Rdynload.h>
 #include <R_ext/Visibility.h>
@@ -13,9 +33,39 @@ static const R_CallMethodDef CallEntries[] = {
     {"mosaic",  (DL_FUNC) &create_mosaic, 2},
     {"prism",  (DL_FUNC) &create_prism, 2},
 
+    {"split_sorted",  (DL_FUNC) &create_split_sorted, 2},
+    {"range_view",  (DL_FUNC) &create_range_view, 3},
+
+    {"mosaic_where",  (DL_FUNC) &create_mosaic_where, 3},
+    {"mosaic_combination",  (DL_FUNC) &create_mosaic_combination, 3},
+    {"mosaic_indices",  (DL_FUNC) &create_mosaic_indices, 1},
+    {"mosaic_source",  (DL_FUNC) &get_mosaic_source, 1},
+    {"zone_map",  (DL_FUNC) &create_zone_map, 2},
+    {"prefix_sums",  (DL_FUNC) &create_prefix_sums, 1},
+    {"rolling_sum",  (DL_FUNC) &create_rolling_sum, 2},
+    {"rolling_mean",  (DL_FUNC) &create_rolling_mean, 2},
+    {"window_apply",  (DL_FUNC) &create_window_apply, 5},
+
+    {"shift",  (DL_FUNC) &create_shift, 2},
+    {"reversal",  (DL_FUNC) &create_reversal, 1},
+    {"concat_view",  (DL_FUNC) &create_concatenation, 1},
+    {"repetition",  (DL_FUNC) &create_repetition, 3},
+    {"submatrix",  (DL_FUNC) &create_submatrix, 3},
+    {"frame_view",  (DL_FUNC) &create_frame_view, 3},
+    {"view_as",  (DL_FUNC) &create_reinterpretation, 5},
+    {"field_view",  (DL_FUNC) &create_field_view, 4},
+    {"scaled_view",  (DL_FUNC) &create_scaling, 4},
+    {"as_bits",  (DL_FUNC) &create_bits, 1},
+    {"bits_where",  (DL_FUNC) &create_bits_where, 3},
+    {"bootstrap_views",  (DL_FUNC) &create_bootstrap_views, 3},
+    {"sample_view",  (DL_FUNC) &create_sample_view, 5},
+
     // Turn on debug mode.
     {"viewport_set_debug_mode",  (DL_FUNC) &set_debug_mode,  1},
 
+    // Tune the size above which prisms are gathered partition by partition.
+    {"viewport_set_gather_threshold",  (DL_FUNC) &set_gather_threshold,  1},
+
     // Terminates the function list. Necessary.
     {NULL, NULL, 0} 
 };
@@ -24,6 +74,20 @@ void attribute_visible R_init_viewports(DllInfo *dll) {
     init_slice_altrep_class(dll);
     init_mosaic_altrep_class(dll);
     init_prism_altrep_class(dll);
+    init_rolling_altrep_class(dll);
+    init_shift_altrep_class(dll);
+    init_reversal_altrep_class(dll);
+    init_concatenation_altrep_class(dll);
+    init_repetition_altrep_class(dll);
+    init_submatrix_altrep_class(dll);
+    init_coercion_altrep_class(dll);
+    init_reinterpretation_altrep_class(dll);
+    init_field_altrep_class(dll);
+    init_scaling_altrep_class(dll);
+    init_bits_altrep_class(dll);
+    init_packed_indices_altrep_class(dll);
+    init_mosaic_indices_altrep_class(dll);
+    init_resampling_altrep_class(dll);
 }
 
 void attribute_visible R_unload_viewports(DllInfo *dll) {
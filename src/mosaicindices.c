@@ -0,0 +1,421 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Altrep.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "bitmap_sexp.h"
+#include "common.h"
+
+#include "mosaicindices.h"
+#include "mosaics.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// Mosaic indices are the positions of the elements a mosaic selects from its
+// source, as which() would return them for its mask, read straight from the
+// bitmap of the mosaic. They are integers if the source is short enough,
+// doubles otherwise.
+//
+// Set bits are found by counting bits word by word. The word where the last
+// lookup ended is remembered, so reading the indices in order, one element at a
+// time, does not start over from the first word every time. Other lookups
+// start from a rank directory, built on the first of them: the number of set
+// bits before every block of words. A binary search over the directory finds
+// the block holding the bit, and only the words of that block are counted.
+#define how_many_words_in_rank_block 64
+
+// Lookups keep a VECSXP: the cursor, and the rank directory once it is built.
+#define LOOKUP_CURSOR 0
+#define LOOKUP_RANKS  1
+
+static R_altrep_class_t mosaic_indices_integer_altrep;
+static R_altrep_class_t mosaic_indices_numeric_altrep;
+
+static inline R_altrep_class_t class_from_sexp_type(SEXPTYPE type) { // @suppress("No return")
+    switch (type) {
+        case INTSXP:  return mosaic_indices_integer_altrep;
+        case REALSXP: return mosaic_indices_numeric_altrep;
+        default:      Rf_error("No ALTREP mosaic indices class for vector of type %s", type2str(type));
+    }
+}
+
+SEXP mosaic_indices_new(SEXP/*INTSXP*/ bitmap, SEXP/*REALSXP*/ length_vector, SEXPTYPE type) {
+    make_sure(TYPEOF(bitmap) == INTSXP, Rf_error, "type of bitmap must be INTSXP");
+    make_sure(type == INTSXP || type == REALSXP, Rf_error, "type of mosaic indices must be either INTSXP or REALSXP");
+
+    if (get_debug_mode()) {
+        Rprintf("mosaic_indices_new\n");
+        Rprintf("         bitmap: %p\n", bitmap);
+        Rprintf("           type: %s\n", type2char(type));
+    }
+
+    // The first ordinal counted in a word, and that word.
+    SEXP/*VECSXP*/  lookup = PROTECT(allocVector(VECSXP, 2));
+    SEXP/*REALSXP*/ cursor = allocVector(REALSXP, 2);
+    SET_VECTOR_ELT(lookup, LOOKUP_CURSOR, cursor);
+    SET_VECTOR_ELT(lookup, LOOKUP_RANKS,  R_NilValue);
+    SET_REAL_ELT(cursor, 0, 0);
+    SET_REAL_ELT(cursor, 1, 0);
+
+    SEXP/*LISTSXP*/ data = PROTECT(allocSExp(LISTSXP));
+    SETCAR (data, length_vector); // The number of set bits, shared with the mosaic
+    SET_TAG(data, R_NilValue);    // Starts as R_NilValue, becomes a vector if the indices are written to
+    SETCDR (data, lookup);        // Where the last lookup ended, and the rank directory
+
+    SEXP indices = R_new_altrep(class_from_sexp_type(type), bitmap, data);
+    UNPROTECT(2);
+    return indices;
+}
+
+static inline SEXP/*INTSXP*/ get_bitmap(SEXP x) {
+    return R_altrep_data1(x);
+}
+
+static inline R_xlen_t get_length(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return (R_xlen_t) REAL_ELT(CAR(cell), 0);
+}
+
+static inline SEXP/*REALSXP*/ get_cursor(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return VECTOR_ELT(CDR(cell), LOOKUP_CURSOR);
+}
+
+static SEXP/*REALSXP*/ get_ranks(SEXP x) {
+    SEXP/*VECSXP*/  lookup = CDR(R_altrep_data2(x));
+    SEXP/*REALSXP*/ ranks  = VECTOR_ELT(lookup, LOOKUP_RANKS);
+    if (ranks != R_NilValue) {
+        return ranks;
+    }
+
+    SEXP/*INTSXP*/  bitmap          = get_bitmap(x);
+    const uint32_t *words           = bitmap_words(bitmap);
+    R_xlen_t        how_many_words  = bitmap_size_in_words(bitmap);
+    R_xlen_t        how_many_blocks = (how_many_words + how_many_words_in_rank_block - 1) / how_many_words_in_rank_block;
+
+    if (get_debug_mode()) {
+        Rprintf("mosaic indices rank directory\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("         blocks: %li\n", how_many_blocks);
+    }
+
+    ranks = PROTECT(allocVector(REALSXP, how_many_blocks + 1));
+    double  *counts  = REAL(ranks);
+    R_xlen_t counted = 0;
+    for (R_xlen_t word = 0; word < how_many_words; word++) {
+        if (word % how_many_words_in_rank_block == 0) {
+            counts[word / how_many_words_in_rank_block] = (double) counted;
+        }
+        counted += __builtin_popcount(words[word]);
+    }
+    counts[how_many_blocks] = (double) counted;
+
+    SET_VECTOR_ELT(lookup, LOOKUP_RANKS, ranks);
+    UNPROTECT(1);
+    return ranks;
+}
+
+// The last block with fewer set bits before it than the ordinal, or as many.
+static R_xlen_t find_rank_block(SEXP/*REALSXP*/ ranks, R_xlen_t ordinal) {
+    const double *counts = REAL_RO(ranks);
+    R_xlen_t low  = 0;
+    R_xlen_t high = XLENGTH(ranks) - 2;
+    while (low < high) {
+        R_xlen_t middle = low + (high - low + 1) / 2;
+        if ((R_xlen_t) counts[middle] <= ordinal) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+static inline SEXP get_materialized_data(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell);
+}
+
+static inline void set_materialized_data(SEXP x, SEXP data) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    SET_TAG(cell, data);
+}
+
+static inline bool is_materialized(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell) != R_NilValue;
+}
+
+// Finds the word holding the set bit with the given ordinal, and the ordinal
+// of the first set bit counted in that word.
+static R_xlen_t select_word(SEXP x, R_xlen_t ordinal, R_xlen_t *first_ordinal_in_word) {
+    SEXP/*REALSXP*/ cursor = get_cursor(x);
+    const uint32_t *words  = bitmap_words(get_bitmap(x));
+
+    R_xlen_t counted = (R_xlen_t) REAL_ELT(cursor, 0);
+    R_xlen_t word    = (R_xlen_t) REAL_ELT(cursor, 1);
+    if (ordinal < counted || ordinal - counted >= 2 * how_many_bits_in_bitmap_word) {
+        SEXP/*REALSXP*/ ranks = get_ranks(x);
+        R_xlen_t        block = find_rank_block(ranks, ordinal);
+        counted = (R_xlen_t) REAL_ELT(ranks, block);
+        word    = block * how_many_words_in_rank_block;
+    }
+
+    for (;;) {
+        R_xlen_t in_word = __builtin_popcount(words[word]);
+        if (counted + in_word > ordinal) {
+            break;
+        }
+        counted += in_word;
+        word++;
+    }
+
+    SET_REAL_ELT(cursor, 0, (double) counted);
+    SET_REAL_ELT(cursor, 1, (double) word);
+    *first_ordinal_in_word = counted;
+    return word;
+}
+
+static inline R_xlen_t select_bit(SEXP x, R_xlen_t ordinal) {
+    R_xlen_t counted = 0;
+    R_xlen_t word    = select_word(x, ordinal, &counted);
+
+    uint32_t remaining = bitmap_words(get_bitmap(x))[word];
+    for (; counted < ordinal; counted++) {
+        remaining &= remaining - 1;
+    }
+    return word * how_many_bits_in_bitmap_word + __builtin_ctz(remaining);
+}
+
+// Enumerates the positions of set bits with ordinals from i to i + n, one-based.
+static R_xlen_t copy_positions(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    R_xlen_t length = get_length(x);
+    R_xlen_t size   = (length - i < n) ? length - i : n;
+    if (size <= 0) {
+        return 0;
+    }
+
+    bool            integers = TYPEOF(x) == INTSXP;
+    const uint32_t *words    = bitmap_words(get_bitmap(x));
+
+    R_xlen_t counted   = 0;
+    R_xlen_t word      = select_word(x, i, &counted);
+    uint32_t remaining = words[word];
+    for (; counted < i; counted++) {
+        remaining &= remaining - 1;
+    }
+
+    R_xlen_t position = 0;
+    while (position < size) {
+        while (remaining == 0) {
+            remaining = words[++word];
+        }
+        R_xlen_t index = word * how_many_bits_in_bitmap_word + __builtin_ctz(remaining) + 1;
+        if (integers) {
+            ((int *) buf)[position] = (int) index;
+        } else {
+            ((double *) buf)[position] = (double) index;
+        }
+        remaining &= remaining - 1;
+        position++;
+    }
+    return size;
+}
+
+SEXP mosaic_indices_duplicate(SEXP x, Rboolean deep) {
+
+    if (get_debug_mode()) {
+        Rprintf("mosaic_indices_duplicate\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           deep: %i\n", deep);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    SEXP/*LISTSXP*/ cell = R_altrep_data2(x);
+    SEXP indices = PROTECT(mosaic_indices_new(get_bitmap(x), CAR(cell), TYPEOF(x)));
+    if (is_materialized(x)) {
+        SEXP data = get_materialized_data(x);
+        set_materialized_data(indices, deep ? duplicate(data) : data);
+    }
+    UNPROTECT(1);
+    return indices;
+}
+
+static Rboolean mosaic_indices_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+
+    Rprintf("mosaic_indices_altrep %s\n", type2char(TYPEOF(x)));
+
+    inspect_subtree(R_altrep_data1(x), pre, deep, pvec);
+    inspect_subtree(R_altrep_data2(x), pre, deep, pvec);
+
+    return FALSE;
+}
+
+static R_xlen_t mosaic_indices_length(SEXP x) {
+    if (get_debug_mode()) {
+        Rprintf("mosaic_indices_length\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return get_length(x);
+}
+
+static void *mosaic_indices_dataptr(SEXP x, Rboolean writeable) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("mosaic_indices_dataptr\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("      writeable: %i\n", writeable);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (!is_materialized(x)) {
+        SEXP data = PROTECT(allocVector(TYPEOF(x), get_length(x)));
+        copy_positions(x, 0, XLENGTH(data), DATAPTR(data));
+        set_materialized_data(x, data);
+        UNPROTECT(1);
+    }
+
+    SEXP data = get_materialized_data(x);
+    return writeable ? DATAPTR(data) : (void *) DATAPTR_RO(data);
+}
+
+static const void *mosaic_indices_dataptr_or_null(SEXP x) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("mosaic_indices_dataptr_or_null\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return is_materialized(x) ? DATAPTR_RO(get_materialized_data(x)) : NULL;
+}
+
+static int mosaic_indices_integer_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("mosaic_indices_integer_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return INTEGER_ELT(get_materialized_data(x), i);
+    }
+
+    return (int) (select_bit(x, i) + 1);
+}
+
+static double mosaic_indices_numeric_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("mosaic_indices_numeric_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return REAL_ELT(get_materialized_data(x), i);
+    }
+
+    return (double) (select_bit(x, i) + 1);
+}
+
+static R_xlen_t mosaic_indices_integer_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("mosaic_indices_integer_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return INTEGER_GET_REGION(get_materialized_data(x), i, n, buf);
+    }
+
+    return copy_positions(x, i, n, buf);
+}
+
+static R_xlen_t mosaic_indices_numeric_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("mosaic_indices_numeric_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return REAL_GET_REGION(get_materialized_data(x), i, n, buf);
+    }
+
+    return copy_positions(x, i, n, buf);
+}
+
+static void init_common_mosaic_indices(R_altrep_class_t cls) {
+    R_set_altrep_Duplicate_method(cls, mosaic_indices_duplicate);
+    R_set_altrep_Inspect_method(cls, mosaic_indices_inspect);
+    R_set_altrep_Length_method(cls, mosaic_indices_length);
+
+    R_set_altvec_Dataptr_method(cls, mosaic_indices_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, mosaic_indices_dataptr_or_null);
+}
+
+void init_mosaic_indices_integer_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altinteger_class("mosaic_indices_integer_altrep", "viewports", dll);
+    mosaic_indices_integer_altrep = cls;
+
+    init_common_mosaic_indices(cls);
+
+    R_set_altinteger_Elt_method(cls, mosaic_indices_integer_element);
+    R_set_altinteger_Get_region_method(cls, mosaic_indices_integer_get_region);
+}
+
+void init_mosaic_indices_numeric_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altreal_class("mosaic_indices_numeric_altrep", "viewports", dll);
+    mosaic_indices_numeric_altrep = cls;
+
+    init_common_mosaic_indices(cls);
+
+    R_set_altreal_Elt_method(cls, mosaic_indices_numeric_element);
+    R_set_altreal_Get_region_method(cls, mosaic_indices_numeric_get_region);
+}
+
+void init_mosaic_indices_altrep_class(DllInfo * dll) {
+    init_mosaic_indices_integer_altrep_class(dll);
+    init_mosaic_indices_numeric_altrep_class(dll);
+}
+
+SEXP/*INTSXP|REALSXP*/ create_mosaic_indices(SEXP mosaic) {
+    SEXP           source = R_NilValue;
+    SEXP/*INTSXP*/ bitmap = R_NilValue;
+    if (!mosaic_selection(mosaic, &source, &bitmap)) {
+        Rf_error("Indices can only be taken from mosaics that were not written to");
+    }
+
+    if (get_debug_mode()) {
+        Rprintf("create mosaic indices\n");
+        Rprintf("         mosaic: %p\n", mosaic);
+    }
+
+    SEXPTYPE type = (XLENGTH(source) <= INT_MAX) ? INTSXP : REALSXP;
+    return mosaic_indices_new(bitmap, mosaic_length_vector(mosaic), type);
+}
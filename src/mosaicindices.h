@@ -0,0 +1,9 @@
+#pragma once
+
+#include "Rinternals.h"
+
+SEXP/*INTSXP|REALSXP*/ mosaic_indices_new(SEXP/*INTSXP*/ bitmap, SEXP/*REALSXP*/ length_vector, SEXPTYPE type);
+
+SEXP/*INTSXP|REALSXP*/ create_mosaic_indices(SEXP mosaic);
+
+void init_mosaic_indices_altrep_class(DllInfo *dll);
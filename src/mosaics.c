@@ -1,6 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define USE_RINTERNALS
 #include <R.h>
@@ -13,6 +18,8 @@
 
 #include "common.h"
 #include "mosaics.h"
+#include "coercions.h"
+#include "bits.h"
 
 #define MAKE_SURE
 #include "make_sure.h"
@@ -42,6 +49,17 @@ R_xlen_t convert_logical_mask_to_bitmap(SEXP/*LGLSXP*/ mask, SEXP/*INTSXP*/ bitm
     R_xlen_t size = XLENGTH(mask);
     make_sure(XLENGTH(mask) == XTRUELENGTH(bitmap), Rf_error, "mask must the same length as the bitmap");
 
+    // Bit vectors already are bitmaps of the right layout.
+    SEXP/*INTSXP*/ values = R_NilValue;
+    SEXP/*INTSXP*/ NAs    = R_NilValue;
+    if (bits_bitmaps(mask, &values, &NAs)) {
+        if (NAs != R_NilValue && bitmap_count_set_bits(NAs) > 0) {
+            Rf_error("Mosaics cannot be created from a logical mask containing NA\n");
+        }
+        memcpy(bitmap_words(bitmap), bitmap_words(values), bitmap_size_in_words(values) * sizeof(uint32_t));
+        return bitmap_count_set_bits(bitmap);
+    }
+
     R_xlen_t elements = 0;
     for (R_xlen_t i = 0; i < size; i++) {
         Rboolean current = LOGICAL_ELT(mask, i);
@@ -175,6 +193,23 @@ static inline R_xlen_t get_length(SEXP x) {
     return REAL_ELT(CDR(cell), 0);
 }
 
+bool mosaic_selection(SEXP x, SEXP *source, SEXP/*INTSXP*/ *bitmap) {
+    SEXPTYPE type = TYPEOF(x);
+    if (type != INTSXP && type != REALSXP && type != LGLSXP && type != CPLXSXP && type != RAWSXP) {
+        return false;
+    }
+    if (!ALTREP(x) || !R_altrep_inherits(x, class_from_sexp_type(type)) || is_materialized(x)) {
+        return false;
+    }
+    *source = get_source(x);
+    *bitmap = get_bitmap(x);
+    return true;
+}
+
+SEXP/*REALSXP*/ mosaic_length_vector(SEXP x) {
+    return get_length_vector(x);
+}
+
 SEXP mosaic_duplicate(SEXP x, Rboolean deep) {
 
     if (get_debug_mode()) {
@@ -540,29 +575,46 @@ SEXP/*REALSXP*/ translate_indices_by_bitmap(SEXP/*REALSXP*/ screened_indices, SE
 	return translated_indices;
 }
 
+// Selects the set bits of the bitmap whose ordinals are the given strictly
+// increasing 1-based indices. Words are skipped whole while the next index is
+// past all of their set bits.
 SEXP/*bitmap*/ translate_bitmap(SEXP source, SEXP/*bitmap*/ bitmap, SEXP/*INTSXP|REALSXP*/ indices) {
 	make_sure(TYPEOF(indices) == INTSXP ||TYPEOF(indices) == REALSXP, Rf_error,
 			  "type of indices must be either INTSXP or REALSXP");
 
-    R_xlen_t translated_bitmap_size = XTRUELENGTH(bitmap);
-    SEXP translated_bitmap = bitmap_new(XLENGTH(source));
+    SEXP/*INTSXP*/ translated_bitmap = PROTECT(bitmap_new(XLENGTH(source)));
 
-    R_xlen_t viewport_index = 0;
-    R_xlen_t indices_index = 0;
+    const uint32_t *words            = bitmap_words(bitmap);
+    uint32_t       *translated_words = bitmap_words(translated_bitmap);
+    R_xlen_t        how_many_indices = XLENGTH(indices);
 
-    for (R_xlen_t i = 0; i < translated_bitmap_size; i++) {
-    	if (bitmap_get(bitmap, i)) {
-        	R_xlen_t index = (R_xlen_t) TYPEOF(indices) == REALSXP ? REAL_ELT(indices, indices_index)
-        														   : INTEGER_ELT(indices, indices_index);
+    R_xlen_t viewport_index = 0;
+    R_xlen_t indices_index  = 0;
+    R_xlen_t next_index     = (how_many_indices > 0) ? get_first_element_as_length(indices) - 1 : 0;
+
+    for (R_xlen_t word = 0; word < bitmap_size_in_words(bitmap) && indices_index < how_many_indices; word++) {
+        uint32_t remaining = words[word];
+        R_xlen_t set_bits  = __builtin_popcount(remaining);
+        if (viewport_index + set_bits <= next_index) {
+            viewport_index += set_bits;
+            continue;
+        }
 
-            if (viewport_index == index - 1) {
-                bitmap_set(translated_bitmap, i);
+        while (remaining != 0 && indices_index < how_many_indices) {
+            if (viewport_index == next_index) {
+                translated_words[word] |= remaining & -remaining;
                 indices_index++;
+                if (indices_index < how_many_indices) {
+                    next_index = (TYPEOF(indices) == INTSXP) ? (R_xlen_t) INTEGER_ELT(indices, indices_index) - 1
+                                                             : (R_xlen_t) REAL_ELT(indices, indices_index) - 1;
+                }
             }
+            remaining &= remaining - 1;
             viewport_index++;
         }
     }
 
+    UNPROTECT(1);
     return translated_bitmap;
 }
 
@@ -589,22 +641,29 @@ static SEXP mosaic_extract_subset(SEXP x, SEXP indices, SEXP call) {
         return allocVector(TYPEOF(source), 0);
     }
 
-    SEXP/*REALSXP*/ screened_indices = screen_indices(indices, length);
+    // Strictly increasing indices, which is what logical masks have become by
+    // the time R calls this method, select set bits of the bitmap directly.
+    if (!is_materialized(x) && are_indices_monotonic(indices) && are_indices_in_range(indices, 1, length)) {
+        SEXP/*bitmap*/ translated_bitmap = PROTECT(translate_bitmap(source, bitmap, indices));
+        SEXP mosaic = mosaic_new(source, translated_bitmap, size);
+        UNPROTECT(1);
+        return mosaic;
+    }
+
+    SEXP/*REALSXP*/ screened_indices = PROTECT(screen_indices(indices, length));
 
     if (is_materialized(x)) {
         // TODO maybe instead just return a viewport into the materialized sexp?
         SEXP materialized_data = get_materialized_data(x);
-        return copy_data_at_indices(materialized_data, screened_indices);
-    }
-
-    if (!are_indices_monotonic(screened_indices)) {
-    	SEXP/*REALSXP*/ translated_indices = translate_indices_by_bitmap(screened_indices, bitmap);
-        return copy_data_at_indices(source, translated_indices);
+        SEXP copy = copy_data_at_indices(materialized_data, screened_indices);
+        UNPROTECT(1);
+        return copy;
     }
 
-    // Monotonic indices.
-    SEXP/*bitmap*/ translated_bitmap = translate_bitmap(source, bitmap, indices);
-    return mosaic_new(source, translated_bitmap, XLENGTH(indices));
+    SEXP/*REALSXP*/ translated_indices = PROTECT(translate_indices_by_bitmap(screened_indices, bitmap));
+    SEXP copy = copy_data_at_indices(source, translated_indices);
+    UNPROTECT(2);
+    return copy;
 }
 
 // R_set_altstring_Set_elt_method
@@ -613,10 +672,23 @@ static SEXP mosaic_extract_subset(SEXP x, SEXP indices, SEXP call) {
 // R_set_altstring_Elt_method
 // string_elt(SEXP x, R_xlen_t i)
 
+static SEXP mosaic_coerce(SEXP x, int type) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("mosaic_coerce\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           type: %s\n", type2char(type));
+    }
+
+    return coerce_view(x, type);
+}
+
 void init_common_mosaic(R_altrep_class_t cls) {
     R_set_altrep_Duplicate_method(cls, mosaic_duplicate);
     R_set_altrep_Inspect_method(cls, mosaic_inspect);
     R_set_altrep_Length_method(cls, mosaic_length);
+    R_set_altrep_Coerce_method(cls, mosaic_coerce);
 
     R_set_altvec_Dataptr_method(cls, mosaic_dataptr);
     R_set_altvec_Dataptr_or_null_method(cls, mosaic_dataptr_or_null);
@@ -698,6 +770,14 @@ SEXP/*A*/ create_mosaic(SEXP/*A*/ source, SEXP/*INTSXP|REALSXP|LGLSXP*/ indices)
         	  "type of indices must be either INTSXP or REALSXP or LGLSXP "
         	  "(if it is LGLSXP, the length of indices must be the same as the source)");
 
+    // Negative indices select everything but the excluded elements.
+    if ((indices_type == INTSXP || indices_type == REALSXP) && are_indices_negative(indices)) {
+        SEXP/*INTSXP*/ bitmap = PROTECT(exclusion_bitmap(indices, source_length, 0, source_length));
+        SEXP mosaic = mosaic_new(source, bitmap, bitmap_count_set_bits(bitmap));
+        UNPROTECT(1);
+        return mosaic;
+    }
+
     if (indices_type == INTSXP || indices_type == REALSXP)
     	if (!are_indices_in_range(indices, 0, source_length))
     		Rf_error("Cannot use these indices with this source: out of range");
@@ -714,3 +794,94 @@ SEXP/*A*/ create_mosaic(SEXP/*A*/ source, SEXP/*INTSXP|REALSXP|LGLSXP*/ indices)
     R_xlen_t how_many_set_bits = convert_indices_to_bitmap(indices, bitmap);
     return mosaic_new(source, bitmap, how_many_set_bits);
 }
+
+typedef enum {
+    COMBINATION_AND,
+    COMBINATION_OR,
+    COMBINATION_ANDNOT,
+    COMBINATION_XOR,
+} combination_t;
+
+static combination_t parse_combination(SEXP/*STRSXP*/ operation) {
+    make_sure(TYPEOF(operation) == STRSXP && XLENGTH(operation) == 1, Rf_error,
+              "operation must be a single string");
+
+    const char *name = CHAR(STRING_ELT(operation, 0));
+    if (strcmp(name, "and")    == 0) return COMBINATION_AND;
+    if (strcmp(name, "or")     == 0) return COMBINATION_OR;
+    if (strcmp(name, "andnot") == 0) return COMBINATION_ANDNOT;
+    if (strcmp(name, "xor")    == 0) return COMBINATION_XOR;
+    Rf_error("Unknown mosaic combination: %s", name);
+}
+
+static inline uint32_t combine_words(combination_t combination, uint32_t left, uint32_t right) { // @suppress("No return")
+    switch (combination) {
+        case COMBINATION_AND:    return left &  right;
+        case COMBINATION_OR:     return left |  right;
+        case COMBINATION_ANDNOT: return left & ~right;
+        case COMBINATION_XOR:    return left ^  right;
+    }
+    return 0;
+}
+
+// Bits past the end of both bitmaps are clear, and every operation keeps them
+// clear, so the whole words can be combined and counted.
+static void combine_bitmaps(combination_t combination, const uint32_t *left, const uint32_t *right,
+                            uint32_t *result, R_xlen_t size_in_words) {
+    R_xlen_t i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= size_in_words; i += 4) {
+        __m128i l = _mm_loadu_si128((const __m128i *) (left  + i));
+        __m128i r = _mm_loadu_si128((const __m128i *) (right + i));
+        __m128i combined;
+        switch (combination) {
+            case COMBINATION_AND:    combined = _mm_and_si128   (l, r); break;
+            case COMBINATION_OR:     combined = _mm_or_si128    (l, r); break;
+            case COMBINATION_ANDNOT: combined = _mm_andnot_si128(r, l); break;
+            case COMBINATION_XOR:
+            default:                 combined = _mm_xor_si128   (l, r); break;
+        }
+        _mm_storeu_si128((__m128i *) (result + i), combined);
+    }
+#endif
+    for (; i < size_in_words; i++) {
+        result[i] = combine_words(combination, left[i], right[i]);
+    }
+}
+
+SEXP get_mosaic_source(SEXP x) {
+    SEXP           source = R_NilValue;
+    SEXP/*INTSXP*/ bitmap = R_NilValue;
+    mosaic_selection(x, &source, &bitmap);
+    return source;
+}
+
+SEXP/*A*/ create_mosaic_combination(SEXP/*A*/ left, SEXP/*A*/ right, SEXP/*STRSXP*/ operation) {
+    combination_t combination = parse_combination(operation);
+
+    SEXP           left_source  = R_NilValue;
+    SEXP           right_source = R_NilValue;
+    SEXP/*INTSXP*/ left_bitmap  = R_NilValue;
+    SEXP/*INTSXP*/ right_bitmap = R_NilValue;
+    if (!mosaic_selection(left, &left_source, &left_bitmap) || !mosaic_selection(right, &right_source, &right_bitmap)) {
+        Rf_error("Only mosaics that were not written to can be combined");
+    }
+    if (left_source != right_source) {
+        Rf_error("Only mosaics over the same source can be combined");
+    }
+
+    if (get_debug_mode()) {
+        Rprintf("create mosaic combination\n");
+        Rprintf("           left: %p\n", left);
+        Rprintf("          right: %p\n", right);
+        Rprintf("      operation: %i\n", combination);
+    }
+
+    SEXP/*INTSXP*/ bitmap = PROTECT(bitmap_new(XTRUELENGTH(left_bitmap)));
+    combine_bitmaps(combination, bitmap_words(left_bitmap), bitmap_words(right_bitmap),
+                    bitmap_words(bitmap), bitmap_size_in_words(bitmap));
+
+    SEXP mosaic = mosaic_new(left_source, bitmap, bitmap_count_set_bits(bitmap));
+    UNPROTECT(1);
+    return mosaic;
+}
@@ -1,7 +1,23 @@
 #pragma once
 
 #include "Rinternals.h"
+#include <stdbool.h>
+
+SEXP/*A*/ mosaic_new(SEXP/*A*/ source, SEXP/*INTSXP*/ bitmap, R_xlen_t size);
+R_xlen_t  convert_indices_to_bitmap  (SEXP/*INTSXP|REALSXP|LGLSXP*/ indices, SEXP/*INTSXP*/ bitmap);
+SEXP      translate_bitmap           (SEXP source, SEXP/*INTSXP*/ bitmap, SEXP/*INTSXP|REALSXP*/ indices);
+SEXP      translate_indices_by_bitmap(SEXP/*REALSXP*/ screened_indices, SEXP/*INTSXP*/ bitmap);
+
+// True if x is a mosaic that was not written to, in which case its source
+// and bitmap are returned through the pointers.
+bool      mosaic_selection(SEXP x, SEXP *source, SEXP/*INTSXP*/ *bitmap);
+
+// The vector holding the number of elements of a mosaic, shared by views of
+// its selection. Only valid if mosaic_selection is true for x.
+SEXP/*REALSXP*/ mosaic_length_vector(SEXP x);
 
 SEXP/*A*/ create_mosaic(SEXP/*A*/ source, SEXP/*INTSXP|REALSXP|LGLSXP*/ indices);
+SEXP      get_mosaic_source(SEXP x); // R_NilValue unless x is a mosaic that was not written to
+SEXP/*A*/ create_mosaic_combination(SEXP/*A*/ left, SEXP/*A*/ right, SEXP/*STRSXP*/ operation);
 
 void init_mosaic_altrep_class(DllInfo *dll);
@@ -0,0 +1,672 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Altrep.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "common.h"
+
+#include "packedindices.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// Prisms keep one index per element, which takes 8 bytes as a vector of
+// doubles. Index vectors are stored more compactly when prisms are created:
+//
+//  - as contiguous runs, if that is smallest (see below),
+//  - as frame-of-reference blocks, if that is smallest: every block of 64
+//    indices is stored as its smallest index plus bit-packed differences from
+//    it, using only as many bits as the largest difference needs,
+//  - as integers, if the source is short enough for its indices to fit,
+//  - as they are otherwise.
+//
+// Packed indices and runs are ALTREP vectors of doubles, so prisms read them
+// the same way as any other index vector.
+static R_altrep_class_t packed_indices_numeric_altrep;
+
+#define how_many_indices_in_packed_block 64
+#define how_many_bits_in_packed_word     32
+
+// Each block is described by three doubles in data1.
+#define block_base(blocks, b)   ((R_xlen_t) REAL_ELT((blocks), 3 * (b)))
+#define block_offset(blocks, b) ((R_xlen_t) REAL_ELT((blocks), 3 * (b) + 1))
+#define block_width(blocks, b)  ((int)      REAL_ELT((blocks), 3 * (b) + 2))
+
+static SEXP packed_indices_new(SEXP/*REALSXP*/ blocks, SEXP/*INTSXP*/ words, R_xlen_t length) {
+    if (get_debug_mode()) {
+        Rprintf("packed_indices_new\n");
+        Rprintf("         blocks: %li\n", XLENGTH(blocks) / 3);
+        Rprintf("          words: %li\n", XLENGTH(words));
+        Rprintf("         length: %li\n", length);
+    }
+
+    SEXP/*REALSXP*/ length_sexp = PROTECT(ScalarReal((double) length));
+
+    SEXP/*LISTSXP*/ data = PROTECT(allocSExp(LISTSXP));
+    SETCAR (data, words);       // The bit-packed differences of all blocks
+    SET_TAG(data, R_NilValue);  // Starts as R_NilValue, becomes a vector if the indices are written to
+    SETCDR (data, length_sexp); // The number of indices
+
+    SEXP packed = R_new_altrep(packed_indices_numeric_altrep, blocks, data);
+    UNPROTECT(2);
+    return packed;
+}
+
+static inline SEXP/*REALSXP*/ get_blocks(SEXP x) {
+    return R_altrep_data1(x);
+}
+
+static inline SEXP/*INTSXP*/ get_words(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return CAR(cell);
+}
+
+static inline R_xlen_t get_length(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return (R_xlen_t) REAL_ELT(CDR(cell), 0);
+}
+
+static inline SEXP get_materialized_data(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell);
+}
+
+static inline void set_materialized_data(SEXP x, SEXP data) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    SET_TAG(cell, data);
+}
+
+static inline bool is_materialized(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell) != R_NilValue;
+}
+
+static inline int bits_needed(uint64_t value) {
+    return value == 0 ? 0 : 64 - __builtin_clzll(value);
+}
+
+static inline R_xlen_t words_needed(R_xlen_t count, int width) {
+    return (count * width + how_many_bits_in_packed_word - 1) / how_many_bits_in_packed_word;
+}
+
+// Values never span more than two words, since they are at most 32 bits wide.
+static inline uint64_t unpack(const uint32_t *words, R_xlen_t bit, int width) {
+    R_xlen_t word  = bit / how_many_bits_in_packed_word;
+    int      shift = bit % how_many_bits_in_packed_word;
+    uint64_t pair  = ((uint64_t) words[word + 1] << 32) | words[word];
+    return (pair >> shift) & ((((uint64_t) 1) << width) - 1);
+}
+
+static inline void pack(uint32_t *words, R_xlen_t bit, int width, uint64_t value) {
+    R_xlen_t word  = bit / how_many_bits_in_packed_word;
+    int      shift = bit % how_many_bits_in_packed_word;
+    uint64_t pair  = value << shift;
+    words[word]     |= (uint32_t) pair;
+    words[word + 1] |= (uint32_t) (pair >> 32);
+}
+
+static inline R_xlen_t index_at(SEXP/*INTSXP|REALSXP*/ indices, R_xlen_t i) {
+    return (TYPEOF(indices) == INTSXP) ? (R_xlen_t) INTEGER_ELT(indices, i) : (R_xlen_t) REAL_ELT(indices, i);
+}
+
+// Decodes size indices starting from the i-th one, a block at a time.
+static R_xlen_t copy_unpacked_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    R_xlen_t length = get_length(x);
+    R_xlen_t size   = (length - i < n) ? length - i : n;
+
+    SEXP/*REALSXP*/ blocks = get_blocks(x);
+    const uint32_t *words  = (const uint32_t *) INTEGER(get_words(x));
+
+    R_xlen_t position = 0;
+    while (position < size) {
+        R_xlen_t index  = i + position;
+        R_xlen_t block  = index / how_many_indices_in_packed_block;
+        R_xlen_t within = index % how_many_indices_in_packed_block;
+        R_xlen_t count  = how_many_indices_in_packed_block - within;
+        if (count > size - position) {
+            count = size - position;
+        }
+
+        R_xlen_t base   = block_base(blocks, block);
+        R_xlen_t bit    = block_offset(blocks, block) * how_many_bits_in_packed_word;
+        int      width  = block_width(blocks, block);
+
+        if (width == 0) {
+            for (R_xlen_t j = 0; j < count; j++) {
+                buf[position + j] = (double) base;
+            }
+        } else {
+            bit += within * width;
+            for (R_xlen_t j = 0; j < count; j++, bit += width) {
+                buf[position + j] = (double) (base + (R_xlen_t) unpack(words, bit, width));
+            }
+        }
+        position += count;
+    }
+    return size;
+}
+
+SEXP packed_indices_duplicate(SEXP x, Rboolean deep) {
+
+    if (get_debug_mode()) {
+        Rprintf("packed_indices_duplicate\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           deep: %i\n", deep);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    SEXP packed = PROTECT(packed_indices_new(get_blocks(x), get_words(x), get_length(x)));
+    if (is_materialized(x)) {
+        SEXP data = get_materialized_data(x);
+        set_materialized_data(packed, deep ? duplicate(data) : data);
+    }
+    UNPROTECT(1);
+    return packed;
+}
+
+static Rboolean packed_indices_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+
+    Rprintf("packed_indices_altrep %s\n", type2char(TYPEOF(x)));
+
+    inspect_subtree(R_altrep_data1(x), pre, deep, pvec);
+    inspect_subtree(R_altrep_data2(x), pre, deep, pvec);
+
+    return FALSE;
+}
+
+static R_xlen_t packed_indices_length(SEXP x) {
+    if (get_debug_mode()) {
+        Rprintf("packed_indices_length\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return get_length(x);
+}
+
+static SEXP materialize(SEXP x) {
+    SEXP data = PROTECT(allocVector(REALSXP, get_length(x)));
+    copy_unpacked_region(x, 0, XLENGTH(data), REAL(data));
+    UNPROTECT(1);
+    return data;
+}
+
+static void *packed_indices_dataptr(SEXP x, Rboolean writeable) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("packed_indices_dataptr\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("      writeable: %i\n", writeable);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (!is_materialized(x)) {
+        set_materialized_data(x, materialize(x));
+    }
+
+    SEXP data = get_materialized_data(x);
+    return writeable ? DATAPTR(data) : (void *) DATAPTR_RO(data);
+}
+
+static const void *packed_indices_dataptr_or_null(SEXP x) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("packed_indices_dataptr_or_null\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return is_materialized(x) ? DATAPTR_RO(get_materialized_data(x)) : NULL;
+}
+
+static double packed_indices_numeric_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("packed_indices_numeric_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return REAL_ELT(get_materialized_data(x), i);
+    }
+
+    SEXP/*REALSXP*/ blocks = get_blocks(x);
+    R_xlen_t        block  = i / how_many_indices_in_packed_block;
+    R_xlen_t        base   = block_base(blocks, block);
+    int             width  = block_width(blocks, block);
+    if (width == 0) {
+        return (double) base;
+    }
+
+    R_xlen_t bit = block_offset(blocks, block) * how_many_bits_in_packed_word
+                 + (i % how_many_indices_in_packed_block) * width;
+    return (double) (base + (R_xlen_t) unpack((const uint32_t *) INTEGER(get_words(x)), bit, width));
+}
+
+static R_xlen_t packed_indices_numeric_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("packed_indices_numeric_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return copy_region(get_materialized_data(x), i, n, buf);
+    }
+
+    return copy_unpacked_region(x, i, n, buf);
+}
+
+void init_packed_indices_numeric_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altreal_class("packed_indices_numeric_altrep", "viewports", dll);
+    packed_indices_numeric_altrep = cls;
+
+    R_set_altrep_Duplicate_method(cls, packed_indices_duplicate);
+    R_set_altrep_Inspect_method(cls, packed_indices_inspect);
+    R_set_altrep_Length_method(cls, packed_indices_length);
+
+    R_set_altvec_Dataptr_method(cls, packed_indices_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, packed_indices_dataptr_or_null);
+
+    R_set_altreal_Elt_method(cls, packed_indices_numeric_element);
+    R_set_altreal_Get_region_method(cls, packed_indices_numeric_get_region);
+}
+
+// Indices made of contiguous runs, such as those coming from order() on
+// partially sorted data, are stored as one start and one offset per run
+// instead. Offsets hold the position of the first index of every run, and
+// one more past the last one.
+static R_altrep_class_t run_indices_numeric_altrep;
+
+static SEXP run_indices_new(SEXP/*REALSXP*/ starts, SEXP/*REALSXP*/ offsets) {
+    if (get_debug_mode()) {
+        Rprintf("run_indices_new\n");
+        Rprintf("           runs: %li\n", XLENGTH(starts));
+    }
+
+    SEXP/*LISTSXP*/ data = PROTECT(allocSExp(LISTSXP));
+    SETCAR (data, offsets);    // Where every run starts within the indices
+    SET_TAG(data, R_NilValue); // Starts as R_NilValue, becomes a vector if the indices are written to
+    SETCDR (data, R_NilValue); // Nothing here
+
+    SEXP runs = R_new_altrep(run_indices_numeric_altrep, starts, data);
+    UNPROTECT(1);
+    return runs;
+}
+
+static inline SEXP/*REALSXP*/ get_run_starts(SEXP x) {
+    return R_altrep_data1(x);
+}
+
+static inline SEXP/*REALSXP*/ get_run_offsets(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return CAR(cell);
+}
+
+static inline R_xlen_t get_run_length(SEXP x) {
+    SEXP/*REALSXP*/ offsets = get_run_offsets(x);
+    return (R_xlen_t) REAL_ELT(offsets, XLENGTH(offsets) - 1);
+}
+
+bool index_runs(SEXP/*INTSXP|REALSXP*/ indices, SEXP/*REALSXP*/ *starts, SEXP/*REALSXP*/ *offsets) {
+    if (!ALTREP(indices) || !R_altrep_inherits(indices, run_indices_numeric_altrep) || is_materialized(indices)) {
+        return false;
+    }
+    *starts  = get_run_starts(indices);
+    *offsets = get_run_offsets(indices);
+    return true;
+}
+
+R_xlen_t find_index_run(SEXP/*REALSXP*/ offsets, R_xlen_t i) {
+    const double *positions = REAL(offsets);
+    R_xlen_t low  = 0;
+    R_xlen_t high = XLENGTH(offsets) - 2;
+    while (low < high) {
+        R_xlen_t middle = low + (high - low + 1) / 2;
+        if ((R_xlen_t) positions[middle] <= i) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+static R_xlen_t copy_run_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    R_xlen_t length = get_run_length(x);
+    R_xlen_t size   = (length - i < n) ? length - i : n;
+    if (size <= 0) {
+        return 0;
+    }
+
+    const double *starts  = REAL(get_run_starts(x));
+    const double *offsets = REAL(get_run_offsets(x));
+
+    R_xlen_t run      = find_index_run(get_run_offsets(x), i);
+    R_xlen_t position = 0;
+    while (position < size) {
+        R_xlen_t index = i + position;
+        R_xlen_t count = (R_xlen_t) offsets[run + 1] - index;
+        if (count > size - position) {
+            count = size - position;
+        }
+
+        double first = starts[run] + (double) (index - (R_xlen_t) offsets[run]);
+        for (R_xlen_t j = 0; j < count; j++) {
+            buf[position + j] = first + (double) j;
+        }
+        position += count;
+        run++;
+    }
+    return size;
+}
+
+SEXP run_indices_duplicate(SEXP x, Rboolean deep) {
+
+    if (get_debug_mode()) {
+        Rprintf("run_indices_duplicate\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           deep: %i\n", deep);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    SEXP runs = PROTECT(run_indices_new(get_run_starts(x), get_run_offsets(x)));
+    if (is_materialized(x)) {
+        SEXP data = get_materialized_data(x);
+        set_materialized_data(runs, deep ? duplicate(data) : data);
+    }
+    UNPROTECT(1);
+    return runs;
+}
+
+static Rboolean run_indices_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+
+    Rprintf("run_indices_altrep %s\n", type2char(TYPEOF(x)));
+
+    inspect_subtree(R_altrep_data1(x), pre, deep, pvec);
+    inspect_subtree(R_altrep_data2(x), pre, deep, pvec);
+
+    return FALSE;
+}
+
+static R_xlen_t run_indices_length(SEXP x) {
+    if (get_debug_mode()) {
+        Rprintf("run_indices_length\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return get_run_length(x);
+}
+
+static void *run_indices_dataptr(SEXP x, Rboolean writeable) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("run_indices_dataptr\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("      writeable: %i\n", writeable);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (!is_materialized(x)) {
+        SEXP data = PROTECT(allocVector(REALSXP, get_run_length(x)));
+        copy_run_region(x, 0, XLENGTH(data), REAL(data));
+        set_materialized_data(x, data);
+        UNPROTECT(1);
+    }
+
+    SEXP data = get_materialized_data(x);
+    return writeable ? DATAPTR(data) : (void *) DATAPTR_RO(data);
+}
+
+static const void *run_indices_dataptr_or_null(SEXP x) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("run_indices_dataptr_or_null\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return is_materialized(x) ? DATAPTR_RO(get_materialized_data(x)) : NULL;
+}
+
+static double run_indices_numeric_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("run_indices_numeric_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return REAL_ELT(get_materialized_data(x), i);
+    }
+
+    SEXP/*REALSXP*/ offsets = get_run_offsets(x);
+    R_xlen_t        run     = find_index_run(offsets, i);
+    return REAL_ELT(get_run_starts(x), run) + (double) (i - (R_xlen_t) REAL_ELT(offsets, run));
+}
+
+static R_xlen_t run_indices_numeric_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("run_indices_numeric_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return copy_region(get_materialized_data(x), i, n, buf);
+    }
+
+    return copy_run_region(x, i, n, buf);
+}
+
+void init_run_indices_numeric_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altreal_class("run_indices_numeric_altrep", "viewports", dll);
+    run_indices_numeric_altrep = cls;
+
+    R_set_altrep_Duplicate_method(cls, run_indices_duplicate);
+    R_set_altrep_Inspect_method(cls, run_indices_inspect);
+    R_set_altrep_Length_method(cls, run_indices_length);
+
+    R_set_altvec_Dataptr_method(cls, run_indices_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, run_indices_dataptr_or_null);
+
+    R_set_altreal_Elt_method(cls, run_indices_numeric_element);
+    R_set_altreal_Get_region_method(cls, run_indices_numeric_get_region);
+}
+
+void init_packed_indices_altrep_class(DllInfo * dll) {
+    init_packed_indices_numeric_altrep_class(dll);
+    init_run_indices_numeric_altrep_class(dll);
+}
+
+// Finds the width of every block, and from it the number of words needed to
+// pack all of them. Returns -1 if some block needs more than 32 bits.
+static R_xlen_t measure_blocks(SEXP/*INTSXP|REALSXP*/ indices, R_xlen_t how_many_blocks, int *widths) {
+    R_xlen_t length = XLENGTH(indices);
+    R_xlen_t words  = 0;
+
+    for (R_xlen_t block = 0; block < how_many_blocks; block++) {
+        R_xlen_t start = block * how_many_indices_in_packed_block;
+        R_xlen_t end   = (start + how_many_indices_in_packed_block < length)
+                       ? start + how_many_indices_in_packed_block : length;
+
+        R_xlen_t min = index_at(indices, start);
+        R_xlen_t max = min;
+        for (R_xlen_t i = start + 1; i < end; i++) {
+            R_xlen_t index = index_at(indices, i);
+            if (index < min) min = index;
+            if (index > max) max = index;
+        }
+
+        int width = bits_needed((uint64_t) (max - min));
+        if (width > how_many_bits_in_packed_word) {
+            return -1;
+        }
+        widths[block] = width;
+        words += words_needed(end - start, width);
+    }
+
+    return words;
+}
+
+static SEXP/*REALSXP*/ pack_indices(SEXP/*INTSXP|REALSXP*/ indices, R_xlen_t how_many_blocks,
+                                    const int *widths, R_xlen_t how_many_words) {
+    R_xlen_t length = XLENGTH(indices);
+
+    SEXP/*REALSXP*/ blocks = PROTECT(allocVector(REALSXP, 3 * how_many_blocks));
+    SEXP/*INTSXP*/  words  = PROTECT(allocVector(INTSXP, how_many_words + 1)); // One word of padding for unpack
+    uint32_t *packed = (uint32_t *) INTEGER(words);
+    for (R_xlen_t i = 0; i < how_many_words + 1; i++) {
+        packed[i] = 0;
+    }
+
+    R_xlen_t offset = 0;
+    for (R_xlen_t block = 0; block < how_many_blocks; block++) {
+        R_xlen_t start = block * how_many_indices_in_packed_block;
+        R_xlen_t end   = (start + how_many_indices_in_packed_block < length)
+                       ? start + how_many_indices_in_packed_block : length;
+
+        R_xlen_t base = index_at(indices, start);
+        for (R_xlen_t i = start + 1; i < end; i++) {
+            R_xlen_t index = index_at(indices, i);
+            if (index < base) base = index;
+        }
+
+        int      width = widths[block];
+        R_xlen_t bit   = offset * how_many_bits_in_packed_word;
+        if (width > 0) {
+            for (R_xlen_t i = start; i < end; i++, bit += width) {
+                pack(packed, bit, width, (uint64_t) (index_at(indices, i) - base));
+            }
+        }
+
+        SET_REAL_ELT(blocks, 3 * block,     (double) base);
+        SET_REAL_ELT(blocks, 3 * block + 1, (double) offset);
+        SET_REAL_ELT(blocks, 3 * block + 2, (double) width);
+        offset += words_needed(end - start, width);
+    }
+
+    SEXP packed_indices = packed_indices_new(blocks, words, length);
+    UNPROTECT(2);
+    return packed_indices;
+}
+
+static SEXP/*INTSXP*/ narrow_indices(SEXP/*REALSXP*/ indices) {
+    R_xlen_t length = XLENGTH(indices);
+    SEXP/*INTSXP*/ narrowed = PROTECT(allocVector(INTSXP, length));
+    for (R_xlen_t i = 0; i < length; i++) {
+        SET_INTEGER_ELT(narrowed, i, (int) REAL_ELT(indices, i));
+    }
+    UNPROTECT(1);
+    return narrowed;
+}
+
+static R_xlen_t count_runs(SEXP/*INTSXP|REALSXP*/ indices) {
+    R_xlen_t length   = XLENGTH(indices);
+    R_xlen_t runs     = 1;
+    R_xlen_t previous = index_at(indices, 0);
+    for (R_xlen_t i = 1; i < length; i++) {
+        R_xlen_t index = index_at(indices, i);
+        if (index != previous + 1) {
+            runs++;
+        }
+        previous = index;
+    }
+    return runs;
+}
+
+static SEXP/*REALSXP*/ find_runs(SEXP/*INTSXP|REALSXP*/ indices, R_xlen_t how_many_runs) {
+    R_xlen_t length = XLENGTH(indices);
+
+    SEXP/*REALSXP*/ starts  = PROTECT(allocVector(REALSXP, how_many_runs));
+    SEXP/*REALSXP*/ offsets = PROTECT(allocVector(REALSXP, how_many_runs + 1));
+
+    R_xlen_t run      = 0;
+    R_xlen_t previous = index_at(indices, 0);
+    SET_REAL_ELT(starts,  0, (double) previous);
+    SET_REAL_ELT(offsets, 0, 0);
+    for (R_xlen_t i = 1; i < length; i++) {
+        R_xlen_t index = index_at(indices, i);
+        if (index != previous + 1) {
+            run++;
+            SET_REAL_ELT(starts,  run, (double) index);
+            SET_REAL_ELT(offsets, run, (double) i);
+        }
+        previous = index;
+    }
+    SET_REAL_ELT(offsets, how_many_runs, (double) length);
+
+    SEXP runs = run_indices_new(starts, offsets);
+    UNPROTECT(2);
+    return runs;
+}
+
+SEXP/*INTSXP|REALSXP*/ encode_indices(SEXP/*INTSXP|REALSXP*/ indices, R_xlen_t source_length) {
+    make_sure(TYPEOF(indices) == INTSXP || TYPEOF(indices) == REALSXP, Rf_error,
+              "type of indices must be either INTSXP or REALSXP");
+
+    R_xlen_t length = XLENGTH(indices);
+
+    // Indices that are already encoded, too few to bother with, or that
+    // contain NAs are kept as they are.
+    if (ALTREP(indices) && (R_altrep_inherits(indices, packed_indices_numeric_altrep)
+                            || R_altrep_inherits(indices, run_indices_numeric_altrep))) {
+        return indices;
+    }
+    if (length < 2 * how_many_indices_in_packed_block || do_indices_contain_NAs(indices)) {
+        return indices;
+    }
+
+    bool     fits_integers = source_length <= INT_MAX;
+    R_xlen_t plain_size    = length * (fits_integers ? sizeof(int) : sizeof(double));
+
+    R_xlen_t how_many_blocks = (length + how_many_indices_in_packed_block - 1) / how_many_indices_in_packed_block;
+    int     *widths          = (int *) R_alloc(how_many_blocks, sizeof(int));
+    R_xlen_t how_many_words  = measure_blocks(indices, how_many_blocks, widths);
+    R_xlen_t packed_size     = (how_many_words + 1) * sizeof(uint32_t) + how_many_blocks * 3 * sizeof(double);
+    R_xlen_t how_many_runs   = count_runs(indices);
+    R_xlen_t runs_size       = (2 * how_many_runs + 1) * sizeof(double);
+
+    if (get_debug_mode()) {
+        Rprintf("encode indices\n");
+        Rprintf("        indices: %p\n", indices);
+        Rprintf("         length: %li\n", length);
+        Rprintf("     plain size: %li\n", plain_size);
+        Rprintf("    packed size: %li\n", how_many_words < 0 ? -1 : packed_size);
+        Rprintf("      runs size: %li\n", runs_size);
+    }
+
+    if (runs_size < plain_size && (how_many_words < 0 || runs_size <= packed_size)) {
+        return find_runs(indices, how_many_runs);
+    }
+    if (how_many_words >= 0 && packed_size < plain_size) {
+        return pack_indices(indices, how_many_blocks, widths, how_many_words);
+    }
+    if (fits_integers && TYPEOF(indices) == REALSXP) {
+        return narrow_indices(indices);
+    }
+    return indices;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "Rinternals.h"
+#include <stdbool.h>
+
+SEXP/*INTSXP|REALSXP*/ encode_indices(SEXP/*INTSXP|REALSXP*/ indices, R_xlen_t source_length);
+bool                   index_runs    (SEXP/*INTSXP|REALSXP*/ indices, SEXP/*REALSXP*/ *starts, SEXP/*REALSXP*/ *offsets);
+R_xlen_t               find_index_run(SEXP/*REALSXP*/ offsets, R_xlen_t i);
+
+void init_packed_indices_altrep_class(DllInfo *dll);
@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+
+#include "debug.h"
+#include "helpers.h"
+
+#include "prefixsums.h"
+#include "indexes.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// A prefix sum index holds, for every position p of the source, the sum of
+// the finite elements before p and the number of NAs before p, so that the sum
+// of any region is a difference of two entries. Numeric sums are accumulated
+// with Neumaier's compensated summation and the running compensation is kept
+// next to the running sum, so that the difference of two entries does not
+// lose the low-order bits of either.
+//
+// Like zone maps, requesting an index only marks the source, and the index is
+// built the first time it is needed. Built indexes are a VECSXP: sums,
+// compensations (R_NilValue for integer sources), and counts of the NAs, of
+// the NaNs that are not NA, of positive infinities, and of negative
+// infinities, each R_NilValue if the source contains none. Sums skip all of
+// these, and the counts say what the sum of a region really is.
+#define PREFIX_SUMS_SUMS                0
+#define PREFIX_SUMS_COMPENSATIONS       1
+#define PREFIX_SUMS_NAS                 2
+#define PREFIX_SUMS_NANS                3
+#define PREFIX_SUMS_POSITIVE_INFINITIES 4
+#define PREFIX_SUMS_NEGATIVE_INFINITIES 5
+
+static inline bool is_built(SEXP prefix_sums) {
+    return TYPEOF(prefix_sums) == VECSXP;
+}
+
+// Counts are only kept for the kinds of elements the source contains, so a
+// first pass looks for them before anything is allocated.
+typedef struct {
+    bool NAs;
+    bool NaNs;
+    bool positive_infinities;
+    bool negative_infinities;
+} non_finite_kinds_t;
+
+static void find_non_finite_kinds(SEXP/*INTSXP|REALSXP|LGLSXP*/ source, non_finite_kinds_t *kinds) {
+    R_xlen_t size = XLENGTH(source);
+    *kinds = (non_finite_kinds_t) { false, false, false, false };
+
+    if (TYPEOF(source) != REALSXP) {
+        for (R_xlen_t i = 0; i < size && !kinds->NAs; i++) {
+            kinds->NAs = INTEGER_ELT(source, i) == NA_INTEGER;
+        }
+        return;
+    }
+
+    for (R_xlen_t i = 0; i < size; i++) {
+        double value = REAL_ELT(source, i);
+        if (R_FINITE(value)) {
+            continue;
+        }
+        if (ISNAN(value)) {
+            kinds->NAs = true;
+            kinds->NaNs |= !ISNA(value);
+        } else if (value > 0) {
+            kinds->positive_infinities = true;
+        } else {
+            kinds->negative_infinities = true;
+        }
+        if (kinds->NaNs && kinds->positive_infinities && kinds->negative_infinities) {
+            return;
+        }
+    }
+}
+
+static double *allocate_counts(SEXP/*VECSXP*/ prefix_sums, int slot, R_xlen_t size, bool needed) {
+    if (!needed) {
+        return NULL;
+    }
+    SEXP/*REALSXP*/ counts = allocVector(REALSXP, size + 1);
+    SET_VECTOR_ELT(prefix_sums, slot, counts);
+    return REAL(counts);
+}
+
+// Counts that are not kept are NULL.
+static void accumulate_integers(SEXP/*INTSXP|LGLSXP*/ source, double *sums, double *NAs) {
+    R_xlen_t size = XLENGTH(source);
+    double sum = 0;
+    double NA_count = 0;
+
+    sums[0] = 0;
+    if (NAs) NAs[0] = 0;
+    for (R_xlen_t i = 0; i < size; i++) {
+        int value = INTEGER_ELT(source, i);
+        if (value == NA_INTEGER) {
+            NA_count++;
+        } else {
+            sum += (double) value;
+        }
+        sums[i + 1] = sum;
+        if (NAs) NAs[i + 1] = NA_count;
+    }
+}
+
+// NAs counts every NaN, NA or not, so NaNs counts the NaNs that are not NA a
+// second time. Counts that are not kept are NULL.
+static void accumulate_doubles(SEXP/*REALSXP*/ source, double *sums, double *compensations, double *NAs,
+                               double *NaNs, double *positive_infinities, double *negative_infinities) {
+    R_xlen_t size = XLENGTH(source);
+    double sum = 0;
+    double compensation = 0;
+    double NA_count = 0;
+    double NaN_count = 0;
+    double positive_infinity_count = 0;
+    double negative_infinity_count = 0;
+
+    sums[0]          = 0;
+    compensations[0] = 0;
+    if (NAs)                 NAs[0]                 = 0;
+    if (NaNs)                NaNs[0]                = 0;
+    if (positive_infinities) positive_infinities[0] = 0;
+    if (negative_infinities) negative_infinities[0] = 0;
+    for (R_xlen_t i = 0; i < size; i++) {
+        double value = REAL_ELT(source, i);
+        if (ISNAN(value)) {
+            NA_count++;
+            if (!ISNA(value)) {
+                NaN_count++;
+            }
+        } else if (value == R_PosInf) {
+            positive_infinity_count++;
+        } else if (value == R_NegInf) {
+            negative_infinity_count++;
+        } else {
+            double total = sum + value;
+            if (fabs(sum) >= fabs(value)) {
+                compensation += (sum - total) + value;
+            } else {
+                compensation += (value - total) + sum;
+            }
+            sum = total;
+        }
+        sums[i + 1]          = sum;
+        compensations[i + 1] = compensation;
+        if (NAs)                 NAs[i + 1]                 = NA_count;
+        if (NaNs)                NaNs[i + 1]                = NaN_count;
+        if (positive_infinities) positive_infinities[i + 1] = positive_infinity_count;
+        if (negative_infinities) negative_infinities[i + 1] = negative_infinity_count;
+    }
+}
+
+SEXP/*VECSXP*/ prefix_sums_build(SEXP/*INTSXP|REALSXP|LGLSXP*/ source) {
+    SEXPTYPE type = TYPEOF(source);
+    make_sure(type == INTSXP || type == REALSXP || type == LGLSXP, Rf_error,
+              "type of source must be one of INTSXP, REALSXP, or LGLSXP");
+
+    R_xlen_t size = XLENGTH(source);
+
+    if (get_debug_mode()) {
+        Rprintf("prefix_sums_build\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("           size: %li\n", size);
+    }
+
+    non_finite_kinds_t kinds;
+    find_non_finite_kinds(source, &kinds);
+
+    SEXP/*VECSXP*/  prefix_sums = PROTECT(allocVector(VECSXP, 6));
+    SEXP/*REALSXP*/ sums        = allocVector(REALSXP, size + 1);
+    SET_VECTOR_ELT(prefix_sums, PREFIX_SUMS_SUMS, sums);
+    double *NAs = allocate_counts(prefix_sums, PREFIX_SUMS_NAS, size, kinds.NAs);
+
+    if (type == REALSXP) {
+        SEXP/*REALSXP*/ compensations = allocVector(REALSXP, size + 1);
+        SET_VECTOR_ELT(prefix_sums, PREFIX_SUMS_COMPENSATIONS, compensations);
+        accumulate_doubles(source, REAL(sums), REAL(compensations), NAs,
+                           allocate_counts(prefix_sums, PREFIX_SUMS_NANS,                size, kinds.NaNs),
+                           allocate_counts(prefix_sums, PREFIX_SUMS_POSITIVE_INFINITIES, size, kinds.positive_infinities),
+                           allocate_counts(prefix_sums, PREFIX_SUMS_NEGATIVE_INFINITIES, size, kinds.negative_infinities));
+    } else {
+        accumulate_integers(source, REAL(sums), NAs);
+    }
+
+    UNPROTECT(1);
+    return prefix_sums;
+}
+
+SEXP/*VECSXP*/ prefix_sums_get(SEXP source) {
+    SEXP prefix_sums = index_get(source, INDEX_PREFIX_SUMS);
+    if (prefix_sums == R_NilValue || is_built(prefix_sums)) {
+        return prefix_sums;
+    }
+
+    prefix_sums = PROTECT(prefix_sums_build(source));
+    index_set(source, INDEX_PREFIX_SUMS, prefix_sums);
+    UNPROTECT(1);
+    return prefix_sums;
+}
+
+SEXP/*VECSXP*/ prefix_sums_require(SEXP source) {
+    if (index_get(source, INDEX_PREFIX_SUMS) == R_NilValue) {
+        index_set(source, INDEX_PREFIX_SUMS, ScalarLogical(TRUE));
+    }
+    return prefix_sums_get(source);
+}
+
+static inline R_xlen_t count_in_region(SEXP/*VECSXP*/ prefix_sums, int slot, R_xlen_t start, R_xlen_t end) {
+    SEXP/*REALSXP*/ counts = VECTOR_ELT(prefix_sums, slot);
+    return (counts == R_NilValue) ? 0 : (R_xlen_t) (REAL_ELT(counts, end) - REAL_ELT(counts, start));
+}
+
+static inline double finite_sum_of_region(SEXP/*VECSXP*/ prefix_sums, R_xlen_t start, R_xlen_t end) {
+    const double *sums = REAL_RO(VECTOR_ELT(prefix_sums, PREFIX_SUMS_SUMS));
+    double sum = sums[end] - sums[start];
+
+    SEXP/*REALSXP*/ compensations = VECTOR_ELT(prefix_sums, PREFIX_SUMS_COMPENSATIONS);
+    if (compensations != R_NilValue) {
+        sum += REAL_ELT(compensations, end) - REAL_ELT(compensations, start);
+    }
+    return sum;
+}
+
+// Fails if the region contains infinities, since they are not in the sum.
+bool prefix_sums_of_region(SEXP/*VECSXP*/ prefix_sums, R_xlen_t start, R_xlen_t size, double *sum, R_xlen_t *NAs) {
+    make_sure(is_built(prefix_sums), Rf_error, "prefix sums must be built");
+
+    R_xlen_t end = start + size;
+    if (count_in_region(prefix_sums, PREFIX_SUMS_POSITIVE_INFINITIES, start, end) > 0
+     || count_in_region(prefix_sums, PREFIX_SUMS_NEGATIVE_INFINITIES, start, end) > 0) {
+        return false;
+    }
+
+    *sum = finite_sum_of_region(prefix_sums, start, end);
+    *NAs = count_in_region(prefix_sums, PREFIX_SUMS_NAS, start, end);
+    return true;
+}
+
+// The sum of a region as sum() would return it: NA if it contains NAs, NaN
+// if it contains NaNs or infinities of both signs, an infinity if it contains
+// infinities of one sign, and the sum of its elements otherwise.
+double prefix_sums_total_of_region(SEXP/*VECSXP*/ prefix_sums, R_xlen_t start, R_xlen_t size) {
+    make_sure(is_built(prefix_sums), Rf_error, "prefix sums must be built");
+
+    R_xlen_t end = start + size;
+    R_xlen_t NaNs = count_in_region(prefix_sums, PREFIX_SUMS_NANS, start, end);
+    if (count_in_region(prefix_sums, PREFIX_SUMS_NAS, start, end) > NaNs) {
+        return NA_REAL;
+    }
+    if (NaNs > 0) {
+        return R_NaN;
+    }
+
+    bool positive_infinities = count_in_region(prefix_sums, PREFIX_SUMS_POSITIVE_INFINITIES, start, end) > 0;
+    bool negative_infinities = count_in_region(prefix_sums, PREFIX_SUMS_NEGATIVE_INFINITIES, start, end) > 0;
+    if (positive_infinities && negative_infinities) return R_NaN;
+    if (positive_infinities)                        return R_PosInf;
+    if (negative_infinities)                        return R_NegInf;
+
+    return finite_sum_of_region(prefix_sums, start, end);
+}
+
+SEXP create_prefix_sums(SEXP/*INTSXP|REALSXP|LGLSXP*/ source) {
+    SEXPTYPE type = TYPEOF(source);
+    make_sure(type == INTSXP || type == REALSXP || type == LGLSXP, Rf_error,
+              "type of source must be one of INTSXP, REALSXP, or LGLSXP");
+
+    if (get_debug_mode()) {
+        Rprintf("create prefix sums\n");
+        Rprintf("           SEXP: %p\n", source);
+    }
+
+    // Requesting the sums again drops the ones that were built, so that a
+    // source written to in place can be indexed anew.
+    index_set(source, INDEX_PREFIX_SUMS, ScalarLogical(TRUE));
+    return source;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "Rinternals.h"
+#include <stdbool.h>
+
+SEXP/*VECSXP*/ prefix_sums_get      (SEXP source);         // R_NilValue if not requested
+SEXP/*VECSXP*/ prefix_sums_require  (SEXP source);         // Requests the index if necessary
+bool           prefix_sums_of_region(SEXP/*VECSXP*/ prefix_sums, R_xlen_t start, R_xlen_t size,
+                                     double *sum, R_xlen_t *NAs);
+double         prefix_sums_total_of_region(SEXP/*VECSXP*/ prefix_sums, R_xlen_t start, R_xlen_t size);
+
+SEXP create_prefix_sums(SEXP/*INTSXP|REALSXP|LGLSXP*/ source);
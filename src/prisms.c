@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 
 #define USE_RINTERNALS
 #include <R.h>
@@ -12,6 +13,8 @@
 
 #include "slices.h"
 #include "common.h"
+#include "coercions.h"
+#include "packedindices.h"
 
 #define MAKE_SURE
 #include "make_sure.h"
@@ -84,6 +87,19 @@ static inline bool is_materialized(SEXP x) {
     return TAG(cell) != R_NilValue;
 }
 
+bool prism_selection(SEXP x, SEXP *source, SEXP/*INTSXP|REALSXP*/ *indices) {
+    SEXPTYPE type = TYPEOF(x);
+    if (type != INTSXP && type != REALSXP && type != LGLSXP && type != CPLXSXP && type != RAWSXP) {
+        return false;
+    }
+    if (!ALTREP(x) || !R_altrep_inherits(x, class_from_sexp_type(type)) || is_materialized(x)) {
+        return false;
+    }
+    *source  = get_source(x);
+    *indices = get_indices(x);
+    return true;
+}
+
 SEXP prism_duplicate(SEXP x, Rboolean deep) {//TODO
 
     if (get_debug_mode()) {
@@ -135,6 +151,58 @@ static R_xlen_t prism_length(SEXP x) {
     return get_length(x);
 }
 
+// Runs of contiguous indices are copied from the source a block at a time.
+static void copy_run(SEXP source, R_xlen_t start, R_xlen_t size, void *buffer) {
+    const void *data = DATAPTR_OR_NULL(source);
+    if (data == NULL) {
+        copy_region(source, start, size, buffer);
+        return;
+    }
+    size_t element_size = __get_element_size(TYPEOF(source));
+    memcpy(buffer, ((const char *) data) + start * element_size, size * element_size);
+}
+
+static R_xlen_t copy_runs_region(SEXP source, SEXP/*REALSXP*/ starts, SEXP/*REALSXP*/ offsets,
+                                 R_xlen_t i, R_xlen_t n, void *buffer) {
+    R_xlen_t length = (R_xlen_t) REAL_ELT(offsets, XLENGTH(offsets) - 1);
+    R_xlen_t size   = (length - i < n) ? length - i : n;
+    if (size <= 0) {
+        return 0;
+    }
+
+    size_t   element_size = __get_element_size(TYPEOF(source));
+    R_xlen_t run          = find_index_run(offsets, i);
+    R_xlen_t position     = 0;
+    while (position < size) {
+        R_xlen_t index = i + position;
+        R_xlen_t first = (R_xlen_t) REAL_ELT(starts, run) - 1 + (index - (R_xlen_t) REAL_ELT(offsets, run));
+        R_xlen_t count = (R_xlen_t) REAL_ELT(offsets, run + 1) - index;
+        if (count > size - position) {
+            count = size - position;
+        }
+        copy_run(source, first, count, ((char *) buffer) + position * element_size);
+        position += count;
+        run++;
+    }
+    return size;
+}
+
+static SEXP materialize(SEXP x) {
+    SEXP/*INTSXP|REALSXP*/ indices = get_indices(x);
+    SEXP                   source  = get_source(x);
+
+    SEXP/*REALSXP*/ starts  = R_NilValue;
+    SEXP/*REALSXP*/ offsets = R_NilValue;
+    if (index_runs(indices, &starts, &offsets)) {
+        SEXP data = PROTECT(allocVector(TYPEOF(source), get_length(x)));
+        copy_runs_region(source, starts, offsets, 0, XLENGTH(data), DATAPTR(data));
+        UNPROTECT(1);
+        return data;
+    }
+
+    return copy_data_at_indices(source, indices);
+}
+
 static void *prism_dataptr(SEXP x, Rboolean writeable) {
     make_sure(x != NULL, Rf_error, "x must not be null");
 
@@ -150,9 +218,7 @@ static void *prism_dataptr(SEXP x, Rboolean writeable) {
         return (writeable) ? DATAPTR(data) : ((void *) DATAPTR_RO(data));
     }
 
-    SEXP/*INTSXP|REALSXP*/  indices = get_indices(x);
-    SEXP                    source  = get_source(x);
-    SEXP data = copy_data_at_indices(source, indices);
+    SEXP data = materialize(x);
     set_materialized_data(x, data);
     return writeable ? DATAPTR(data) : (void *) DATAPTR_RO(data);
 }
@@ -165,16 +231,9 @@ static const void *prism_dataptr_or_null(SEXP x) {
         Rprintf("           SEXP: %p\n", x);
     }
 
-    if (is_materialized(x)) {
-        SEXP data = get_materialized_data(x);
-        return DATAPTR_RO(data);
-    }
-
-    SEXP/*INTSXP|REALSXP*/  indices = get_indices(x);
-    SEXP                    source  = get_source(x);
-    SEXP data = copy_data_at_indices(source, indices);
-    set_materialized_data(x, data);
-    return DATAPTR_RO(data);
+    // Without a data pointer, R reads the prism through Get_region, which
+    // copies runs of contiguous indices without materializing the prism.
+    return is_materialized(x) ? DATAPTR_RO(get_materialized_data(x)) : NULL;
 }
 
 static inline R_xlen_t translate_index(SEXP/*INTSXP|REALSXP*/ indices, R_xlen_t index) {
@@ -230,7 +289,7 @@ static double prism_numeric_element(SEXP x, R_xlen_t i) {
     if (is_materialized(x)) {
         SEXP/*INTSXP*/ data = get_materialized_data(x);
         make_sure(TYPEOF(data) == REALSXP, Rf_error, "type of data should be REALSXP");
-        return INTEGER_ELT(data, i);
+        return REAL_ELT(data, i);
     }
 
     SEXP/*INTSXP|REALSXP*/ indices = get_indices(x);
@@ -333,6 +392,19 @@ static int prism_logical_element(SEXP x, R_xlen_t i) {
     return LOGICAL_ELT(source, projected_index);
 }
 
+static R_xlen_t prism_get_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    if (!is_materialized(x)) {
+        SEXP/*REALSXP*/ starts  = R_NilValue;
+        SEXP/*REALSXP*/ offsets = R_NilValue;
+        if (index_runs(get_indices(x), &starts, &offsets)) {
+            return copy_runs_region(get_source(x), starts, offsets, i, n, buf);
+        }
+        set_materialized_data(x, materialize(x));
+    }
+
+    return copy_region(get_materialized_data(x), i, n, buf);
+}
+
 static R_xlen_t prism_integer_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
     make_sure(x != R_NilValue, Rf_error, "x must not be null");
 
@@ -344,18 +416,7 @@ static R_xlen_t prism_integer_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *bu
         Rprintf("is_materialized: %i\n", is_materialized(x));
     }
 
-    SEXP/*INTSXP*/ data;
-    if (!is_materialized(x)) {
-        SEXP/*INTSXP|REALSXP*/ indices = get_indices(x);
-        SEXP                   source  = get_source(x);
-        SEXP data = copy_data_at_indices(source, indices);
-        set_materialized_data(x, data);
-    } else {
-        data = get_materialized_data(x);
-    }
-
-    make_sure(TYPEOF(data) == INTSXP, Rf_error, "type of data should be INTSXP");
-    return INTEGER_GET_REGION(data, i, n, buf);
+    return prism_get_region(x, i, n, buf);
 }
 
 static R_xlen_t prism_numeric_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
@@ -369,18 +430,7 @@ static R_xlen_t prism_numeric_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double
         Rprintf("is_materialized: %i\n", is_materialized(x));
     }
 
-    SEXP/*REALSXP*/ data;
-    if (!is_materialized(x)) {
-        SEXP/*INTSXP|REALSXP*/ indices = get_indices(x);
-        SEXP                   source  = get_source(x);
-        SEXP data = copy_data_at_indices(source, indices);
-        set_materialized_data(x, data);
-    } else {
-        data = get_materialized_data(x);
-    }
-
-    make_sure(TYPEOF(data) == REALSXP, Rf_error, "type of data should be REALSXP");
-    return REAL_GET_REGION(data, i, n, buf);
+    return prism_get_region(x, i, n, buf);
 }
 
 static R_xlen_t prism_raw_get_region(SEXP x, R_xlen_t i, R_xlen_t n, Rbyte *buf) {
@@ -394,18 +444,7 @@ static R_xlen_t prism_raw_get_region(SEXP x, R_xlen_t i, R_xlen_t n, Rbyte *buf)
         Rprintf("is_materialized: %i\n", is_materialized(x));
     }
 
-    SEXP/*RAWSXP*/ data;
-    if (!is_materialized(x)) {
-        SEXP/*INTSXP|REALSXP*/ indices = get_indices(x);
-        SEXP                   source  = get_source(x);
-        SEXP data = copy_data_at_indices(source, indices);
-        set_materialized_data(x, data);
-    } else {
-        data = get_materialized_data(x);
-    }
-
-    make_sure(TYPEOF(data) == RAWSXP, Rf_error, "type of data should be RAWSXP");
-    return RAW_GET_REGION(data, i, n, buf);
+    return prism_get_region(x, i, n, buf);
 }
 
 static R_xlen_t prism_complex_get_region(SEXP x, R_xlen_t i, R_xlen_t n, Rcomplex *buf) {
@@ -419,18 +458,7 @@ static R_xlen_t prism_complex_get_region(SEXP x, R_xlen_t i, R_xlen_t n, Rcomple
         Rprintf("is_materialized: %i\n", is_materialized(x));
     }
 
-    SEXP/*CPLXSXP*/ data;
-    if (!is_materialized(x)) {
-        SEXP/*INTSXP|REALSXP*/ indices = get_indices(x);
-        SEXP                   source  = get_source(x);
-        SEXP data = copy_data_at_indices(source, indices);
-        set_materialized_data(x, data);
-    } else {
-        data = get_materialized_data(x);
-    }
-
-    make_sure(TYPEOF(data) == CPLXSXP, Rf_error, "type of data should be CPLXSXP");
-    return COMPLEX_GET_REGION(data, i, n, buf);
+    return prism_get_region(x, i, n, buf);
 }
 
 static R_xlen_t prism_logical_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
@@ -444,18 +472,7 @@ static R_xlen_t prism_logical_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *bu
         Rprintf("is_materialized: %i\n", is_materialized(x));
     }
 
-    SEXP/*LGLSXP*/ data;
-    if (!is_materialized(x)) {
-        SEXP/*INTSXP|REALSXP*/ indices = get_indices(x);
-        SEXP                   source  = get_source(x);
-        SEXP data = copy_data_at_indices(source, indices);
-        set_materialized_data(x, data);
-    } else {
-        data = get_materialized_data(x);
-    }
-
-    make_sure(TYPEOF(data) == LGLSXP, Rf_error, "type of data should be LGLSXP");
-    return LOGICAL_GET_REGION(data, i, n, buf);
+    return prism_get_region(x, i, n, buf);
 }
 
 SEXP/*REALSXP*/ map_indices_onto_source(SEXP/*INTSXP|REALSXP*/ indices, SEXP/*INTSXP|REALSXP*/ prism_indices, R_xlen_t size) {
@@ -520,14 +537,17 @@ static SEXP prism_extract_subset(SEXP x, SEXP indices, SEXP call) {
         return copy_data_at_indices(materialized_data, screened_indices);
     }
 
-    if (!do_indices_contain_NAs(screened_indices)) {
+    if (do_indices_contain_NAs(screened_indices)) {
     	SEXP/*REALSXP*/ translated_indices = map_indices_onto_source(screened_indices, prism_indices, size);
     	return copy_data_at_indices(source, translated_indices);
     }
 
     // Non-NA indices.
-    SEXP translated_indices = map_indices_onto_source(indices, prism_indices, size);
-    return prism_new(source, translated_indices);
+    SEXP translated_indices = PROTECT(map_indices_onto_source(indices, prism_indices, size));
+    SEXP encoded_indices    = PROTECT(encode_indices(translated_indices, XLENGTH(source)));
+    SEXP prism = prism_new(source, encoded_indices);
+    UNPROTECT(2);
+    return prism;
 }
 
 // R_set_altstring_Set_elt_method
@@ -536,10 +556,23 @@ static SEXP prism_extract_subset(SEXP x, SEXP indices, SEXP call) {
 // R_set_altstring_Elt_method
 // string_elt(SEXP x, R_xlen_t i)
 
+static SEXP prism_coerce(SEXP x, int type) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("prism_coerce\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           type: %s\n", type2char(type));
+    }
+
+    return coerce_view(x, type);
+}
+
 void init_common_prism(R_altrep_class_t cls) {
     R_set_altrep_Duplicate_method(cls, prism_duplicate);
     R_set_altrep_Inspect_method(cls, prism_inspect);
     R_set_altrep_Length_method(cls, prism_length);
+    R_set_altrep_Coerce_method(cls, prism_coerce);
 
     R_set_altvec_Dataptr_method(cls, prism_dataptr);
     R_set_altvec_Dataptr_or_null_method(cls, prism_dataptr_or_null);
@@ -626,5 +659,8 @@ SEXP create_prism(SEXP source, SEXP/*INTSXP|REALSXP*/ indices) {
         Rprintf("           SEXP: %p\n", source);
     }
 
-    return prism_new(source, indices);
+    SEXP encoded_indices = PROTECT(encode_indices(indices, source_length));
+    SEXP prism = prism_new(source, encoded_indices);
+    UNPROTECT(1);
+    return prism;
 }
@@ -1,6 +1,13 @@
 #pragma once
 
 #include "Rinternals.h"
+#include <stdbool.h>
+
+SEXP           prism_new(SEXP source, SEXP/*INTSXP|REALSXP*/ indices);
+
+// True if x is a prism that was not written to, in which case its source
+// and indices are returned through the pointers.
+bool           prism_selection(SEXP x, SEXP *source, SEXP/*INTSXP|REALSXP*/ *indices);
 
 SEXP/*NILSXP*/ create_prism(SEXP, SEXP/*INTSXP|REALSXP*/ indices);
 
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+// A counter-based generator: the n-th number of a stream is a hash of the
+// stream's key and n, so any element can be regenerated without the ones
+// before it. The hash is the finalizer of SplitMix64.
+#define random_golden_gamma 0x9E3779B97F4A7C15ULL
+
+static inline uint64_t random_mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t random_key(uint64_t seed, uint64_t stream) {
+    return random_mix(random_mix(seed + random_golden_gamma) + stream * random_golden_gamma);
+}
+
+static inline uint64_t random_at(uint64_t key, uint64_t counter) {
+    return random_mix(key + (counter + 1) * random_golden_gamma);
+}
+
+// Maps a random number onto [0, bound) by multiplying and keeping the high
+// half, which avoids a division.
+static inline uint64_t random_below(uint64_t random, uint64_t bound) {
+    return (uint64_t) (((unsigned __int128) random * bound) >> 64);
+}
@@ -0,0 +1,438 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Altrep.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "common.h"
+
+#include "reinterpretations.h"
+#include "slices.h"
+#include "coercions.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// A reinterpretation is a view of a region of a raw vector as a vector of
+// integers, doubles, or logicals, the way readBin would decode it. The region
+// is described by a slice window whose start is a byte offset into the raw
+// vector and whose size is a number of elements. If the bytes are in the wrong
+// order for this machine, each element is byte-swapped as it is read.
+//
+// A reinterpretation of a raw slice reads from the slice's source directly.
+static R_altrep_class_t reinterpretation_integer_altrep;
+static R_altrep_class_t reinterpretation_numeric_altrep;
+static R_altrep_class_t reinterpretation_logical_altrep;
+
+static inline R_altrep_class_t class_from_sexp_type(SEXPTYPE type) { // @suppress("No return")
+    switch (type) {
+        case INTSXP:  return reinterpretation_integer_altrep;
+        case REALSXP: return reinterpretation_numeric_altrep;
+        case LGLSXP:  return reinterpretation_logical_altrep;
+        default:      Rf_error("No ALTREP reinterpretation class for vector of type %s", type2str(type));
+    }
+}
+
+SEXP reinterpretation_new(SEXP/*RAWSXP*/ source, SEXPTYPE type, R_xlen_t offset, R_xlen_t size, bool swap) {
+    make_sure(TYPEOF(source) == RAWSXP, Rf_error, "type of source must be RAWSXP");
+    make_sure(type == INTSXP || type == REALSXP || type == LGLSXP, Rf_error,
+              "type must be one of INTSXP, REALSXP, or LGLSXP");
+    make_sure(offset >= 0 && offset + size * (R_xlen_t) __get_element_size(type) <= XLENGTH(source), Rf_error,
+              "reinterpretation must fit within the length of source");
+
+    if (get_debug_mode()) {
+        Rprintf("reinterpretation_new\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("           type: %s\n", type2char(type));
+        Rprintf("         offset: %li\n", offset);
+        Rprintf("           size: %li\n", size);
+        Rprintf("           swap: %i\n", swap);
+    }
+
+    SEXP/*INTSXP*/ window = PROTECT(write_start_and_size(offset, size));
+
+    SEXP/*LISTSXP*/ data = PROTECT(allocSExp(LISTSXP));
+    SETCAR (data, source);                 // The original vector
+    SET_TAG(data, R_NilValue);             // Starts as R_NilValue, becomes a vector if it the reinterpretation is written to
+    SETCDR (data, ScalarLogical(swap));    // Whether the bytes of each element are swapped
+
+    SEXP reinterpretation = R_new_altrep(class_from_sexp_type(type), window, data);
+    UNPROTECT(2);
+    return reinterpretation;
+}
+
+static inline SEXP/*INTSXP*/ get_window(SEXP x) {
+    return R_altrep_data1(x);
+}
+
+static inline SEXP get_source(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return CAR(cell);
+}
+
+static inline bool get_swap(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return LOGICAL_ELT(CDR(cell), 0);
+}
+
+static inline SEXP get_materialized_data(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell);
+}
+
+static inline void set_materialized_data(SEXP x, SEXP data) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    SET_TAG(cell, data);
+}
+
+static inline bool is_materialized(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell) != R_NilValue;
+}
+
+static inline size_t get_element_size(SEXP x) {
+    return __get_element_size(TYPEOF(x));
+}
+
+static void swap_bytes(void *buffer, R_xlen_t size, size_t element_size) {
+    if (element_size == sizeof(uint32_t)) {
+        uint32_t *elements = (uint32_t *) buffer;
+        for (R_xlen_t i = 0; i < size; i++) {
+            elements[i] = __builtin_bswap32(elements[i]);
+        }
+    } else {
+        uint64_t *elements = (uint64_t *) buffer;
+        for (R_xlen_t i = 0; i < size; i++) {
+            elements[i] = __builtin_bswap64(elements[i]);
+        }
+    }
+}
+
+// The elements can be read straight out of the raw vector if they need no
+// swapping and the raw vector keeps them at properly aligned addresses.
+static const void *extract_read_only_data_pointer(SEXP x) {
+    if (get_swap(x)) {
+        return NULL;
+    }
+
+    const Rbyte *bytes = (const Rbyte *) DATAPTR_OR_NULL(get_source(x));
+    if (bytes == NULL) {
+        return NULL;
+    }
+
+    R_xlen_t offset = 0;
+    R_xlen_t size   = 0;
+    read_start_and_size(get_window(x), &offset, &size);
+
+    const Rbyte *data = bytes + offset;
+    return ((uintptr_t) data % get_element_size(x) == 0) ? (const void *) data : NULL;
+}
+
+static R_xlen_t copy_reinterpreted_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    R_xlen_t offset = 0;
+    R_xlen_t length = 0;
+    read_start_and_size(get_window(x), &offset, &length);
+
+    size_t   element_size = get_element_size(x);
+    R_xlen_t size         = (length - i < n) ? length - i : n;
+
+    copy_region(get_source(x), offset + i * element_size, size * element_size, buf);
+    if (get_swap(x)) {
+        swap_bytes(buf, size, element_size);
+    }
+    return size;
+}
+
+SEXP reinterpretation_duplicate(SEXP x, Rboolean deep) {
+
+    if (get_debug_mode()) {
+        Rprintf("reinterpretation_duplicate\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           deep: %i\n", deep);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    R_xlen_t offset = 0;
+    R_xlen_t size   = 0;
+    read_start_and_size(get_window(x), &offset, &size);
+
+    SEXP reinterpretation = PROTECT(reinterpretation_new(get_source(x), TYPEOF(x), offset, size, get_swap(x)));
+    if (is_materialized(x)) {
+        SEXP data = get_materialized_data(x);
+        set_materialized_data(reinterpretation, deep ? duplicate(data) : data);
+    }
+    UNPROTECT(1);
+    return reinterpretation;
+}
+
+static Rboolean reinterpretation_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+
+    Rprintf("reinterpretation_altrep %s\n", type2char(TYPEOF(x)));
+
+    inspect_subtree(R_altrep_data1(x), pre, deep, pvec);
+    inspect_subtree(R_altrep_data2(x), pre, deep, pvec);
+
+    return FALSE;
+}
+
+static R_xlen_t reinterpretation_length(SEXP x) {
+    if (get_debug_mode()) {
+        Rprintf("reinterpretation_length\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    R_xlen_t offset = 0;
+    R_xlen_t size   = 0;
+    read_start_and_size(get_window(x), &offset, &size);
+    return size;
+}
+
+static SEXP materialize(SEXP x) {
+    SEXP data = PROTECT(allocVector(TYPEOF(x), XLENGTH(x)));
+    copy_reinterpreted_region(x, 0, XLENGTH(data), DATAPTR(data));
+    UNPROTECT(1);
+    return data;
+}
+
+static void *reinterpretation_dataptr(SEXP x, Rboolean writeable) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reinterpretation_dataptr\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("      writeable: %i\n", writeable);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (!is_materialized(x) && !writeable) {
+        const void *data = extract_read_only_data_pointer(x);
+        if (data != NULL) {
+            return (void *) data;
+        }
+    }
+
+    if (!is_materialized(x)) {
+        set_materialized_data(x, materialize(x));
+    }
+
+    SEXP data = get_materialized_data(x);
+    return writeable ? DATAPTR(data) : (void *) DATAPTR_RO(data);
+}
+
+static const void *reinterpretation_dataptr_or_null(SEXP x) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reinterpretation_dataptr_or_null\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    if (is_materialized(x)) {
+        return DATAPTR_RO(get_materialized_data(x));
+    }
+
+    return extract_read_only_data_pointer(x);
+}
+
+static int reinterpretation_integer_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reinterpretation_integer_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return INTEGER_ELT(get_materialized_data(x), i);
+    }
+
+    int element = 0;
+    copy_reinterpreted_region(x, i, 1, &element);
+    return element;
+}
+
+static double reinterpretation_numeric_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reinterpretation_numeric_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return REAL_ELT(get_materialized_data(x), i);
+    }
+
+    double element = 0;
+    copy_reinterpreted_region(x, i, 1, &element);
+    return element;
+}
+
+static int reinterpretation_logical_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reinterpretation_logical_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return LOGICAL_ELT(get_materialized_data(x), i);
+    }
+
+    int element = 0;
+    copy_reinterpreted_region(x, i, 1, &element);
+    return element;
+}
+
+static R_xlen_t reinterpretation_get_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reinterpretation_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return copy_region(get_materialized_data(x), i, n, buf);
+    }
+
+    return copy_reinterpreted_region(x, i, n, buf);
+}
+
+static R_xlen_t reinterpretation_integer_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    return reinterpretation_get_region(x, i, n, buf);
+}
+
+static R_xlen_t reinterpretation_numeric_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    return reinterpretation_get_region(x, i, n, buf);
+}
+
+static R_xlen_t reinterpretation_logical_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    return reinterpretation_get_region(x, i, n, buf);
+}
+
+static SEXP reinterpretation_coerce(SEXP x, int type) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reinterpretation_coerce\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           type: %s\n", type2char(type));
+    }
+
+    return coerce_view(x, type);
+}
+
+static void init_common_reinterpretation(R_altrep_class_t cls) {
+    R_set_altrep_Duplicate_method(cls, reinterpretation_duplicate);
+    R_set_altrep_Inspect_method(cls, reinterpretation_inspect);
+    R_set_altrep_Length_method(cls, reinterpretation_length);
+    R_set_altrep_Coerce_method(cls, reinterpretation_coerce);
+
+    R_set_altvec_Dataptr_method(cls, reinterpretation_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, reinterpretation_dataptr_or_null);
+}
+
+void init_reinterpretation_integer_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altinteger_class("reinterpretation_integer_altrep", "viewports", dll);
+    reinterpretation_integer_altrep = cls;
+
+    init_common_reinterpretation(cls);
+
+    R_set_altinteger_Elt_method(cls, reinterpretation_integer_element);
+    R_set_altinteger_Get_region_method(cls, reinterpretation_integer_get_region);
+}
+
+void init_reinterpretation_numeric_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altreal_class("reinterpretation_numeric_altrep", "viewports", dll);
+    reinterpretation_numeric_altrep = cls;
+
+    init_common_reinterpretation(cls);
+
+    R_set_altreal_Elt_method(cls, reinterpretation_numeric_element);
+    R_set_altreal_Get_region_method(cls, reinterpretation_numeric_get_region);
+}
+
+void init_reinterpretation_logical_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altlogical_class("reinterpretation_logical_altrep", "viewports", dll);
+    reinterpretation_logical_altrep = cls;
+
+    init_common_reinterpretation(cls);
+
+    R_set_altlogical_Elt_method(cls, reinterpretation_logical_element);
+    R_set_altlogical_Get_region_method(cls, reinterpretation_logical_get_region);
+}
+
+void init_reinterpretation_altrep_class(DllInfo * dll) {
+    init_reinterpretation_integer_altrep_class(dll);
+    init_reinterpretation_numeric_altrep_class(dll);
+    init_reinterpretation_logical_altrep_class(dll);
+}
+
+static SEXPTYPE type_from_name(const char *name) { // @suppress("No return")
+    if (strcmp(name, "integer") == 0) return INTSXP;
+    if (strcmp(name, "double")  == 0) return REALSXP;
+    if (strcmp(name, "numeric") == 0) return REALSXP;
+    if (strcmp(name, "logical") == 0) return LGLSXP;
+    Rf_error("Raw vectors can only be viewed as integer, double, or logical vectors, but found: %s", name);
+}
+
+SEXP create_reinterpretation(SEXP/*RAWSXP*/ source, SEXP/*STRSXP*/ type_sexp, SEXP/*INTSXP|REALSXP*/ offset_sexp,
+                             SEXP/*INTSXP|REALSXP*/ count_sexp, SEXP/*LGLSXP*/ swap_sexp) {
+    make_sure(TYPEOF(source) == RAWSXP, Rf_error, "type of source must be RAWSXP");
+    make_sure(TYPEOF(type_sexp) == STRSXP && XLENGTH(type_sexp) > 0, Rf_error, "type must be a character vector");
+    make_sure(TYPEOF(swap_sexp) == LGLSXP && XLENGTH(swap_sexp) > 0, Rf_error, "swap must be a logical vector");
+
+    SEXPTYPE type         = type_from_name(CHAR(STRING_ELT(type_sexp, 0)));
+    size_t   element_size = __get_element_size(type);
+    bool     swap         = LOGICAL_ELT(swap_sexp, 0) == TRUE;
+
+    // The offset is 0-based, like readBin would see it after skipping bytes.
+    R_xlen_t offset = get_first_element_as_whole_length(offset_sexp, "offset");
+    if (offset < 0 || offset > XLENGTH(source)) {
+        Rf_error("Offset must be between 0 and the length of the raw vector");
+    }
+
+    R_xlen_t available = (XLENGTH(source) - offset) / element_size;
+    R_xlen_t count     = (count_sexp == R_NilValue) ? available : get_first_element_as_whole_length(count_sexp, "count");
+    if (count < 0 || count > available) {
+        Rf_error("Count exceeds the number of elements in the raw vector after the offset");
+    }
+
+    // Views of raw slices read from the slice's source.
+    SEXP     slice_source = R_NilValue;
+    R_xlen_t slice_start  = 0;
+    R_xlen_t slice_size   = 0;
+    if (slice_window(source, &slice_source, &slice_start, &slice_size)) {
+        source = slice_source;
+        offset = slice_start + offset;
+    }
+
+    if (get_debug_mode()) {
+        Rprintf("create reinterpretation\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("           type: %s\n", type2char(type));
+        Rprintf("         offset: %li\n", offset);
+        Rprintf("          count: %li\n", count);
+        Rprintf("           swap: %i\n", swap);
+    }
+
+    return reinterpretation_new(source, type, offset, count, swap);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "Rinternals.h"
+#include <stdbool.h>
+
+SEXP reinterpretation_new(SEXP/*RAWSXP*/ source, SEXPTYPE type, R_xlen_t offset, R_xlen_t size, bool swap);
+
+SEXP create_reinterpretation(SEXP/*RAWSXP*/ source, SEXP/*STRSXP*/ type, SEXP/*INTSXP|REALSXP*/ offset,
+                             SEXP/*INTSXP|REALSXP|NILSXP*/ count, SEXP/*LGLSXP*/ swap);
+
+void init_reinterpretation_altrep_class(DllInfo *dll);
@@ -0,0 +1,568 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Altrep.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "common.h"
+
+#include "repetitions.h"
+#include "coercions.h"
+#include "aggregates.h"
+#include "zonemaps.h"
+#include "prefixsums.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// A repetition is the source repeated as if by rep(source, times, each=each):
+// every element of the source is repeated `each` times, and then the whole
+// thing is repeated `times` times. Its i-th element is the source's
+// ((i / each) % length(source))-th element.
+static R_altrep_class_t repetition_integer_altrep;
+static R_altrep_class_t repetition_numeric_altrep;
+static R_altrep_class_t repetition_logical_altrep;
+static R_altrep_class_t repetition_complex_altrep;
+static R_altrep_class_t repetition_raw_altrep;
+
+static inline R_altrep_class_t class_from_sexp_type(SEXPTYPE type) { // @suppress("No return")
+    switch (type) {
+        case INTSXP:  return repetition_integer_altrep;
+        case REALSXP: return repetition_numeric_altrep;
+        case LGLSXP:  return repetition_logical_altrep;
+        case CPLXSXP: return repetition_complex_altrep;
+        case RAWSXP:  return repetition_raw_altrep;
+        default:      Rf_error("No ALTREP repetition class for vector of type %s", type2str(type));
+    }
+}
+
+#define REPETITION_TIMES 0
+#define REPETITION_EACH  1
+
+SEXP repetition_new(SEXP source, R_xlen_t times, R_xlen_t each) {
+    make_sure(TYPEOF(source) == INTSXP || TYPEOF(source) == REALSXP || TYPEOF(source) == CPLXSXP
+           || TYPEOF(source) == LGLSXP || TYPEOF(source) == RAWSXP, Rf_error,
+              "type of source should be one of INTSXP, REALSXP, CPLXSXP, LGLSXP, or RAWSXP");
+    make_sure(times >= 0 && each >= 1, Rf_error, "times must not be negative and each must be positive");
+
+    if (get_debug_mode()) {
+        Rprintf("repetition_new\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("          times: %li\n", times);
+        Rprintf("           each: %li\n", each);
+    }
+
+    SEXP/*REALSXP*/ parameters = PROTECT(allocVector(REALSXP, 2));
+    SET_REAL_ELT(parameters, REPETITION_TIMES, (double) times);
+    SET_REAL_ELT(parameters, REPETITION_EACH,  (double) each);
+
+    SEXP/*LISTSXP*/ data = PROTECT(allocSExp(LISTSXP));
+    SETCAR (data, source);     // The original vector
+    SET_TAG(data, R_NilValue); // Starts as R_NilValue, becomes a vector if it the repetition is written to
+    SETCDR (data, R_NilValue); // Nothing here
+
+    SEXP repetition = R_new_altrep(class_from_sexp_type(TYPEOF(source)), parameters, data);
+    UNPROTECT(2);
+    return repetition;
+}
+
+static inline R_xlen_t get_times(SEXP x) {
+    return (R_xlen_t) REAL_ELT(R_altrep_data1(x), REPETITION_TIMES);
+}
+
+static inline R_xlen_t get_each(SEXP x) {
+    return (R_xlen_t) REAL_ELT(R_altrep_data1(x), REPETITION_EACH);
+}
+
+static inline SEXP get_source(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return CAR(cell);
+}
+
+static inline SEXP get_materialized_data(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell);
+}
+
+static inline void set_materialized_data(SEXP x, SEXP data) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    SET_TAG(cell, data);
+}
+
+static inline bool is_materialized(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell) != R_NilValue;
+}
+
+static inline R_xlen_t project_index(SEXP x, R_xlen_t i) {
+    return (i / get_each(x)) % XLENGTH(get_source(x));
+}
+
+SEXP repetition_duplicate(SEXP x, Rboolean deep) {
+
+    if (get_debug_mode()) {
+        Rprintf("repetition_duplicate\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           deep: %i\n", deep);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    SEXP repetition = PROTECT(repetition_new(get_source(x), get_times(x), get_each(x)));
+    if (is_materialized(x)) {
+        SEXP data = get_materialized_data(x);
+        set_materialized_data(repetition, deep ? duplicate(data) : data);
+    }
+    UNPROTECT(1);
+    return repetition;
+}
+
+static Rboolean repetition_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+
+    Rprintf("repetition_altrep %s\n", type2char(TYPEOF(x)));
+
+    inspect_subtree(R_altrep_data1(x), pre, deep, pvec);
+    inspect_subtree(R_altrep_data2(x), pre, deep, pvec);
+
+    return FALSE;
+}
+
+static R_xlen_t repetition_length(SEXP x) {
+    if (get_debug_mode()) {
+        Rprintf("repetition_length\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return XLENGTH(get_source(x)) * get_each(x) * get_times(x);
+}
+
+// Fills the buffer with copies of its first run elements, doubling the filled
+// part with every memcpy.
+static void replicate_leading_run(char *buffer, size_t element_size, R_xlen_t run, R_xlen_t count) {
+    R_xlen_t filled = run;
+    while (filled < count) {
+        R_xlen_t copied = (count - filled < filled) ? count - filled : filled;
+        memcpy(buffer + filled * element_size, buffer, copied * element_size);
+        filled += copied;
+    }
+}
+
+// Writes count elements of the repetition starting from the i-th one: with
+// each = 1 as runs of consecutive source elements, otherwise as runs of a
+// single source element each repeated up to `each` times.
+static void copy_repeated_elements(SEXP x, R_xlen_t i, R_xlen_t count, char *buffer) {
+    SEXP     source = get_source(x);
+    R_xlen_t source_length = XLENGTH(source);
+    R_xlen_t each   = get_each(x);
+    size_t   element_size = __get_element_size(TYPEOF(source));
+
+    R_xlen_t written = 0;
+    while (written < count) {
+        R_xlen_t position = i + written;
+        R_xlen_t source_index = (position / each) % source_length;
+        R_xlen_t remaining = count - written;
+
+        if (each == 1) {
+            R_xlen_t run = source_length - source_index;
+            R_xlen_t run_count = (remaining < run) ? remaining : run;
+            copy_region(source, source_index, run_count, buffer + written * element_size);
+            written += run_count;
+        } else {
+            R_xlen_t run = each - position % each;
+            R_xlen_t run_count = (remaining < run) ? remaining : run;
+            copy_region(source, source_index, 1, buffer + written * element_size);
+            replicate_leading_run(buffer + written * element_size, element_size, 1, run_count);
+            written += run_count;
+        }
+    }
+}
+
+// Tiles a region of the repetition. The repetition has a period of
+// length(source) * each elements: the partial period the region starts in is
+// written element by element, then one whole period is, and the rest of the
+// region is filled by doubling that period with memcpy, so the source is read
+// at most twice however many times it is repeated.
+static R_xlen_t copy_repeated_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    R_xlen_t length = repetition_length(x);
+    R_xlen_t size   = (length - i < n) ? length - i : n;
+    if (size <= 0) {
+        return 0;
+    }
+
+    size_t   element_size = __get_element_size(TYPEOF(get_source(x)));
+    R_xlen_t period = XLENGTH(get_source(x)) * get_each(x);
+    char    *buffer = (char *) buf;
+
+    R_xlen_t leading = period - i % period;
+    if (leading > size) {
+        leading = size;
+    }
+    copy_repeated_elements(x, i, leading, buffer);
+
+    if (leading < size) {
+        char    *tiles = buffer + leading * element_size;
+        R_xlen_t tiled = size - leading;
+        R_xlen_t first_tile = (tiled < period) ? tiled : period;
+        copy_repeated_elements(x, i + leading, first_tile, tiles);
+        replicate_leading_run(tiles, element_size, first_tile, tiled);
+    }
+    return size;
+}
+
+static SEXP materialize(SEXP x) {
+    R_xlen_t size = repetition_length(x);
+    SEXP data = PROTECT(allocVector(TYPEOF(get_source(x)), size));
+    copy_repeated_region(x, 0, size, DATAPTR(data));
+    UNPROTECT(1);
+    return data;
+}
+
+static void *repetition_dataptr(SEXP x, Rboolean writeable) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("repetition_dataptr\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("      writeable: %i\n", writeable);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (!is_materialized(x)) {
+        set_materialized_data(x, materialize(x));
+    }
+
+    SEXP data = get_materialized_data(x);
+    return writeable ? DATAPTR(data) : (void *) DATAPTR_RO(data);
+}
+
+static const void *repetition_dataptr_or_null(SEXP x) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("repetition_dataptr_or_null\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return is_materialized(x) ? DATAPTR_RO(get_materialized_data(x)) : NULL;
+}
+
+static int repetition_integer_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("repetition_integer_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return INTEGER_ELT(get_materialized_data(x), i);
+    }
+
+    return INTEGER_ELT(get_source(x), project_index(x, i));
+}
+
+static double repetition_numeric_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("repetition_numeric_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return REAL_ELT(get_materialized_data(x), i);
+    }
+
+    return REAL_ELT(get_source(x), project_index(x, i));
+}
+
+static int repetition_logical_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("repetition_logical_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return LOGICAL_ELT(get_materialized_data(x), i);
+    }
+
+    return LOGICAL_ELT(get_source(x), project_index(x, i));
+}
+
+static Rcomplex repetition_complex_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("repetition_complex_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return COMPLEX_ELT(get_materialized_data(x), i);
+    }
+
+    return COMPLEX_ELT(get_source(x), project_index(x, i));
+}
+
+static Rbyte repetition_raw_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("repetition_raw_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return RAW_ELT(get_materialized_data(x), i);
+    }
+
+    return RAW_ELT(get_source(x), project_index(x, i));
+}
+
+static R_xlen_t repetition_get_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("repetition_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return copy_region(get_materialized_data(x), i, n, buf);
+    }
+
+    return copy_repeated_region(x, i, n, buf);
+}
+
+static R_xlen_t repetition_integer_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    return repetition_get_region(x, i, n, buf);
+}
+
+static R_xlen_t repetition_numeric_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    return repetition_get_region(x, i, n, buf);
+}
+
+static R_xlen_t repetition_logical_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    return repetition_get_region(x, i, n, buf);
+}
+
+static R_xlen_t repetition_complex_get_region(SEXP x, R_xlen_t i, R_xlen_t n, Rcomplex *buf) {
+    return repetition_get_region(x, i, n, buf);
+}
+
+static R_xlen_t repetition_raw_get_region(SEXP x, R_xlen_t i, R_xlen_t n, Rbyte *buf) {
+    return repetition_get_region(x, i, n, buf);
+}
+
+// Every element of the source occurs exactly each * times times, so the
+// extremes are those of the source and the sum is that of the source scaled.
+static SEXP repetition_min(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("repetition_min\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x) || repetition_length(x) == 0) {
+        return NULL;
+    }
+
+    SEXP source = get_source(x);
+    extremes_t extremes;
+    extremes_init(&extremes);
+    if (!zone_map_extremes(source, 0, XLENGTH(source), &extremes)) {
+        extremes_of_region(source, 0, XLENGTH(source), &extremes);
+    }
+    return extremes_min_as_sexp(TYPEOF(x), &extremes, XLENGTH(source), narm);
+}
+
+static SEXP repetition_max(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("repetition_max\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x) || repetition_length(x) == 0) {
+        return NULL;
+    }
+
+    SEXP source = get_source(x);
+    extremes_t extremes;
+    extremes_init(&extremes);
+    if (!zone_map_extremes(source, 0, XLENGTH(source), &extremes)) {
+        extremes_of_region(source, 0, XLENGTH(source), &extremes);
+    }
+    return extremes_max_as_sexp(TYPEOF(x), &extremes, XLENGTH(source), narm);
+}
+
+static SEXP repetition_sum(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("repetition_sum\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    SEXP     source = get_source(x);
+    R_xlen_t copies = get_each(x) * get_times(x);
+
+    double   sum = 0;
+    R_xlen_t NAs = 0;
+    SEXP/*VECSXP*/ prefix_sums = prefix_sums_get(source);
+    if (prefix_sums == R_NilValue || !prefix_sums_of_region(prefix_sums, 0, XLENGTH(source), &sum, &NAs)) {
+        sum_of_region(source, 0, XLENGTH(source), &sum, &NAs);
+    }
+
+    return sum_as_sexp(TYPEOF(x), sum * (double) copies, NAs * copies, narm);
+}
+
+static SEXP repetition_coerce(SEXP x, int type) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("repetition_coerce\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           type: %s\n", type2char(type));
+    }
+
+    return coerce_view(x, type);
+}
+
+static void init_common_repetition(R_altrep_class_t cls) {
+    R_set_altrep_Duplicate_method(cls, repetition_duplicate);
+    R_set_altrep_Inspect_method(cls, repetition_inspect);
+    R_set_altrep_Length_method(cls, repetition_length);
+    R_set_altrep_Coerce_method(cls, repetition_coerce);
+
+    R_set_altvec_Dataptr_method(cls, repetition_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, repetition_dataptr_or_null);
+}
+
+void init_repetition_integer_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altinteger_class("repetition_integer_altrep", "viewports", dll);
+    repetition_integer_altrep = cls;
+
+    init_common_repetition(cls);
+
+    R_set_altinteger_Elt_method(cls, repetition_integer_element);
+    R_set_altinteger_Get_region_method(cls, repetition_integer_get_region);
+    R_set_altinteger_Min_method(cls, repetition_min);
+    R_set_altinteger_Max_method(cls, repetition_max);
+    R_set_altinteger_Sum_method(cls, repetition_sum);
+}
+
+void init_repetition_numeric_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altreal_class("repetition_numeric_altrep", "viewports", dll);
+    repetition_numeric_altrep = cls;
+
+    init_common_repetition(cls);
+
+    R_set_altreal_Elt_method(cls, repetition_numeric_element);
+    R_set_altreal_Get_region_method(cls, repetition_numeric_get_region);
+    R_set_altreal_Min_method(cls, repetition_min);
+    R_set_altreal_Max_method(cls, repetition_max);
+    R_set_altreal_Sum_method(cls, repetition_sum);
+}
+
+void init_repetition_logical_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altlogical_class("repetition_logical_altrep", "viewports", dll);
+    repetition_logical_altrep = cls;
+
+    init_common_repetition(cls);
+
+    R_set_altlogical_Elt_method(cls, repetition_logical_element);
+    R_set_altlogical_Get_region_method(cls, repetition_logical_get_region);
+    R_set_altlogical_Sum_method(cls, repetition_sum);
+}
+
+void init_repetition_complex_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altcomplex_class("repetition_complex_altrep", "viewports", dll);
+    repetition_complex_altrep = cls;
+
+    init_common_repetition(cls);
+
+    R_set_altcomplex_Elt_method(cls, repetition_complex_element);
+    R_set_altcomplex_Get_region_method(cls, repetition_complex_get_region);
+}
+
+void init_repetition_raw_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altraw_class("repetition_raw_altrep", "viewports", dll);
+    repetition_raw_altrep = cls;
+
+    init_common_repetition(cls);
+
+    R_set_altraw_Elt_method(cls, repetition_raw_element);
+    R_set_altraw_Get_region_method(cls, repetition_raw_get_region);
+}
+
+void init_repetition_altrep_class(DllInfo * dll) {
+    init_repetition_integer_altrep_class(dll);
+    init_repetition_numeric_altrep_class(dll);
+    init_repetition_logical_altrep_class(dll);
+    init_repetition_complex_altrep_class(dll);
+    init_repetition_raw_altrep_class(dll);
+}
+
+SEXP create_repetition(SEXP source, SEXP/*INTSXP|REALSXP*/ times_sexp, SEXP/*INTSXP|REALSXP*/ each_sexp) {
+    make_sure(TYPEOF(times_sexp) == INTSXP || TYPEOF(times_sexp) == REALSXP, Rf_error,
+              "type of times must be either INTSXP or REALSXP");
+    make_sure(TYPEOF(each_sexp) == INTSXP || TYPEOF(each_sexp) == REALSXP, Rf_error,
+              "type of each must be either INTSXP or REALSXP");
+    make_sure(XLENGTH(times_sexp) > 0, Rf_error, "times cannot be a zero-length vector");
+    make_sure(XLENGTH(each_sexp) > 0, Rf_error, "each cannot be a zero-length vector");
+
+    R_xlen_t times = get_first_element_as_whole_length(times_sexp, "times");
+    R_xlen_t each  = get_first_element_as_whole_length(each_sexp,  "each");
+
+    if (times < 0) {
+        Rf_error("Times cannot be negative");
+    }
+    if (each < 1) {
+        Rf_error("Each must be at least 1");
+    }
+    if ((double) XLENGTH(source) * (double) each * (double) times > (double) R_XLEN_T_MAX) {
+        Rf_error("Repetition is too long");
+    }
+
+    if (get_debug_mode()) {
+        Rprintf("create repetition\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("          times: %li\n", times);
+        Rprintf("           each: %li\n", each);
+    }
+
+    return repetition_new(source, times, each);
+}
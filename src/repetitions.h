@@ -0,0 +1,9 @@
+#pragma once
+
+#include "Rinternals.h"
+
+SEXP repetition_new(SEXP source, R_xlen_t times, R_xlen_t each);
+
+SEXP create_repetition(SEXP source, SEXP/*INTSXP|REALSXP*/ times, SEXP/*INTSXP|REALSXP*/ each);
+
+void init_repetition_altrep_class(DllInfo *dll);
@@ -0,0 +1,619 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Altrep.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "common.h"
+
+#include "resamplings.h"
+#include "random.h"
+#include "aggregates.h"
+#include "coercions.h"
+#include "bitmap_sexp.h"
+#include "mosaics.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// A resampling draws its elements from a source, as x[sample(length(x), size,
+// replace)] would, but it keeps no index vector. The index of every element is
+// regenerated when needed from a seed and a stream, so a resampling takes the
+// same small amount of memory regardless of its size:
+//
+//  - with replacement, the i-th index is drawn from a counter-based generator
+//    evaluated at i,
+//  - without replacement, the i-th index is i sent through a keyed permutation
+//    of the source positions: a Feistel network over the smallest power of
+//    four covering the source, with positions that fall outside the source
+//    sent through it again until they land inside.
+//
+// Bootstrap replicates are resamplings of the whole source, one stream each.
+// Their sums and extremes are computed by regenerating the indices a block at
+// a time.
+static R_altrep_class_t resampling_integer_altrep;
+static R_altrep_class_t resampling_numeric_altrep;
+static R_altrep_class_t resampling_logical_altrep;
+
+#define how_many_indices_in_resampling_block 1024
+
+#define how_many_feistel_rounds 4
+
+typedef struct {
+    uint64_t key;
+    R_xlen_t size;
+    R_xlen_t source_length;
+    bool     replace;
+    int      half_bits;   // Feistel networks split positions into two halves of this many bits.
+    uint64_t half_mask;
+} resampling_t;
+
+static inline R_altrep_class_t class_from_sexp_type(SEXPTYPE type) { // @suppress("No return")
+    switch (type) {
+        case INTSXP:  return resampling_integer_altrep;
+        case REALSXP: return resampling_numeric_altrep;
+        case LGLSXP:  return resampling_logical_altrep;
+        default:      Rf_error("No ALTREP resampling class for vector of type %s", type2str(type));
+    }
+}
+
+SEXP/*A*/ resampling_new(SEXP/*A*/ source, double seed, double stream, R_xlen_t size, bool replace) {
+    make_sure(TYPEOF(source) == INTSXP || TYPEOF(source) == REALSXP || TYPEOF(source) == LGLSXP, Rf_error,
+              "type of source must be one of INTSXP, REALSXP, or LGLSXP");
+    make_sure(size == 0 || XLENGTH(source) > 0, Rf_error, "cannot draw elements from an empty source");
+    make_sure(replace || size <= XLENGTH(source), Rf_error, "cannot draw more elements than the source has without replacement");
+
+    if (get_debug_mode()) {
+        Rprintf("resampling_new\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("           seed: %f\n", seed);
+        Rprintf("         stream: %f\n", stream);
+        Rprintf("           size: %li\n", size);
+        Rprintf("        replace: %i\n", replace);
+    }
+
+    SEXP/*REALSXP*/ descriptor = PROTECT(allocVector(REALSXP, 4));
+    SET_REAL_ELT(descriptor, 0, seed);
+    SET_REAL_ELT(descriptor, 1, stream);
+    SET_REAL_ELT(descriptor, 2, (double) size);
+    SET_REAL_ELT(descriptor, 3, replace ? 1 : 0);
+
+    SEXP/*LISTSXP*/ data = PROTECT(allocSExp(LISTSXP));
+    SETCAR (data, source);     // The original vector
+    SET_TAG(data, R_NilValue); // Starts as R_NilValue, becomes a vector if the resampling is written to
+    SETCDR (data, R_NilValue); // Nothing here
+
+    SEXP resampling = R_new_altrep(class_from_sexp_type(TYPEOF(source)), descriptor, data);
+    UNPROTECT(2);
+    return resampling;
+}
+
+static inline SEXP/*REALSXP*/ get_descriptor(SEXP x) {
+    return R_altrep_data1(x);
+}
+
+static inline SEXP get_source(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return CAR(cell);
+}
+
+static inline SEXP get_materialized_data(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell);
+}
+
+static inline void set_materialized_data(SEXP x, SEXP data) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    SET_TAG(cell, data);
+}
+
+static inline bool is_materialized(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell) != R_NilValue;
+}
+
+static inline void get_resampling(SEXP x, resampling_t *resampling) {
+    SEXP/*REALSXP*/ descriptor = get_descriptor(x);
+    resampling->key           = random_key((uint64_t) (int64_t) REAL_ELT(descriptor, 0),
+                                           (uint64_t) (int64_t) REAL_ELT(descriptor, 1));
+    resampling->size          = (R_xlen_t) REAL_ELT(descriptor, 2);
+    resampling->source_length = XLENGTH(get_source(x));
+    resampling->replace       = REAL_ELT(descriptor, 3) != 0;
+
+    int bits = 0;
+    while (bits < 62 && (((R_xlen_t) 1) << bits) < resampling->source_length) {
+        bits++;
+    }
+    resampling->half_bits = (bits + 1) / 2;
+    resampling->half_mask = (((uint64_t) 1) << resampling->half_bits) - 1;
+}
+
+static inline uint64_t feistel(const resampling_t *resampling, uint64_t position) {
+    uint64_t left  = position >> resampling->half_bits;
+    uint64_t right = position &  resampling->half_mask;
+    for (uint64_t round = 0; round < how_many_feistel_rounds; round++) {
+        uint64_t mixed = random_at(resampling->key, (round << 58) ^ right) & resampling->half_mask;
+        uint64_t next  = left ^ mixed;
+        left  = right;
+        right = next;
+    }
+    return (left << resampling->half_bits) | right;
+}
+
+static inline R_xlen_t permuted_index(const resampling_t *resampling, R_xlen_t i) {
+    uint64_t position = (uint64_t) i;
+    do {
+        position = feistel(resampling, position);
+    } while (position >= (uint64_t) resampling->source_length);
+    return (R_xlen_t) position;
+}
+
+static inline R_xlen_t resampled_index(const resampling_t *resampling, R_xlen_t i) {
+    if (!resampling->replace) {
+        return permuted_index(resampling, i);
+    }
+    return (R_xlen_t) random_below(random_at(resampling->key, (uint64_t) i), (uint64_t) resampling->source_length);
+}
+
+// Regenerates the indices of a region and gathers the elements they point to.
+static R_xlen_t copy_resampled_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    resampling_t resampling;
+    get_resampling(x, &resampling);
+
+    R_xlen_t size = (resampling.size - i < n) ? resampling.size - i : n;
+    if (size <= 0) {
+        return 0;
+    }
+
+    SEXP        source = get_source(x);
+    SEXPTYPE    type   = TYPEOF(source);
+    const void *data   = DATAPTR_OR_NULL(source);
+
+    R_xlen_t indices[how_many_indices_in_resampling_block];
+    for (R_xlen_t offset = 0; offset < size; offset += how_many_indices_in_resampling_block) {
+        R_xlen_t block_size = (size - offset < how_many_indices_in_resampling_block)
+                            ? size - offset : how_many_indices_in_resampling_block;
+        for (R_xlen_t j = 0; j < block_size; j++) {
+            indices[j] = resampled_index(&resampling, i + offset + j);
+        }
+
+        if (type == REALSXP) {
+            double *target = ((double *) buf) + offset;
+            if (data != NULL) {
+                for (R_xlen_t j = 0; j < block_size; j++) target[j] = ((const double *) data)[indices[j]];
+            } else {
+                for (R_xlen_t j = 0; j < block_size; j++) target[j] = REAL_ELT(source, indices[j]);
+            }
+        } else {
+            int *target = ((int *) buf) + offset;
+            if (data != NULL) {
+                for (R_xlen_t j = 0; j < block_size; j++) target[j] = ((const int *) data)[indices[j]];
+            } else if (type == INTSXP) {
+                for (R_xlen_t j = 0; j < block_size; j++) target[j] = INTEGER_ELT(source, indices[j]);
+            } else {
+                for (R_xlen_t j = 0; j < block_size; j++) target[j] = LOGICAL_ELT(source, indices[j]);
+            }
+        }
+    }
+    return size;
+}
+
+SEXP resampling_duplicate(SEXP x, Rboolean deep) {
+
+    if (get_debug_mode()) {
+        Rprintf("resampling_duplicate\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           deep: %i\n", deep);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    SEXP/*REALSXP*/ descriptor = get_descriptor(x);
+    SEXP resampling = PROTECT(resampling_new(get_source(x), REAL_ELT(descriptor, 0), REAL_ELT(descriptor, 1),
+                                             (R_xlen_t) REAL_ELT(descriptor, 2), REAL_ELT(descriptor, 3) != 0));
+    if (is_materialized(x)) {
+        SEXP data = get_materialized_data(x);
+        set_materialized_data(resampling, deep ? duplicate(data) : data);
+    }
+    UNPROTECT(1);
+    return resampling;
+}
+
+static Rboolean resampling_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+
+    Rprintf("resampling_altrep %s\n", type2char(TYPEOF(x)));
+
+    inspect_subtree(R_altrep_data1(x), pre, deep, pvec);
+    inspect_subtree(R_altrep_data2(x), pre, deep, pvec);
+
+    return FALSE;
+}
+
+static R_xlen_t resampling_length(SEXP x) {
+    if (get_debug_mode()) {
+        Rprintf("resampling_length\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return (R_xlen_t) REAL_ELT(get_descriptor(x), 2);
+}
+
+static void *resampling_dataptr(SEXP x, Rboolean writeable) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("resampling_dataptr\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("      writeable: %i\n", writeable);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (!is_materialized(x)) {
+        SEXP data = PROTECT(allocVector(TYPEOF(x), XLENGTH(x)));
+        copy_resampled_region(x, 0, XLENGTH(data), DATAPTR(data));
+        set_materialized_data(x, data);
+        UNPROTECT(1);
+    }
+
+    SEXP data = get_materialized_data(x);
+    return writeable ? DATAPTR(data) : (void *) DATAPTR_RO(data);
+}
+
+static const void *resampling_dataptr_or_null(SEXP x) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("resampling_dataptr_or_null\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return is_materialized(x) ? DATAPTR_RO(get_materialized_data(x)) : NULL;
+}
+
+static int resampling_integer_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("resampling_integer_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return INTEGER_ELT(get_materialized_data(x), i);
+    }
+
+    resampling_t resampling;
+    get_resampling(x, &resampling);
+    return INTEGER_ELT(get_source(x), resampled_index(&resampling, i));
+}
+
+static double resampling_numeric_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("resampling_numeric_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return REAL_ELT(get_materialized_data(x), i);
+    }
+
+    resampling_t resampling;
+    get_resampling(x, &resampling);
+    return REAL_ELT(get_source(x), resampled_index(&resampling, i));
+}
+
+static int resampling_logical_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("resampling_logical_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return LOGICAL_ELT(get_materialized_data(x), i);
+    }
+
+    resampling_t resampling;
+    get_resampling(x, &resampling);
+    return LOGICAL_ELT(get_source(x), resampled_index(&resampling, i));
+}
+
+static R_xlen_t resampling_get_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    if (is_materialized(x)) {
+        return copy_region(get_materialized_data(x), i, n, buf);
+    }
+    return copy_resampled_region(x, i, n, buf);
+}
+
+static R_xlen_t resampling_integer_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("resampling_integer_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    return resampling_get_region(x, i, n, buf);
+}
+
+static R_xlen_t resampling_numeric_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("resampling_numeric_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    return resampling_get_region(x, i, n, buf);
+}
+
+static R_xlen_t resampling_logical_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("resampling_logical_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    return resampling_get_region(x, i, n, buf);
+}
+
+static SEXP resampling_sum(SEXP x, Rboolean narm) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("resampling_sum\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    double   sum = 0;
+    R_xlen_t NAs = 0;
+    sum_of_region(x, 0, XLENGTH(x), &sum, &NAs);
+    return sum_as_sexp(TYPEOF(x), sum, NAs, narm);
+}
+
+static SEXP resampling_min(SEXP x, Rboolean narm) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("resampling_min\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    extremes_t extremes;
+    extremes_init(&extremes);
+    extremes_of_region(x, 0, XLENGTH(x), &extremes);
+    return extremes_min_as_sexp(TYPEOF(x), &extremes, XLENGTH(x), narm);
+}
+
+static SEXP resampling_max(SEXP x, Rboolean narm) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("resampling_max\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    extremes_t extremes;
+    extremes_init(&extremes);
+    extremes_of_region(x, 0, XLENGTH(x), &extremes);
+    return extremes_max_as_sexp(TYPEOF(x), &extremes, XLENGTH(x), narm);
+}
+
+static SEXP resampling_coerce(SEXP x, int type) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("resampling_coerce\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           type: %s\n", type2char(type));
+    }
+
+    return coerce_view(x, type);
+}
+
+static void init_common_resampling(R_altrep_class_t cls) {
+    R_set_altrep_Duplicate_method(cls, resampling_duplicate);
+    R_set_altrep_Inspect_method(cls, resampling_inspect);
+    R_set_altrep_Length_method(cls, resampling_length);
+    R_set_altrep_Coerce_method(cls, resampling_coerce);
+
+    R_set_altvec_Dataptr_method(cls, resampling_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, resampling_dataptr_or_null);
+}
+
+void init_resampling_integer_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altinteger_class("resampling_integer_altrep", "viewports", dll);
+    resampling_integer_altrep = cls;
+
+    init_common_resampling(cls);
+
+    R_set_altinteger_Elt_method(cls, resampling_integer_element);
+    R_set_altinteger_Get_region_method(cls, resampling_integer_get_region);
+    R_set_altinteger_Sum_method(cls, resampling_sum);
+    R_set_altinteger_Min_method(cls, resampling_min);
+    R_set_altinteger_Max_method(cls, resampling_max);
+}
+
+void init_resampling_numeric_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altreal_class("resampling_numeric_altrep", "viewports", dll);
+    resampling_numeric_altrep = cls;
+
+    init_common_resampling(cls);
+
+    R_set_altreal_Elt_method(cls, resampling_numeric_element);
+    R_set_altreal_Get_region_method(cls, resampling_numeric_get_region);
+    R_set_altreal_Sum_method(cls, resampling_sum);
+    R_set_altreal_Min_method(cls, resampling_min);
+    R_set_altreal_Max_method(cls, resampling_max);
+}
+
+void init_resampling_logical_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altlogical_class("resampling_logical_altrep", "viewports", dll);
+    resampling_logical_altrep = cls;
+
+    init_common_resampling(cls);
+
+    R_set_altlogical_Elt_method(cls, resampling_logical_element);
+    R_set_altlogical_Get_region_method(cls, resampling_logical_get_region);
+    R_set_altlogical_Sum_method(cls, resampling_sum);
+}
+
+void init_resampling_altrep_class(DllInfo * dll) {
+    init_resampling_integer_altrep_class(dll);
+    init_resampling_numeric_altrep_class(dll);
+    init_resampling_logical_altrep_class(dll);
+}
+
+// Seeds are converted to 64-bit integers for the key, so they must be finite
+// and smaller than 2^63 in magnitude.
+static double extract_seed_or_die(SEXP/*INTSXP|REALSXP*/ seed) {
+    if (TYPEOF(seed) == INTSXP) {
+        int value = INTEGER_ELT(seed, 0);
+        if (value == NA_INTEGER) {
+            Rf_error("Seed must not be NA");
+        }
+        return (double) value;
+    }
+
+    double value = REAL_ELT(seed, 0);
+    if (!R_FINITE(value)) {
+        Rf_error("Seed must be finite");
+    }
+    if (fabs(value) >= 9223372036854775808.0 /* 2^63 */) {
+        Rf_error("Seed must be smaller than 2^63 in magnitude");
+    }
+    return value;
+}
+
+SEXP/*VECSXP*/ create_bootstrap_views(SEXP/*A*/ source, SEXP/*INTSXP|REALSXP*/ replicates, SEXP/*INTSXP|REALSXP*/ seed) {
+    make_sure(TYPEOF(source) == INTSXP || TYPEOF(source) == REALSXP || TYPEOF(source) == LGLSXP, Rf_error,
+              "type of source must be one of INTSXP, REALSXP, or LGLSXP");
+    make_sure(TYPEOF(replicates) == INTSXP || TYPEOF(replicates) == REALSXP, Rf_error,
+              "type of replicates must be either INTSXP or REALSXP");
+    make_sure(TYPEOF(seed) == INTSXP || TYPEOF(seed) == REALSXP, Rf_error,
+              "type of seed must be either INTSXP or REALSXP");
+
+    R_xlen_t how_many_replicates = get_first_element_as_whole_length(replicates, "replicates");
+    double   seed_value          = extract_seed_or_die(seed);
+
+    if (how_many_replicates < 0) {
+        Rf_error("Cannot draw a negative number of bootstrap replicates");
+    }
+    if (XLENGTH(source) == 0) {
+        Rf_error("Cannot draw bootstrap replicates from an empty vector");
+    }
+
+    if (get_debug_mode()) {
+        Rprintf("create bootstrap views\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("     replicates: %li\n", how_many_replicates);
+        Rprintf("           seed: %f\n", seed_value);
+    }
+
+    SEXP/*VECSXP*/ views = PROTECT(allocVector(VECSXP, how_many_replicates));
+    for (R_xlen_t replicate = 0; replicate < how_many_replicates; replicate++) {
+        SET_VECTOR_ELT(views, replicate, resampling_new(source, seed_value, (double) replicate, XLENGTH(source), true));
+    }
+    UNPROTECT(1);
+    return views;
+}
+
+// Samples drawn without replacement and kept in the order of the source are a
+// mosaic: the first size positions of the permutation are set in its bitmap.
+SEXP/*A*/ create_sample_view(SEXP/*A*/ source, SEXP/*INTSXP|REALSXP*/ size, SEXP/*INTSXP|REALSXP*/ seed,
+                             SEXP/*LGLSXP*/ replace, SEXP/*LGLSXP*/ sorted) {
+    make_sure(TYPEOF(source) == INTSXP || TYPEOF(source) == REALSXP || TYPEOF(source) == LGLSXP, Rf_error,
+              "type of source must be one of INTSXP, REALSXP, or LGLSXP");
+    make_sure(TYPEOF(size) == INTSXP || TYPEOF(size) == REALSXP, Rf_error,
+              "type of size must be either INTSXP or REALSXP");
+    make_sure(TYPEOF(seed) == INTSXP || TYPEOF(seed) == REALSXP, Rf_error,
+              "type of seed must be either INTSXP or REALSXP");
+
+    R_xlen_t sample_size = get_first_element_as_whole_length(size, "size");
+    double   seed_value  = extract_seed_or_die(seed);
+    bool     replace_value = __extract_boolean_or_die(replace);
+    bool     sorted_value  = __extract_boolean_or_die(sorted);
+
+    if (sample_size < 0) {
+        Rf_error("Cannot take a sample of negative size");
+    }
+    if (!replace_value && sample_size > XLENGTH(source)) {
+        Rf_error("Cannot take a sample larger than the vector without replacement");
+    }
+    if (replace_value && sorted_value) {
+        Rf_error("Only samples without replacement can be sorted");
+    }
+    if (sample_size > 0 && XLENGTH(source) == 0) {
+        Rf_error("Cannot draw a sample from an empty vector");
+    }
+
+    if (get_debug_mode()) {
+        Rprintf("create sample view\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("           size: %li\n", sample_size);
+        Rprintf("           seed: %f\n", seed_value);
+        Rprintf("        replace: %i\n", replace_value);
+        Rprintf("         sorted: %i\n", sorted_value);
+    }
+
+    SEXP resampling = PROTECT(resampling_new(source, seed_value, 0, sample_size, replace_value));
+    if (!sorted_value) {
+        UNPROTECT(1);
+        return resampling;
+    }
+
+    resampling_t permutation;
+    get_resampling(resampling, &permutation);
+
+    SEXP/*INTSXP*/ bitmap = PROTECT(bitmap_new(XLENGTH(source)));
+    for (R_xlen_t i = 0; i < sample_size; i++) {
+        bitmap_set(bitmap, permuted_index(&permutation, i));
+    }
+
+    SEXP mosaic = mosaic_new(source, bitmap, sample_size);
+    UNPROTECT(2);
+    return mosaic;
+}
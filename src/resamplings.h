@@ -0,0 +1,12 @@
+#pragma once
+
+#include "Rinternals.h"
+#include <stdbool.h>
+
+SEXP/*A*/ resampling_new(SEXP/*A*/ source, double seed, double stream, R_xlen_t size, bool replace);
+
+SEXP/*VECSXP*/ create_bootstrap_views(SEXP/*A*/ source, SEXP/*INTSXP|REALSXP*/ replicates, SEXP/*INTSXP|REALSXP*/ seed);
+SEXP/*A*/      create_sample_view    (SEXP/*A*/ source, SEXP/*INTSXP|REALSXP*/ size, SEXP/*INTSXP|REALSXP*/ seed,
+                                      SEXP/*LGLSXP*/ replace, SEXP/*LGLSXP*/ sorted);
+
+void init_resampling_altrep_class(DllInfo *dll);
@@ -0,0 +1,670 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Altrep.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "common.h"
+
+#include "reversals.h"
+#include "coercions.h"
+#include "slices.h"
+#include "mosaics.h"
+#include "prisms.h"
+#include "aggregates.h"
+#include "zonemaps.h"
+#include "prefixsums.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// A reversal is a window of the source read back to front: its i-th element
+// is the (start + size - 1 - i)-th element of the source. Like a slice, it is
+// described by the start and size of the window only.
+static R_altrep_class_t reversal_integer_altrep;
+static R_altrep_class_t reversal_numeric_altrep;
+static R_altrep_class_t reversal_logical_altrep;
+static R_altrep_class_t reversal_complex_altrep;
+static R_altrep_class_t reversal_raw_altrep;
+
+static inline R_altrep_class_t class_from_sexp_type(SEXPTYPE type) { // @suppress("No return")
+    switch (type) {
+        case INTSXP:  return reversal_integer_altrep;
+        case REALSXP: return reversal_numeric_altrep;
+        case LGLSXP:  return reversal_logical_altrep;
+        case CPLXSXP: return reversal_complex_altrep;
+        case RAWSXP:  return reversal_raw_altrep;
+        default:      Rf_error("No ALTREP reversal class for vector of type %s", type2str(type));
+    }
+}
+
+SEXP reversal_new(SEXP source, R_xlen_t start, R_xlen_t size) {
+    make_sure(TYPEOF(source) == INTSXP || TYPEOF(source) == REALSXP || TYPEOF(source) == CPLXSXP
+           || TYPEOF(source) == LGLSXP || TYPEOF(source) == RAWSXP, Rf_error,
+              "type of source should be one of INTSXP, REALSXP, CPLXSXP, LGLSXP, or RAWSXP");
+    make_sure(start >= 0 && start + size <= XLENGTH(source), Rf_error, "viewport must fit within the length of source");
+
+    if (get_debug_mode()) {
+        Rprintf("reversal_new\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("          start: %li\n", start);
+        Rprintf("           size: %li\n", size);
+    }
+
+    SEXP/*INTSXP*/ window = PROTECT(write_start_and_size(start, size));
+
+    SEXP/*LISTSXP*/ data = PROTECT(allocSExp(LISTSXP));
+    SETCAR (data, source);     // The original vector
+    SET_TAG(data, R_NilValue); // Starts as R_NilValue, becomes a vector if it the reversal is written to
+    SETCDR (data, R_NilValue); // Nothing here
+
+    SEXP reversal = R_new_altrep(class_from_sexp_type(TYPEOF(source)), window, data);
+    UNPROTECT(2);
+    return reversal;
+}
+
+static inline SEXP/*INTSXP*/ get_window(SEXP x) {
+    return R_altrep_data1(x);
+}
+
+static inline SEXP get_source(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return CAR(cell);
+}
+
+static inline SEXP get_materialized_data(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell);
+}
+
+static inline void set_materialized_data(SEXP x, SEXP data) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    SET_TAG(cell, data);
+}
+
+static inline bool is_materialized(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell) != R_NilValue;
+}
+
+// Position in the source of the i-th element of the reversal.
+static inline R_xlen_t project_reversed_index(SEXP x, R_xlen_t i) {
+    R_xlen_t start = 0;
+    R_xlen_t size  = 0;
+    read_start_and_size(get_window(x), &start, &size);
+    return start + size - 1 - i;
+}
+
+// Buffers are reversed in place by swapping vectors from both ends, each
+// reversed with a shuffle, and finishing the middle one element at a time.
+static void reverse_doubles(double *values, R_xlen_t size) {
+    R_xlen_t left  = 0;
+    R_xlen_t right = size;
+#ifdef __SSE2__
+    for (; right - left >= 4; left += 2, right -= 2) {
+        __m128d front = _mm_loadu_pd(values + left);
+        __m128d back  = _mm_loadu_pd(values + right - 2);
+        _mm_storeu_pd(values + left,      _mm_shuffle_pd(back,  back,  1));
+        _mm_storeu_pd(values + right - 2, _mm_shuffle_pd(front, front, 1));
+    }
+#endif
+    for (; right - left >= 2; left++, right--) {
+        double swap       = values[left];
+        values[left]      = values[right - 1];
+        values[right - 1] = swap;
+    }
+}
+
+static void reverse_integers(int *values, R_xlen_t size) {
+    R_xlen_t left  = 0;
+    R_xlen_t right = size;
+#ifdef __SSE2__
+    for (; right - left >= 8; left += 4, right -= 4) {
+        __m128i front = _mm_loadu_si128((const __m128i *) (values + left));
+        __m128i back  = _mm_loadu_si128((const __m128i *) (values + right - 4));
+        _mm_storeu_si128((__m128i *) (values + left),      _mm_shuffle_epi32(back,  _MM_SHUFFLE(0, 1, 2, 3)));
+        _mm_storeu_si128((__m128i *) (values + right - 4), _mm_shuffle_epi32(front, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+#endif
+    for (; right - left >= 2; left++, right--) {
+        int swap          = values[left];
+        values[left]      = values[right - 1];
+        values[right - 1] = swap;
+    }
+}
+
+#ifdef __SSE2__
+// SSE2 cannot shuffle bytes, so the bytes are reversed by reversing the
+// 32-bit lanes, then the 16-bit halves of each lane, then the bytes of each half.
+static inline __m128i reverse_bytes_in_vector(__m128i vector) {
+    vector = _mm_shuffle_epi32(vector, _MM_SHUFFLE(0, 1, 2, 3));
+    vector = _mm_shufflelo_epi16(vector, _MM_SHUFFLE(2, 3, 0, 1));
+    vector = _mm_shufflehi_epi16(vector, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_or_si128(_mm_slli_epi16(vector, 8), _mm_srli_epi16(vector, 8));
+}
+#endif
+
+static void reverse_bytes(Rbyte *values, R_xlen_t size) {
+    R_xlen_t left  = 0;
+    R_xlen_t right = size;
+#ifdef __SSE2__
+    for (; right - left >= 32; left += 16, right -= 16) {
+        __m128i front = _mm_loadu_si128((const __m128i *) (values + left));
+        __m128i back  = _mm_loadu_si128((const __m128i *) (values + right - 16));
+        _mm_storeu_si128((__m128i *) (values + left),       reverse_bytes_in_vector(back));
+        _mm_storeu_si128((__m128i *) (values + right - 16), reverse_bytes_in_vector(front));
+    }
+#endif
+    for (; right - left >= 2; left++, right--) {
+        Rbyte swap        = values[left];
+        values[left]      = values[right - 1];
+        values[right - 1] = swap;
+    }
+}
+
+static void reverse_complexes(Rcomplex *values, R_xlen_t size) {
+    for (R_xlen_t left = 0, right = size; right - left >= 2; left++, right--) {
+        Rcomplex swap     = values[left];
+        values[left]      = values[right - 1];
+        values[right - 1] = swap;
+    }
+}
+
+static void reverse_buffer(SEXPTYPE type, void *buffer, R_xlen_t size) {
+    switch (type) {
+        case INTSXP:
+        case LGLSXP:  reverse_integers ((int *)      buffer, size); break;
+        case REALSXP: reverse_doubles  ((double *)   buffer, size); break;
+        case CPLXSXP: reverse_complexes((Rcomplex *) buffer, size); break;
+        case RAWSXP:  reverse_bytes    ((Rbyte *)    buffer, size); break;
+        default:      Rf_error("Unsupported vector type: %d\n", type);
+    }
+}
+
+// Elements i to i + n of the reversal are a contiguous region of the source,
+// read front to back and then reversed in the buffer.
+static R_xlen_t copy_reversed_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    SEXP     source = get_source(x);
+    R_xlen_t start  = 0;
+    R_xlen_t size   = 0;
+    read_start_and_size(get_window(x), &start, &size);
+
+    R_xlen_t count = (size - i < n) ? size - i : n;
+    if (count <= 0) {
+        return 0;
+    }
+
+    copy_region(source, start + size - i - count, count, buf);
+    reverse_buffer(TYPEOF(source), buf, count);
+    return count;
+}
+
+SEXP reversal_duplicate(SEXP x, Rboolean deep) {
+
+    if (get_debug_mode()) {
+        Rprintf("reversal_duplicate\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           deep: %i\n", deep);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    R_xlen_t start = 0;
+    R_xlen_t size  = 0;
+    read_start_and_size(get_window(x), &start, &size);
+
+    SEXP reversal = PROTECT(reversal_new(get_source(x), start, size));
+    if (is_materialized(x)) {
+        SEXP data = get_materialized_data(x);
+        set_materialized_data(reversal, deep ? duplicate(data) : data);
+    }
+    UNPROTECT(1);
+    return reversal;
+}
+
+static Rboolean reversal_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+
+    Rprintf("reversal_altrep %s\n", type2char(TYPEOF(x)));
+
+    inspect_subtree(R_altrep_data1(x), pre, deep, pvec);
+    inspect_subtree(R_altrep_data2(x), pre, deep, pvec);
+
+    return FALSE;
+}
+
+static R_xlen_t reversal_length(SEXP x) {
+    if (get_debug_mode()) {
+        Rprintf("reversal_length\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    R_xlen_t start = 0;
+    R_xlen_t size  = 0;
+    read_start_and_size(get_window(x), &start, &size);
+
+    return size;
+}
+
+static SEXP materialize(SEXP x) {
+    R_xlen_t size = reversal_length(x);
+    SEXP data = PROTECT(allocVector(TYPEOF(get_source(x)), size));
+    copy_reversed_region(x, 0, size, DATAPTR(data));
+    UNPROTECT(1);
+    return data;
+}
+
+static void *reversal_dataptr(SEXP x, Rboolean writeable) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reversal_dataptr\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("      writeable: %i\n", writeable);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (!is_materialized(x)) {
+        set_materialized_data(x, materialize(x));
+    }
+
+    SEXP data = get_materialized_data(x);
+    return writeable ? DATAPTR(data) : (void *) DATAPTR_RO(data);
+}
+
+static const void *reversal_dataptr_or_null(SEXP x) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reversal_dataptr_or_null\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return is_materialized(x) ? DATAPTR_RO(get_materialized_data(x)) : NULL;
+}
+
+static int reversal_integer_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reversal_integer_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return INTEGER_ELT(get_materialized_data(x), i);
+    }
+
+    return INTEGER_ELT(get_source(x), project_reversed_index(x, i));
+}
+
+static double reversal_numeric_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reversal_numeric_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return REAL_ELT(get_materialized_data(x), i);
+    }
+
+    return REAL_ELT(get_source(x), project_reversed_index(x, i));
+}
+
+static int reversal_logical_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reversal_logical_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return LOGICAL_ELT(get_materialized_data(x), i);
+    }
+
+    return LOGICAL_ELT(get_source(x), project_reversed_index(x, i));
+}
+
+static Rcomplex reversal_complex_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reversal_complex_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return COMPLEX_ELT(get_materialized_data(x), i);
+    }
+
+    return COMPLEX_ELT(get_source(x), project_reversed_index(x, i));
+}
+
+static Rbyte reversal_raw_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reversal_raw_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return RAW_ELT(get_materialized_data(x), i);
+    }
+
+    return RAW_ELT(get_source(x), project_reversed_index(x, i));
+}
+
+static R_xlen_t reversal_get_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reversal_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return copy_region(get_materialized_data(x), i, n, buf);
+    }
+
+    return copy_reversed_region(x, i, n, buf);
+}
+
+static R_xlen_t reversal_integer_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    return reversal_get_region(x, i, n, buf);
+}
+
+static R_xlen_t reversal_numeric_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    return reversal_get_region(x, i, n, buf);
+}
+
+static R_xlen_t reversal_logical_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    return reversal_get_region(x, i, n, buf);
+}
+
+static R_xlen_t reversal_complex_get_region(SEXP x, R_xlen_t i, R_xlen_t n, Rcomplex *buf) {
+    return reversal_get_region(x, i, n, buf);
+}
+
+static R_xlen_t reversal_raw_get_region(SEXP x, R_xlen_t i, R_xlen_t n, Rbyte *buf) {
+    return reversal_get_region(x, i, n, buf);
+}
+
+// The order of elements does not matter to Min, Max, and Sum, so these are
+// answered from the window of the source just like for a slice.
+static void reversal_extremes(SEXP x, extremes_t *extremes) {
+    SEXP source = get_source(x);
+
+    R_xlen_t start = 0;
+    R_xlen_t size  = 0;
+    read_start_and_size(get_window(x), &start, &size);
+
+    extremes_init(extremes);
+    if (!zone_map_extremes(source, start, size, extremes)) {
+        extremes_of_region(source, start, size, extremes);
+    }
+}
+
+static SEXP reversal_min(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reversal_min\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    extremes_t extremes;
+    reversal_extremes(x, &extremes);
+    return extremes_min_as_sexp(TYPEOF(x), &extremes, reversal_length(x), narm);
+}
+
+static SEXP reversal_max(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reversal_max\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    extremes_t extremes;
+    reversal_extremes(x, &extremes);
+    return extremes_max_as_sexp(TYPEOF(x), &extremes, reversal_length(x), narm);
+}
+
+static SEXP reversal_sum(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reversal_sum\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    SEXP source = get_source(x);
+
+    R_xlen_t start = 0;
+    R_xlen_t size  = 0;
+    read_start_and_size(get_window(x), &start, &size);
+
+    double   sum = 0;
+    R_xlen_t NAs = 0;
+    SEXP/*VECSXP*/ prefix_sums = prefix_sums_get(source);
+    if (prefix_sums == R_NilValue || !prefix_sums_of_region(prefix_sums, start, size, &sum, &NAs)) {
+        sum_of_region(source, start, size, &sum, &NAs);
+    }
+
+    return sum_as_sexp(TYPEOF(x), sum, NAs, narm);
+}
+
+// Translates indices into the reversal into 1-based indices into the source.
+// Indices outside the reversal become NA.
+static SEXP/*REALSXP*/ translate_reversed_indices(SEXP x, SEXP/*INTSXP|REALSXP*/ indices) {
+    R_xlen_t start = 0;
+    R_xlen_t size  = 0;
+    read_start_and_size(get_window(x), &start, &size);
+
+    R_xlen_t length = XLENGTH(indices);
+    SEXP/*REALSXP*/ translated = PROTECT(allocVector(REALSXP, length));
+    for (R_xlen_t i = 0; i < length; i++) {
+        double index = (TYPEOF(indices) == INTSXP)
+                     ? (INTEGER_ELT(indices, i) == NA_INTEGER ? NA_REAL : (double) INTEGER_ELT(indices, i))
+                     : REAL_ELT(indices, i);
+        if (ISNAN(index) || index < 1 || index > size) {
+            SET_REAL_ELT(translated, i, NA_REAL);
+        } else {
+            SET_REAL_ELT(translated, i, (double) (start + size - (R_xlen_t) index + 1));
+        }
+    }
+    UNPROTECT(1);
+    return translated;
+}
+
+static SEXP reversal_extract_subset(SEXP x, SEXP indices, SEXP call) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reversal_extract_subset\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("        indices: %p\n", indices);
+        Rprintf("           call: %p\n", call);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    SEXP source = get_source(x);
+
+    // No indices.
+    R_xlen_t size = XLENGTH(indices);
+    if (size == 0) {
+        return allocVector(TYPEOF(source), 0);
+    }
+
+    if (is_materialized(x)) {
+        return copy_data_at_indices(get_materialized_data(x), indices);
+    }
+
+    R_xlen_t window_start = 0;
+    R_xlen_t window_size  = 0;
+    read_start_and_size(get_window(x), &window_start, &window_size);
+
+    if (!are_indices_in_range(indices, 1, window_size)) {
+        SEXP translated_indices = PROTECT(translate_reversed_indices(x, indices));
+        SEXP result = copy_data_at_indices(source, translated_indices);
+        UNPROTECT(1);
+        return result;
+    }
+
+    // Contiguous indices into a reversal are a reversal of a smaller window,
+    // and reverse contiguous indices read the source front to back again.
+    R_xlen_t first = get_first_element_as_length(indices);
+    if (are_indices_contiguous(indices)) {
+        R_xlen_t last = first + size - 1;
+        return reversal_new(source, window_start + window_size - last, size);
+    }
+    if (are_indices_reverse_contiguous(indices)) {
+        return slice_new(source, window_start + window_size - first, size);
+    }
+
+    SEXP translated_indices = PROTECT(translate_reversed_indices(x, indices));
+    SEXP result = are_indices_monotonic(translated_indices)
+                ? create_mosaic(source, translated_indices)
+                : create_prism(source, translated_indices);
+    UNPROTECT(1);
+    return result;
+}
+
+static SEXP reversal_coerce(SEXP x, int type) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("reversal_coerce\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           type: %s\n", type2char(type));
+    }
+
+    return coerce_view(x, type);
+}
+
+static void init_common_reversal(R_altrep_class_t cls) {
+    R_set_altrep_Duplicate_method(cls, reversal_duplicate);
+    R_set_altrep_Inspect_method(cls, reversal_inspect);
+    R_set_altrep_Length_method(cls, reversal_length);
+    R_set_altrep_Coerce_method(cls, reversal_coerce);
+
+    R_set_altvec_Dataptr_method(cls, reversal_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, reversal_dataptr_or_null);
+    R_set_altvec_Extract_subset_method(cls, reversal_extract_subset);
+}
+
+void init_reversal_integer_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altinteger_class("reversal_integer_altrep", "viewports", dll);
+    reversal_integer_altrep = cls;
+
+    init_common_reversal(cls);
+
+    R_set_altinteger_Elt_method(cls, reversal_integer_element);
+    R_set_altinteger_Get_region_method(cls, reversal_integer_get_region);
+    R_set_altinteger_Min_method(cls, reversal_min);
+    R_set_altinteger_Max_method(cls, reversal_max);
+    R_set_altinteger_Sum_method(cls, reversal_sum);
+}
+
+void init_reversal_numeric_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altreal_class("reversal_numeric_altrep", "viewports", dll);
+    reversal_numeric_altrep = cls;
+
+    init_common_reversal(cls);
+
+    R_set_altreal_Elt_method(cls, reversal_numeric_element);
+    R_set_altreal_Get_region_method(cls, reversal_numeric_get_region);
+    R_set_altreal_Min_method(cls, reversal_min);
+    R_set_altreal_Max_method(cls, reversal_max);
+    R_set_altreal_Sum_method(cls, reversal_sum);
+}
+
+void init_reversal_logical_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altlogical_class("reversal_logical_altrep", "viewports", dll);
+    reversal_logical_altrep = cls;
+
+    init_common_reversal(cls);
+
+    R_set_altlogical_Elt_method(cls, reversal_logical_element);
+    R_set_altlogical_Get_region_method(cls, reversal_logical_get_region);
+    R_set_altlogical_Sum_method(cls, reversal_sum);
+}
+
+void init_reversal_complex_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altcomplex_class("reversal_complex_altrep", "viewports", dll);
+    reversal_complex_altrep = cls;
+
+    init_common_reversal(cls);
+
+    R_set_altcomplex_Elt_method(cls, reversal_complex_element);
+    R_set_altcomplex_Get_region_method(cls, reversal_complex_get_region);
+}
+
+void init_reversal_raw_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altraw_class("reversal_raw_altrep", "viewports", dll);
+    reversal_raw_altrep = cls;
+
+    init_common_reversal(cls);
+
+    R_set_altraw_Elt_method(cls, reversal_raw_element);
+    R_set_altraw_Get_region_method(cls, reversal_raw_get_region);
+}
+
+void init_reversal_altrep_class(DllInfo * dll) {
+    init_reversal_integer_altrep_class(dll);
+    init_reversal_numeric_altrep_class(dll);
+    init_reversal_logical_altrep_class(dll);
+    init_reversal_complex_altrep_class(dll);
+    init_reversal_raw_altrep_class(dll);
+}
+
+SEXP create_reversal(SEXP source) {
+    if (get_debug_mode()) {
+        Rprintf("create reversal\n");
+        Rprintf("           SEXP: %p\n", source);
+    }
+
+    return reversal_new(source, 0, XLENGTH(source));
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "Rinternals.h"
+
+SEXP reversal_new(SEXP source, R_xlen_t start, R_xlen_t size);
+
+SEXP create_reversal(SEXP source);
+
+void init_reversal_altrep_class(DllInfo *dll);
@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Altrep.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "common.h"
+
+#include "rolling.h"
+#include "prefixsums.h"
+#include "slices.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// Rolling aggregates are lazy numeric vectors whose i-th element aggregates
+// the window of the source starting at i. Each element is answered in O(1)
+// from the source's prefix sum index, including windows with NAs, NaNs, or
+// infinities, which the index counts rather than sums.
+static R_altrep_class_t rolling_numeric_altrep;
+
+typedef enum {
+    ROLLING_SUM,
+    ROLLING_MEAN,
+} rolling_aggregate_t;
+
+#define ROLLING_WIDTH     0
+#define ROLLING_AGGREGATE 1
+
+SEXP rolling_new(SEXP/*INTSXP|REALSXP|LGLSXP*/ source, R_xlen_t width, rolling_aggregate_t aggregate) {
+    make_sure(TYPEOF(source) == INTSXP || TYPEOF(source) == REALSXP || TYPEOF(source) == LGLSXP, Rf_error,
+              "type of source should be one of INTSXP, REALSXP, or LGLSXP");
+    make_sure(width > 0 && width <= XLENGTH(source), Rf_error, "window must fit within the length of source");
+
+    if (get_debug_mode()) {
+        Rprintf("rolling_new\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("          width: %li\n", width);
+        Rprintf("      aggregate: %i\n", aggregate);
+    }
+
+    SEXP/*VECSXP*/ prefix_sums = PROTECT(prefix_sums_require(source));
+
+    SEXP/*REALSXP*/ parameters = PROTECT(allocVector(REALSXP, 2));
+    SET_REAL_ELT(parameters, ROLLING_WIDTH,     (double) width);
+    SET_REAL_ELT(parameters, ROLLING_AGGREGATE, (double) aggregate);
+
+    SEXP/*LISTSXP*/ data = PROTECT(allocSExp(LISTSXP));
+    SETCAR (data, source);      // The original vector
+    SET_TAG(data, R_NilValue);  // Starts as R_NilValue, becomes a vector if it the rolling aggregate is written to
+    SETCDR (data, prefix_sums); // The prefix sums of the source
+
+    SEXP rolling = R_new_altrep(rolling_numeric_altrep, parameters, data);
+    UNPROTECT(3);
+    return rolling;
+}
+
+static inline R_xlen_t get_width(SEXP x) {
+    return (R_xlen_t) REAL_ELT(R_altrep_data1(x), ROLLING_WIDTH);
+}
+
+static inline rolling_aggregate_t get_aggregate(SEXP x) {
+    return (rolling_aggregate_t) REAL_ELT(R_altrep_data1(x), ROLLING_AGGREGATE);
+}
+
+static inline SEXP get_source(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return CAR(cell);
+}
+
+static inline SEXP get_prefix_sums(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return CDR(cell);
+}
+
+static inline SEXP get_materialized_data(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell);
+}
+
+static inline void set_materialized_data(SEXP x, SEXP data) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    SET_TAG(cell, data);
+}
+
+static inline bool is_materialized(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell) != R_NilValue;
+}
+
+static R_xlen_t rolling_length(SEXP x) {
+    if (get_debug_mode()) {
+        Rprintf("rolling_length\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return XLENGTH(get_source(x)) - get_width(x) + 1;
+}
+
+static inline double compute_element(SEXP x, R_xlen_t i) {
+    R_xlen_t width = get_width(x);
+    double   sum   = prefix_sums_total_of_region(get_prefix_sums(x), i, width);
+    return (get_aggregate(x) == ROLLING_MEAN) ? sum / (double) width : sum;
+}
+
+SEXP rolling_duplicate(SEXP x, Rboolean deep) {
+
+    if (get_debug_mode()) {
+        Rprintf("rolling_duplicate\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           deep: %i\n", deep);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    SEXP rolling = PROTECT(rolling_new(get_source(x), get_width(x), get_aggregate(x)));
+    if (is_materialized(x)) {
+        SEXP data = get_materialized_data(x);
+        set_materialized_data(rolling, deep ? duplicate(data) : data);
+    }
+    UNPROTECT(1);
+    return rolling;
+}
+
+static Rboolean rolling_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+
+    Rprintf("rolling_altrep %s\n", type2char(TYPEOF(x)));
+
+    inspect_subtree(R_altrep_data1(x), pre, deep, pvec);
+    inspect_subtree(R_altrep_data2(x), pre, deep, pvec);
+
+    return FALSE;
+}
+
+static SEXP/*REALSXP*/ materialize(SEXP x) {
+    R_xlen_t length = rolling_length(x);
+    SEXP/*REALSXP*/ data = PROTECT(allocVector(REALSXP, length));
+    double *values = REAL(data);
+    for (R_xlen_t i = 0; i < length; i++) {
+        values[i] = compute_element(x, i);
+    }
+    UNPROTECT(1);
+    return data;
+}
+
+static void *rolling_dataptr(SEXP x, Rboolean writeable) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("rolling_dataptr\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("      writeable: %i\n", writeable);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (!is_materialized(x)) {
+        set_materialized_data(x, materialize(x));
+    }
+
+    SEXP data = get_materialized_data(x);
+    return writeable ? DATAPTR(data) : (void *) DATAPTR_RO(data);
+}
+
+static const void *rolling_dataptr_or_null(SEXP x) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("rolling_dataptr_or_null\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return is_materialized(x) ? DATAPTR_RO(get_materialized_data(x)) : NULL;
+}
+
+static double rolling_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("rolling_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return REAL_ELT(get_materialized_data(x), i);
+    }
+
+    return compute_element(x, i);
+}
+
+static R_xlen_t rolling_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("rolling_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return REAL_GET_REGION(get_materialized_data(x), i, n, buf);
+    }
+
+    R_xlen_t length = rolling_length(x);
+    R_xlen_t count = (length - i < n) ? length - i : n;
+    for (R_xlen_t k = 0; k < count; k++) {
+        buf[k] = compute_element(x, i + k);
+    }
+    return count;
+}
+
+void init_rolling_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altreal_class("rolling_numeric_altrep", "viewports", dll);
+    rolling_numeric_altrep = cls;
+
+    R_set_altrep_Duplicate_method(cls, rolling_duplicate);
+    R_set_altrep_Inspect_method(cls, rolling_inspect);
+    R_set_altrep_Length_method(cls, rolling_length);
+
+    R_set_altvec_Dataptr_method(cls, rolling_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, rolling_dataptr_or_null);
+
+    R_set_altreal_Elt_method(cls, rolling_element);
+    R_set_altreal_Get_region_method(cls, rolling_get_region);
+}
+
+static SEXP create_rolling(SEXP source, SEXP/*INTSXP|REALSXP*/ width_sexp, rolling_aggregate_t aggregate) {
+    make_sure(TYPEOF(source) == INTSXP || TYPEOF(source) == REALSXP || TYPEOF(source) == LGLSXP, Rf_error,
+              "type of source must be one of INTSXP, REALSXP, or LGLSXP");
+    make_sure(TYPEOF(width_sexp) == INTSXP || TYPEOF(width_sexp) == REALSXP, Rf_error,
+              "type of width must be either INTSXP or REALSXP");
+    make_sure(XLENGTH(width_sexp) > 0, Rf_error, "width cannot be a zero-length vector");
+
+    R_xlen_t width = get_first_element_as_length(width_sexp);
+    if (width < 1 || width > XLENGTH(source)) {
+        Rf_error("Window width must be between 1 and the length of the source");
+    }
+
+    return rolling_new(source, width, aggregate);
+}
+
+SEXP create_rolling_sum(SEXP source, SEXP/*INTSXP|REALSXP*/ width) {
+    return create_rolling(source, width, ROLLING_SUM);
+}
+
+SEXP create_rolling_mean(SEXP source, SEXP/*INTSXP|REALSXP*/ width) {
+    return create_rolling(source, width, ROLLING_MEAN);
+}
+
+void window_iterator_init(window_iterator_t *iterator, SEXP source, R_xlen_t width, R_xlen_t step) {
+    make_sure(width > 0 && width <= XLENGTH(source), Rf_error, "window must fit within the length of source");
+    make_sure(step > 0, Rf_error, "step must be positive");
+
+    iterator->source     = source;
+    iterator->width      = width;
+    iterator->step       = step;
+    iterator->next_start = 0;
+    iterator->slice      = slice_new(source, 0, width);
+    PROTECT_WITH_INDEX(iterator->slice, &iterator->protection);
+}
+
+R_xlen_t window_iterator_count(const window_iterator_t *iterator) {
+    return (XLENGTH(iterator->source) - iterator->width) / iterator->step + 1;
+}
+
+// Moving the slice is only safe if nothing but the iterator (and the call
+// passing it around) holds on to it, so a slice that was retained, or that
+// materialized because it was written to, is left alone and replaced.
+bool window_iterator_next(window_iterator_t *iterator) {
+    R_xlen_t start = iterator->next_start;
+    if (start + iterator->width > XLENGTH(iterator->source)) {
+        return false;
+    }
+
+    if (start > 0) {
+        if (MAYBE_SHARED(iterator->slice) || slice_is_materialized(iterator->slice)) {
+            iterator->slice = slice_new(iterator->source, start, iterator->width);
+            REPROTECT(iterator->slice, iterator->protection);
+        } else {
+            slice_move(iterator->slice, start);
+        }
+    }
+
+    iterator->next_start = start + iterator->step;
+    return true;
+}
+
+SEXP create_window_apply(SEXP source, SEXP/*INTSXP|REALSXP*/ width_sexp, SEXP/*INTSXP|REALSXP*/ step_sexp,
+                         SEXP/*CLOSXP*/ function, SEXP/*ENVSXP*/ environment) {
+    make_sure(TYPEOF(width_sexp) == INTSXP || TYPEOF(width_sexp) == REALSXP, Rf_error,
+              "type of width must be either INTSXP or REALSXP");
+    make_sure(TYPEOF(step_sexp) == INTSXP || TYPEOF(step_sexp) == REALSXP, Rf_error,
+              "type of step must be either INTSXP or REALSXP");
+    make_sure(XLENGTH(width_sexp) > 0, Rf_error, "width cannot be a zero-length vector");
+    make_sure(XLENGTH(step_sexp) > 0, Rf_error, "step cannot be a zero-length vector");
+    make_sure(TYPEOF(environment) == ENVSXP, Rf_error, "environment must be an ENVSXP");
+
+    R_xlen_t width = get_first_element_as_length(width_sexp);
+    R_xlen_t step  = get_first_element_as_length(step_sexp);
+    if (width < 1 || width > XLENGTH(source)) {
+        Rf_error("Window width must be between 1 and the length of the source");
+    }
+    if (step < 1) {
+        Rf_error("Step must be at least 1");
+    }
+
+    if (get_debug_mode()) {
+        Rprintf("create window apply\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("          width: %li\n", width);
+        Rprintf("           step: %li\n", step);
+    }
+
+    window_iterator_t iterator;
+    window_iterator_init(&iterator, source, width, step);
+
+    SEXP/*VECSXP*/ results = PROTECT(allocVector(VECSXP, window_iterator_count(&iterator)));
+    SEXP/*LANGSXP*/ call   = PROTECT(lang2(function, iterator.slice));
+
+    for (R_xlen_t i = 0; window_iterator_next(&iterator); i++) {
+        SETCADR(call, iterator.slice);
+        SET_VECTOR_ELT(results, i, eval(call, environment));
+    }
+
+    UNPROTECT(3);
+    return results;
+}
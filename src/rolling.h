@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Rinternals.h"
+#include <stdbool.h>
+
+// Iterates over windows of the source, presenting each as the same slice
+// object moved in place. The slice is replaced by a fresh one only if the
+// previous window was retained or written to. Initialization protects the
+// slice, so the caller has to unprotect one object when done.
+typedef struct {
+    SEXP          source;
+    SEXP          slice;
+    PROTECT_INDEX protection;
+    R_xlen_t      width;
+    R_xlen_t      step;
+    R_xlen_t      next_start;
+} window_iterator_t;
+
+void     window_iterator_init (window_iterator_t *iterator, SEXP source, R_xlen_t width, R_xlen_t step);
+bool     window_iterator_next (window_iterator_t *iterator);  // false when there are no more windows
+R_xlen_t window_iterator_count(const window_iterator_t *iterator);
+
+SEXP/*REALSXP*/ create_rolling_sum (SEXP source, SEXP/*INTSXP|REALSXP*/ width);
+SEXP/*REALSXP*/ create_rolling_mean(SEXP source, SEXP/*INTSXP|REALSXP*/ width);
+SEXP/*VECSXP*/   create_window_apply(SEXP source, SEXP/*INTSXP|REALSXP*/ width, SEXP/*INTSXP|REALSXP*/ step,
+                                    SEXP/*CLOSXP*/ function, SEXP/*ENVSXP*/ environment);
+
+void init_rolling_altrep_class(DllInfo *dll);
@@ -0,0 +1,505 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Altrep.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "common.h"
+
+#include "scalings.h"
+#include "slices.h"
+#include "mosaics.h"
+#include "prisms.h"
+#include "aggregates.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// A scaling shows integers, or unsigned bytes, kept in a compact source as the
+// doubles they encode: its i-th element is source[i] * scale + offset. Stored
+// values equal to the NA value, as well as integer NAs, are NA.
+//
+// Aggregates are computed over the stored values and only then scaled, and
+// subsets of a scaling are scalings of subsets of the source, so the source
+// is never widened to doubles unless the scaling is written to.
+static R_altrep_class_t scaling_numeric_altrep;
+
+#define how_many_elements_in_scaling_block 1024
+
+typedef struct {
+    double scale;
+    double offset;
+    double NA_value; // NA_REAL if only integer NAs are NA
+} encoding_t;
+
+SEXP scaling_new(SEXP/*INTSXP|RAWSXP*/ source, double scale, double offset, double NA_value) {
+    make_sure(TYPEOF(source) == INTSXP || TYPEOF(source) == RAWSXP, Rf_error,
+              "type of source must be either INTSXP or RAWSXP");
+
+    if (get_debug_mode()) {
+        Rprintf("scaling_new\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("          scale: %f\n", scale);
+        Rprintf("         offset: %f\n", offset);
+        Rprintf("       NA value: %f\n", NA_value);
+    }
+
+    SEXP/*REALSXP*/ encoding = PROTECT(allocVector(REALSXP, 3));
+    SET_REAL_ELT(encoding, 0, scale);
+    SET_REAL_ELT(encoding, 1, offset);
+    SET_REAL_ELT(encoding, 2, NA_value);
+
+    SEXP/*LISTSXP*/ data = PROTECT(allocSExp(LISTSXP));
+    SETCAR (data, source);     // The original vector
+    SET_TAG(data, R_NilValue); // Starts as R_NilValue, becomes a vector if it the scaling is written to
+    SETCDR (data, R_NilValue); // Nothing here
+
+    SEXP scaling = R_new_altrep(scaling_numeric_altrep, encoding, data);
+    UNPROTECT(2);
+    return scaling;
+}
+
+static inline void get_encoding(SEXP x, encoding_t *encoding) {
+    SEXP/*REALSXP*/ descriptor = R_altrep_data1(x);
+    encoding->scale    = REAL_ELT(descriptor, 0);
+    encoding->offset   = REAL_ELT(descriptor, 1);
+    encoding->NA_value = REAL_ELT(descriptor, 2);
+}
+
+static inline SEXP get_source(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return CAR(cell);
+}
+
+static inline SEXP get_materialized_data(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell);
+}
+
+static inline void set_materialized_data(SEXP x, SEXP data) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    SET_TAG(cell, data);
+}
+
+static inline bool is_materialized(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell) != R_NilValue;
+}
+
+// The NA value as a stored integer, or NA_INTEGER if there is none, which
+// integer sources treat as NA anyway and bytes can never be equal to.
+static inline int stored_NA(const encoding_t *encoding) {
+    return ISNAN(encoding->NA_value) ? NA_INTEGER : (int) encoding->NA_value;
+}
+
+// Reads stored values from the source as integers.
+static void copy_stored_region(SEXP source, R_xlen_t start, R_xlen_t size, int *buffer) {
+    if (TYPEOF(source) == INTSXP) {
+        copy_region(source, start, size, buffer);
+        return;
+    }
+
+    Rbyte bytes[how_many_elements_in_scaling_block];
+    for (R_xlen_t offset = 0; offset < size; offset += how_many_elements_in_scaling_block) {
+        R_xlen_t block_size = size - offset < how_many_elements_in_scaling_block
+                            ? size - offset : how_many_elements_in_scaling_block;
+        copy_region(source, start + offset, block_size, bytes);
+        for (R_xlen_t i = 0; i < block_size; i++) {
+            buffer[offset + i] = bytes[i];
+        }
+    }
+}
+
+static inline double decode(const encoding_t *encoding, int NA, int stored) {
+    return (stored == NA || stored == NA_INTEGER) ? NA_REAL : stored * encoding->scale + encoding->offset;
+}
+
+// Blocks of four stored values without NAs are decoded two at a time.
+static void decode_integers(const encoding_t *encoding, const int *stored, double *decoded, R_xlen_t size) {
+    int      NA = stored_NA(encoding);
+    R_xlen_t i  = 0;
+
+#ifdef __SSE2__
+    const __m128i NAs          = _mm_set1_epi32(NA_INTEGER);
+    const __m128i NA_values    = _mm_set1_epi32(NA);
+    const __m128d scale        = _mm_set1_pd(encoding->scale);
+    const __m128d offset       = _mm_set1_pd(encoding->offset);
+    for (; i + 4 <= size; i += 4) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (stored + i));
+        __m128i NA_mask = _mm_or_si128(_mm_cmpeq_epi32(block, NAs), _mm_cmpeq_epi32(block, NA_values));
+        if (_mm_movemask_epi8(NA_mask) == 0) {
+            __m128d low  = _mm_cvtepi32_pd(block);
+            __m128d high = _mm_cvtepi32_pd(_mm_shuffle_epi32(block, _MM_SHUFFLE(1, 0, 3, 2)));
+            _mm_storeu_pd(decoded + i,     _mm_add_pd(_mm_mul_pd(low,  scale), offset));
+            _mm_storeu_pd(decoded + i + 2, _mm_add_pd(_mm_mul_pd(high, scale), offset));
+            continue;
+        }
+        for (R_xlen_t j = i; j < i + 4; j++) {
+            decoded[j] = decode(encoding, NA, stored[j]);
+        }
+    }
+#endif
+
+    for (; i < size; i++) {
+        decoded[i] = decode(encoding, NA, stored[i]);
+    }
+}
+
+static R_xlen_t copy_scaled_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    SEXP     source = get_source(x);
+    R_xlen_t length = XLENGTH(source);
+    R_xlen_t size   = (length - i < n) ? length - i : n;
+
+    encoding_t encoding;
+    get_encoding(x, &encoding);
+
+    const int *data = (TYPEOF(source) == INTSXP) ? (const int *) DATAPTR_OR_NULL(source) : NULL;
+    if (data != NULL) {
+        decode_integers(&encoding, data + i, buf, size);
+        return size;
+    }
+
+    int block[how_many_elements_in_scaling_block];
+    for (R_xlen_t offset = 0; offset < size; offset += how_many_elements_in_scaling_block) {
+        R_xlen_t block_size = size - offset < how_many_elements_in_scaling_block
+                            ? size - offset : how_many_elements_in_scaling_block;
+        copy_stored_region(source, i + offset, block_size, block);
+        decode_integers(&encoding, block, buf + offset, block_size);
+    }
+    return size;
+}
+
+// Sum, smallest and largest of the stored values, not counting NAs.
+static void stored_aggregates(SEXP x, long double *sum, extremes_t *extremes) {
+    SEXP     source = get_source(x);
+    R_xlen_t length = XLENGTH(source);
+
+    encoding_t encoding;
+    get_encoding(x, &encoding);
+    int NA = stored_NA(&encoding);
+
+    int block[how_many_elements_in_scaling_block];
+    for (R_xlen_t offset = 0; offset < length; offset += how_many_elements_in_scaling_block) {
+        R_xlen_t block_size = length - offset < how_many_elements_in_scaling_block
+                            ? length - offset : how_many_elements_in_scaling_block;
+        copy_stored_region(source, offset, block_size, block);
+        for (R_xlen_t i = 0; i < block_size; i++) {
+            if (block[i] == NA || block[i] == NA_INTEGER) {
+                extremes->NAs++;
+                continue;
+            }
+            *sum += block[i];
+            if (block[i] < extremes->min) extremes->min = block[i];
+            if (block[i] > extremes->max) extremes->max = block[i];
+        }
+    }
+}
+
+SEXP scaling_duplicate(SEXP x, Rboolean deep) {
+
+    if (get_debug_mode()) {
+        Rprintf("scaling_duplicate\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           deep: %i\n", deep);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    encoding_t encoding;
+    get_encoding(x, &encoding);
+
+    SEXP scaling = PROTECT(scaling_new(get_source(x), encoding.scale, encoding.offset, encoding.NA_value));
+    if (is_materialized(x)) {
+        SEXP data = get_materialized_data(x);
+        set_materialized_data(scaling, deep ? duplicate(data) : data);
+    }
+    UNPROTECT(1);
+    return scaling;
+}
+
+static Rboolean scaling_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+
+    Rprintf("scaling_altrep %s\n", type2char(TYPEOF(x)));
+
+    inspect_subtree(R_altrep_data1(x), pre, deep, pvec);
+    inspect_subtree(R_altrep_data2(x), pre, deep, pvec);
+
+    return FALSE;
+}
+
+static R_xlen_t scaling_length(SEXP x) {
+    if (get_debug_mode()) {
+        Rprintf("scaling_length\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return XLENGTH(get_source(x));
+}
+
+static SEXP materialize(SEXP x) {
+    SEXP data = PROTECT(allocVector(REALSXP, XLENGTH(get_source(x))));
+    copy_scaled_region(x, 0, XLENGTH(data), REAL(data));
+    UNPROTECT(1);
+    return data;
+}
+
+static void *scaling_dataptr(SEXP x, Rboolean writeable) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("scaling_dataptr\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("      writeable: %i\n", writeable);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (!is_materialized(x)) {
+        set_materialized_data(x, materialize(x));
+    }
+
+    SEXP data = get_materialized_data(x);
+    return writeable ? DATAPTR(data) : (void *) DATAPTR_RO(data);
+}
+
+static const void *scaling_dataptr_or_null(SEXP x) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("scaling_dataptr_or_null\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return is_materialized(x) ? DATAPTR_RO(get_materialized_data(x)) : NULL;
+}
+
+static double scaling_numeric_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("scaling_numeric_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return REAL_ELT(get_materialized_data(x), i);
+    }
+
+    encoding_t encoding;
+    get_encoding(x, &encoding);
+
+    SEXP source = get_source(x);
+    int  stored = (TYPEOF(source) == INTSXP) ? INTEGER_ELT(source, i) : RAW_ELT(source, i);
+    return decode(&encoding, stored_NA(&encoding), stored);
+}
+
+static R_xlen_t scaling_numeric_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("scaling_numeric_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return copy_region(get_materialized_data(x), i, n, buf);
+    }
+
+    return copy_scaled_region(x, i, n, buf);
+}
+
+static SEXP scaling_sum(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("scaling_sum\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    encoding_t encoding;
+    get_encoding(x, &encoding);
+
+    long double sum = 0;
+    extremes_t  extremes;
+    extremes_init(&extremes);
+    stored_aggregates(x, &sum, &extremes);
+
+    R_xlen_t values = XLENGTH(get_source(x)) - extremes.NAs;
+    return sum_as_sexp(REALSXP, (double) (sum * encoding.scale + values * (long double) encoding.offset),
+                       extremes.NAs, narm);
+}
+
+// A negative scale turns the smallest stored value into the largest element.
+static void scale_extremes(SEXP x, extremes_t *scaled) {
+    encoding_t encoding;
+    get_encoding(x, &encoding);
+
+    long double sum = 0;
+    extremes_t  stored;
+    extremes_init(&stored);
+    stored_aggregates(x, &sum, &stored);
+
+    double low  = stored.min * encoding.scale + encoding.offset;
+    double high = stored.max * encoding.scale + encoding.offset;
+
+    scaled->NAs = stored.NAs;
+    scaled->min = encoding.scale < 0 ? high : low;
+    scaled->max = encoding.scale < 0 ? low  : high;
+}
+
+static SEXP scaling_min(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("scaling_min\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    extremes_t extremes;
+    scale_extremes(x, &extremes);
+    return extremes_min_as_sexp(REALSXP, &extremes, XLENGTH(get_source(x)), narm);
+}
+
+static SEXP scaling_max(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("scaling_max\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    extremes_t extremes;
+    scale_extremes(x, &extremes);
+    return extremes_max_as_sexp(REALSXP, &extremes, XLENGTH(get_source(x)), narm);
+}
+
+// Subsets of a scaling are scalings of the same subsets of the source.
+static SEXP scaling_extract_subset(SEXP x, SEXP indices, SEXP call) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("scaling_extract_subset\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("        indices: %p\n", indices);
+        Rprintf("           call: %p\n", call);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    R_xlen_t size = XLENGTH(indices);
+    if (size == 0) {
+        return allocVector(REALSXP, 0);
+    }
+
+    if (is_materialized(x)) {
+        return copy_data_at_indices(get_materialized_data(x), indices);
+    }
+
+    SEXP source = get_source(x);
+
+    // Out of range indices produce NAs, which R takes care of.
+    if (!are_indices_in_range(indices, 1, XLENGTH(source))) {
+        return NULL;
+    }
+
+    SEXP subset = R_NilValue;
+    if (are_indices_contiguous(indices)) {
+        subset = slice_new(source, get_first_element_as_length(indices) - 1, size);
+    } else if (are_indices_monotonic(indices)) {
+        subset = create_mosaic(source, indices);
+    } else {
+        subset = create_prism(source, indices);
+    }
+    PROTECT(subset);
+
+    encoding_t encoding;
+    get_encoding(x, &encoding);
+
+    SEXP scaling = scaling_new(subset, encoding.scale, encoding.offset, encoding.NA_value);
+    UNPROTECT(1);
+    return scaling;
+}
+
+void init_scaling_numeric_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altreal_class("scaling_numeric_altrep", "viewports", dll);
+    scaling_numeric_altrep = cls;
+
+    R_set_altrep_Duplicate_method(cls, scaling_duplicate);
+    R_set_altrep_Inspect_method(cls, scaling_inspect);
+    R_set_altrep_Length_method(cls, scaling_length);
+
+    R_set_altvec_Dataptr_method(cls, scaling_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, scaling_dataptr_or_null);
+    R_set_altvec_Extract_subset_method(cls, scaling_extract_subset);
+
+    R_set_altreal_Elt_method(cls, scaling_numeric_element);
+    R_set_altreal_Get_region_method(cls, scaling_numeric_get_region);
+    R_set_altreal_Min_method(cls, scaling_min);
+    R_set_altreal_Max_method(cls, scaling_max);
+    R_set_altreal_Sum_method(cls, scaling_sum);
+}
+
+void init_scaling_altrep_class(DllInfo * dll) {
+    init_scaling_numeric_altrep_class(dll);
+}
+
+SEXP create_scaling(SEXP/*INTSXP|RAWSXP*/ source, SEXP/*REALSXP*/ scale_sexp, SEXP/*REALSXP*/ offset_sexp,
+                    SEXP/*REALSXP*/ NA_value_sexp) {
+    make_sure(TYPEOF(source) == INTSXP || TYPEOF(source) == RAWSXP, Rf_error,
+              "type of source must be either INTSXP or RAWSXP");
+    make_sure(TYPEOF(scale_sexp) == REALSXP && XLENGTH(scale_sexp) > 0, Rf_error, "scale must be a double");
+    make_sure(TYPEOF(offset_sexp) == REALSXP && XLENGTH(offset_sexp) > 0, Rf_error, "offset must be a double");
+    make_sure(TYPEOF(NA_value_sexp) == REALSXP && XLENGTH(NA_value_sexp) > 0, Rf_error, "NA value must be a double");
+
+    double scale    = REAL_ELT(scale_sexp, 0);
+    double offset   = REAL_ELT(offset_sexp, 0);
+    double NA_value = REAL_ELT(NA_value_sexp, 0);
+
+    if (!R_FINITE(scale) || !R_FINITE(offset)) {
+        Rf_error("Scale and offset must be finite");
+    }
+    if (!ISNAN(NA_value) && (NA_value < -INT_MAX || NA_value > INT_MAX || NA_value != floor(NA_value))) {
+        Rf_error("NA value must be a whole number that fits into an integer");
+    }
+
+    if (get_debug_mode()) {
+        Rprintf("create scaling\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("          scale: %f\n", scale);
+        Rprintf("         offset: %f\n", offset);
+        Rprintf("       NA value: %f\n", NA_value);
+    }
+
+    return scaling_new(source, scale, offset, NA_value);
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "Rinternals.h"
+
+SEXP scaling_new(SEXP/*INTSXP|RAWSXP*/ source, double scale, double offset, double NA_value);
+
+SEXP create_scaling(SEXP/*INTSXP|RAWSXP*/ source, SEXP/*REALSXP*/ scale, SEXP/*REALSXP*/ offset,
+                    SEXP/*REALSXP*/ NA_value);
+
+void init_scaling_altrep_class(DllInfo *dll);
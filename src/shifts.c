@@ -0,0 +1,497 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Altrep.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "common.h"
+
+#include "shifts.h"
+#include "coercions.h"
+#include "aggregates.h"
+#include "prefixsums.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// A shift is a lagged (positive offset) or led (negative offset) view of the
+// source: its i-th element is the source's (i - offset)-th element, or NA if
+// that falls outside the source. The shift has the same length as the source.
+static R_altrep_class_t shift_integer_altrep;
+static R_altrep_class_t shift_numeric_altrep;
+static R_altrep_class_t shift_logical_altrep;
+static R_altrep_class_t shift_complex_altrep;
+static R_altrep_class_t shift_raw_altrep;
+
+static inline R_altrep_class_t class_from_sexp_type(SEXPTYPE type) { // @suppress("No return")
+    switch (type) {
+        case INTSXP:  return shift_integer_altrep;
+        case REALSXP: return shift_numeric_altrep;
+        case LGLSXP:  return shift_logical_altrep;
+        case CPLXSXP: return shift_complex_altrep;
+        case RAWSXP:  return shift_raw_altrep;
+        default:      Rf_error("No ALTREP shift class for vector of type %s", type2str(type));
+    }
+}
+
+SEXP shift_new(SEXP source, R_xlen_t offset) {
+    make_sure(TYPEOF(source) == INTSXP || TYPEOF(source) == REALSXP || TYPEOF(source) == CPLXSXP
+           || TYPEOF(source) == LGLSXP || TYPEOF(source) == RAWSXP, Rf_error,
+              "type of source should be one of INTSXP, REALSXP, CPLXSXP, LGLSXP, or RAWSXP");
+
+    if (get_debug_mode()) {
+        Rprintf("shift_new\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("         offset: %li\n", offset);
+    }
+
+    SEXP/*REALSXP*/ offset_sexp = PROTECT(ScalarReal((double) offset));
+
+    SEXP/*LISTSXP*/ data = PROTECT(allocSExp(LISTSXP));
+    SETCAR (data, source);     // The original vector
+    SET_TAG(data, R_NilValue); // Starts as R_NilValue, becomes a vector if it the shift is written to
+    SETCDR (data, R_NilValue); // Nothing here
+
+    SEXP shift = R_new_altrep(class_from_sexp_type(TYPEOF(source)), offset_sexp, data);
+    UNPROTECT(2);
+    return shift;
+}
+
+static inline R_xlen_t get_offset(SEXP x) {
+    return (R_xlen_t) REAL_ELT(R_altrep_data1(x), 0);
+}
+
+static inline SEXP get_source(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return CAR(cell);
+}
+
+static inline SEXP get_materialized_data(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell);
+}
+
+static inline void set_materialized_data(SEXP x, SEXP data) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    SET_TAG(cell, data);
+}
+
+static inline bool is_materialized(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell) != R_NilValue;
+}
+
+// The part of the shift that shows elements of the source, as a range of
+// positions in the shift. Everything before and after it is NA.
+static void visible_range(SEXP x, R_xlen_t *first, R_xlen_t *last) {
+    R_xlen_t length = XLENGTH(get_source(x));
+    R_xlen_t offset = get_offset(x);
+
+    *first = offset > 0 ? offset : 0;
+    *last  = offset < 0 ? length + offset : length;
+    if (*first > length) *first = length;
+    if (*last  < *first) *last  = *first;
+}
+
+static inline bool index_within_bounds(SEXP x, R_xlen_t index) {
+    R_xlen_t first = 0;
+    R_xlen_t last  = 0;
+    visible_range(x, &first, &last);
+    return index >= first && index < last;
+}
+
+SEXP shift_duplicate(SEXP x, Rboolean deep) {
+
+    if (get_debug_mode()) {
+        Rprintf("shift_duplicate\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           deep: %i\n", deep);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    SEXP shift = PROTECT(shift_new(get_source(x), get_offset(x)));
+    if (is_materialized(x)) {
+        SEXP data = get_materialized_data(x);
+        set_materialized_data(shift, deep ? duplicate(data) : data);
+    }
+    UNPROTECT(1);
+    return shift;
+}
+
+static Rboolean shift_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+
+    Rprintf("shift_altrep %s\n", type2char(TYPEOF(x)));
+
+    inspect_subtree(R_altrep_data1(x), pre, deep, pvec);
+    inspect_subtree(R_altrep_data2(x), pre, deep, pvec);
+
+    return FALSE;
+}
+
+static R_xlen_t shift_length(SEXP x) {
+    if (get_debug_mode()) {
+        Rprintf("shift_length\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return XLENGTH(get_source(x));
+}
+
+// Copies a region of the shift into the buffer: NAs before and after the
+// visible range and a single region read from the source in between.
+static R_xlen_t copy_shifted_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    SEXP     source = get_source(x);
+    R_xlen_t length = XLENGTH(source);
+    R_xlen_t offset = get_offset(x);
+    R_xlen_t size   = (length - i < n) ? length - i : n;
+
+    R_xlen_t first = 0;
+    R_xlen_t last  = 0;
+    visible_range(x, &first, &last);
+
+    R_xlen_t copy_start = (first > i)        ? first : i;
+    R_xlen_t copy_end   = (last  < i + size) ? last  : i + size;
+
+    if (copy_end <= copy_start) {
+        fill_with_NA(TYPEOF(source), buf, 0, size);
+        return size;
+    }
+
+    fill_with_NA(TYPEOF(source), buf, 0, copy_start - i);
+    copy_region(source, copy_start - offset, copy_end - copy_start,
+                (char *) buf + (copy_start - i) * __get_element_size(TYPEOF(source)));
+    fill_with_NA(TYPEOF(source), buf, copy_end - i, i + size - copy_end);
+    return size;
+}
+
+static SEXP materialize(SEXP x) {
+    SEXP source = get_source(x);
+    SEXP data = PROTECT(allocVector(TYPEOF(source), XLENGTH(source)));
+    copy_shifted_region(x, 0, XLENGTH(source), DATAPTR(data));
+    UNPROTECT(1);
+    return data;
+}
+
+static void *shift_dataptr(SEXP x, Rboolean writeable) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("shift_dataptr\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("      writeable: %i\n", writeable);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (!is_materialized(x)) {
+        set_materialized_data(x, materialize(x));
+    }
+
+    SEXP data = get_materialized_data(x);
+    return writeable ? DATAPTR(data) : (void *) DATAPTR_RO(data);
+}
+
+static const void *shift_dataptr_or_null(SEXP x) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("shift_dataptr_or_null\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return is_materialized(x) ? DATAPTR_RO(get_materialized_data(x)) : NULL;
+}
+
+static int shift_integer_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("shift_integer_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return INTEGER_ELT(get_materialized_data(x), i);
+    }
+
+    if (!index_within_bounds(x, i)) {
+        return NA_INTEGER;
+    }
+
+    return INTEGER_ELT(get_source(x), i - get_offset(x));
+}
+
+static double shift_numeric_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("shift_numeric_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return REAL_ELT(get_materialized_data(x), i);
+    }
+
+    if (!index_within_bounds(x, i)) {
+        return NA_REAL;
+    }
+
+    return REAL_ELT(get_source(x), i - get_offset(x));
+}
+
+static int shift_logical_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("shift_logical_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return LOGICAL_ELT(get_materialized_data(x), i);
+    }
+
+    if (!index_within_bounds(x, i)) {
+        return NA_LOGICAL;
+    }
+
+    return LOGICAL_ELT(get_source(x), i - get_offset(x));
+}
+
+static Rcomplex shift_complex_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("shift_complex_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return COMPLEX_ELT(get_materialized_data(x), i);
+    }
+
+    if (!index_within_bounds(x, i)) {
+        Rcomplex NA_CPLX = { NA_REAL, NA_REAL };
+        return NA_CPLX;
+    }
+
+    return COMPLEX_ELT(get_source(x), i - get_offset(x));
+}
+
+static Rbyte shift_raw_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("shift_raw_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return RAW_ELT(get_materialized_data(x), i);
+    }
+
+    if (!index_within_bounds(x, i)) {
+        return 0;
+    }
+
+    return RAW_ELT(get_source(x), i - get_offset(x));
+}
+
+static R_xlen_t shift_get_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("shift_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return copy_region(get_materialized_data(x), i, n, buf);
+    }
+
+    return copy_shifted_region(x, i, n, buf);
+}
+
+static R_xlen_t shift_integer_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    return shift_get_region(x, i, n, buf);
+}
+
+static R_xlen_t shift_numeric_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    return shift_get_region(x, i, n, buf);
+}
+
+static R_xlen_t shift_logical_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    return shift_get_region(x, i, n, buf);
+}
+
+static R_xlen_t shift_complex_get_region(SEXP x, R_xlen_t i, R_xlen_t n, Rcomplex *buf) {
+    return shift_get_region(x, i, n, buf);
+}
+
+static R_xlen_t shift_raw_get_region(SEXP x, R_xlen_t i, R_xlen_t n, Rbyte *buf) {
+    return shift_get_region(x, i, n, buf);
+}
+
+// The sum of a shift is the sum of its visible range, plus as many NAs as
+// there are padding elements.
+static SEXP shift_sum(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("shift_sum\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    SEXP     source = get_source(x);
+    R_xlen_t offset = get_offset(x);
+
+    R_xlen_t first = 0;
+    R_xlen_t last  = 0;
+    visible_range(x, &first, &last);
+
+    R_xlen_t padding = XLENGTH(source) - (last - first);
+    R_xlen_t start   = first - offset;
+    R_xlen_t size    = last - first;
+
+    double   sum = 0;
+    R_xlen_t NAs = 0;
+    SEXP/*VECSXP*/ prefix_sums = prefix_sums_get(source);
+    if (prefix_sums == R_NilValue || !prefix_sums_of_region(prefix_sums, start, size, &sum, &NAs)) {
+        sum_of_region(source, start, size, &sum, &NAs);
+    }
+
+    return sum_as_sexp(TYPEOF(x), sum, NAs + padding, narm);
+}
+
+static SEXP shift_coerce(SEXP x, int type) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("shift_coerce\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           type: %s\n", type2char(type));
+    }
+
+    return coerce_view(x, type);
+}
+
+static void init_common_shift(R_altrep_class_t cls) {
+    R_set_altrep_Duplicate_method(cls, shift_duplicate);
+    R_set_altrep_Inspect_method(cls, shift_inspect);
+    R_set_altrep_Length_method(cls, shift_length);
+    R_set_altrep_Coerce_method(cls, shift_coerce);
+
+    R_set_altvec_Dataptr_method(cls, shift_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, shift_dataptr_or_null);
+}
+
+void init_shift_integer_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altinteger_class("shift_integer_altrep", "viewports", dll);
+    shift_integer_altrep = cls;
+
+    init_common_shift(cls);
+
+    R_set_altinteger_Elt_method(cls, shift_integer_element);
+    R_set_altinteger_Get_region_method(cls, shift_integer_get_region);
+    R_set_altinteger_Sum_method(cls, shift_sum);
+}
+
+void init_shift_numeric_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altreal_class("shift_numeric_altrep", "viewports", dll);
+    shift_numeric_altrep = cls;
+
+    init_common_shift(cls);
+
+    R_set_altreal_Elt_method(cls, shift_numeric_element);
+    R_set_altreal_Get_region_method(cls, shift_numeric_get_region);
+    R_set_altreal_Sum_method(cls, shift_sum);
+}
+
+void init_shift_logical_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altlogical_class("shift_logical_altrep", "viewports", dll);
+    shift_logical_altrep = cls;
+
+    init_common_shift(cls);
+
+    R_set_altlogical_Elt_method(cls, shift_logical_element);
+    R_set_altlogical_Get_region_method(cls, shift_logical_get_region);
+    R_set_altlogical_Sum_method(cls, shift_sum);
+}
+
+void init_shift_complex_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altcomplex_class("shift_complex_altrep", "viewports", dll);
+    shift_complex_altrep = cls;
+
+    init_common_shift(cls);
+
+    R_set_altcomplex_Elt_method(cls, shift_complex_element);
+    R_set_altcomplex_Get_region_method(cls, shift_complex_get_region);
+}
+
+void init_shift_raw_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altraw_class("shift_raw_altrep", "viewports", dll);
+    shift_raw_altrep = cls;
+
+    init_common_shift(cls);
+
+    R_set_altraw_Elt_method(cls, shift_raw_element);
+    R_set_altraw_Get_region_method(cls, shift_raw_get_region);
+}
+
+void init_shift_altrep_class(DllInfo * dll) {
+    init_shift_integer_altrep_class(dll);
+    init_shift_numeric_altrep_class(dll);
+    init_shift_logical_altrep_class(dll);
+    init_shift_complex_altrep_class(dll);
+    init_shift_raw_altrep_class(dll);
+}
+
+SEXP create_shift(SEXP source, SEXP/*INTSXP|REALSXP*/ offset_sexp) {
+    make_sure(TYPEOF(offset_sexp) == INTSXP || TYPEOF(offset_sexp) == REALSXP, Rf_error,
+              "type of offset must be either INTSXP or REALSXP");
+    make_sure(XLENGTH(offset_sexp) > 0, Rf_error, "offset cannot be a zero-length vector");
+
+    double offset = (TYPEOF(offset_sexp) == INTSXP)
+                  ? (INTEGER_ELT(offset_sexp, 0) == NA_INTEGER ? NA_REAL : (double) INTEGER_ELT(offset_sexp, 0))
+                  : REAL_ELT(offset_sexp, 0);
+    if (ISNAN(offset)) {
+        Rf_error("Offset cannot be NA");
+    }
+
+    // Shifting by more than the length shows nothing of the source either way.
+    double length = (double) XLENGTH(source);
+    if (offset >  length) offset =  length;
+    if (offset < -length) offset = -length;
+
+    if (get_debug_mode()) {
+        Rprintf("create shift\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("         offset: %li\n", (R_xlen_t) offset);
+    }
+
+    return shift_new(source, (R_xlen_t) offset);
+}
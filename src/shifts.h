@@ -0,0 +1,9 @@
+#pragma once
+
+#include "Rinternals.h"
+
+SEXP shift_new(SEXP source, R_xlen_t offset);
+
+SEXP create_shift(SEXP source, SEXP/*INTSXP|REALSXP*/ offset);
+
+void init_shift_altrep_class(DllInfo *dll);
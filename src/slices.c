@@ -11,9 +11,15 @@
 #include "helpers.h"
 
 #include "slices.h"
+#include "coercions.h"
 #include "common.h"
 #include "mosaics.h"
 #include "prisms.h"
+#include "aggregates.h"
+#include "zonemaps.h"
+#include "prefixsums.h"
+#include "reversals.h"
+#include "bits.h"
 
 #define MAKE_SURE
 #include "make_sure.h"
@@ -61,6 +67,23 @@ void read_start_and_size(SEXP/*INTSXP*/ window, R_xlen_t *start, R_xlen_t *size)
     *size = size_converter.length;
 }
 
+SEXP/*INTSXP*/ write_start_and_size(R_xlen_t start, R_xlen_t size) {
+    SEXP/*INTSXP*/ window = allocVector(INTSXP, 2 * how_many_ints_in_R_xlen_t);
+
+    converter_t start_converter = { .length = start };
+    converter_t size_converter  = { .length = size  };
+
+    for (size_t i = 0; i < how_many_ints_in_R_xlen_t; i++) {
+        SET_INTEGER_ELT(window, i, start_converter.integers[i]);
+    }
+
+    for (size_t i = 0; i < how_many_ints_in_R_xlen_t; i++) {
+        SET_INTEGER_ELT(window, how_many_ints_in_R_xlen_t + i, size_converter.integers[i]);
+    }
+
+    return window;
+}
+
 SEXP slice_new(SEXP source, R_xlen_t start, R_xlen_t size) {
     make_sure(TYPEOF(source) == INTSXP || TYPEOF(source) == REALSXP || TYPEOF(source) == CPLXSXP
            || TYPEOF(source) == LGLSXP || TYPEOF(source) == VECSXP  || TYPEOF(source) == STRSXP
@@ -77,25 +100,16 @@ SEXP slice_new(SEXP source, R_xlen_t start, R_xlen_t size) {
         Rprintf("           size: %li\n", size);
     }
 
-    SEXP/*INTSXP*/ window = allocVector(INTSXP, 2 * how_many_ints_in_R_xlen_t);
-
-    converter_t start_converter = { .length = start };
-    converter_t size_converter  = { .length = size  };
-
-    for (size_t i = 0; i < how_many_ints_in_R_xlen_t; i++) {
-        SET_INTEGER_ELT(window, i, start_converter.integers[i]);
-    }
-
-    for (size_t i = 0; i < how_many_ints_in_R_xlen_t; i++) {
-        SET_INTEGER_ELT(window, how_many_ints_in_R_xlen_t + i, size_converter.integers[i]);
-    }
+    SEXP/*INTSXP*/ window = PROTECT(write_start_and_size(start, size));
 
-    SEXP/*LISTSXP*/ data = allocSExp(LISTSXP);
+    SEXP/*LISTSXP*/ data = PROTECT(allocSExp(LISTSXP));
     SETCAR (data, source);     // The original vector
     SET_TAG(data, R_NilValue); // Starts as R_NilValue, becomes a vector if it the slice is written to
     SETCDR (data, R_NilValue); // Nothing here
 
-    return R_new_altrep(class_from_sexp_type(TYPEOF(source)), window, data);
+    SEXP slice = R_new_altrep(class_from_sexp_type(TYPEOF(source)), window, data);
+    UNPROTECT(2);
+    return slice;
 }
 
 static inline SEXP/*INTSXP*/ get_window(SEXP x) {
@@ -122,6 +136,46 @@ static inline bool is_materialized(SEXP x) {
     return TAG(cell) != R_NilValue;
 }
 
+bool slice_is_materialized(SEXP x) {
+    return is_materialized(x);
+}
+
+// Finds out whether x is a slice still reading from its source, and if so,
+// which region of the source it reads.
+bool slice_window(SEXP x, SEXP *source, R_xlen_t *start, R_xlen_t *size) {
+    SEXPTYPE type = TYPEOF(x);
+    if (type != INTSXP && type != REALSXP && type != LGLSXP && type != CPLXSXP && type != RAWSXP) {
+        return false;
+    }
+    if (!ALTREP(x) || !R_altrep_inherits(x, class_from_sexp_type(type)) || is_materialized(x)) {
+        return false;
+    }
+    *source = get_source(x);
+    read_start_and_size(get_window(x), start, size);
+    return true;
+}
+
+// Moves the window of the slice to a new start, keeping its size. This
+// changes the slice in place, so it is only meant for slices that are not
+// visible to anything else, like the one reused by window iterators.
+void slice_move(SEXP x, R_xlen_t start) {
+    make_sure(!is_materialized(x), Rf_error, "cannot move a materialized slice");
+
+    SEXP/*INTSXP*/ window = get_window(x);
+
+    R_xlen_t old_start = 0;
+    R_xlen_t size      = 0;
+    read_start_and_size(window, &old_start, &size);
+    make_sure(start >= 0 && start + size <= XLENGTH(get_source(x)), Rf_error,
+              "viewport must fit within the length of source");
+
+    converter_t start_converter = { .length = start };
+    int *integers = INTEGER(window);
+    for (size_t i = 0; i < how_many_ints_in_R_xlen_t; i++) {
+        integers[i] = start_converter.integers[i];
+    }
+}
+
 SEXP slice_duplicate(SEXP x, Rboolean deep) {
 
     if (get_debug_mode()) {
@@ -589,6 +643,99 @@ static R_xlen_t slice_logical_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *bu
     return LOGICAL_GET_REGION(source, projected_index, n, buf);
 }
 
+static void slice_extremes(SEXP x, extremes_t *extremes) {
+    SEXP/*INTSXP*/ window = get_window(x);
+    SEXP           source = get_source(x);
+
+    R_xlen_t start = 0;
+    R_xlen_t size  = 0;
+    read_start_and_size(window, &start, &size);
+
+    extremes_init(extremes);
+    if (!zone_map_extremes(source, start, size, extremes)) {
+        extremes_of_region(source, start, size, extremes);
+    }
+}
+
+static SEXP slice_min(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("slice_min\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    extremes_t extremes;
+    slice_extremes(x, &extremes);
+    return extremes_min_as_sexp(TYPEOF(x), &extremes, slice_length(x), narm);
+}
+
+static SEXP slice_max(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("slice_max\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    extremes_t extremes;
+    slice_extremes(x, &extremes);
+    return extremes_max_as_sexp(TYPEOF(x), &extremes, slice_length(x), narm);
+}
+
+static SEXP slice_sum(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("slice_sum\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    SEXP/*INTSXP*/ window = get_window(x);
+    SEXP           source = get_source(x);
+
+    R_xlen_t start = 0;
+    R_xlen_t size  = 0;
+    read_start_and_size(window, &start, &size);
+
+    double   sum = 0;
+    R_xlen_t NAs = 0;
+
+    // Slices of bit vectors count their TRUE elements a word at a time.
+    if (bits_sum_of_region(source, start, size, &sum, &NAs)) {
+        return sum_as_sexp(TYPEOF(x), sum, NAs, narm);
+    }
+
+    SEXP/*VECSXP*/ prefix_sums = prefix_sums_get(source);
+    if (prefix_sums == R_NilValue) {
+        return NULL;
+    }
+
+    if (!prefix_sums_of_region(prefix_sums, start, size, &sum, &NAs)) {
+        return NULL;
+    }
+
+    return sum_as_sexp(TYPEOF(x), sum, NAs, narm);
+}
+
 SEXP translate_indices(SEXP original, R_xlen_t offset, R_xlen_t size) {
 	make_sure(TYPEOF(original) == INTSXP || TYPEOF(original) == REALSXP, Rf_error,
 			  "type of original must be either INTSXP or REALSXP");
@@ -660,6 +807,13 @@ static SEXP slice_extract_subset(SEXP x, SEXP indices, SEXP call) {
     	return copy_data_at_indices(source, translated_indices);
     }
 
+    // Descending contiguous indices, e.g. length(x):1.
+    if (size > 1 && TYPEOF(source) != VECSXP && TYPEOF(source) != STRSXP
+                 && are_indices_reverse_contiguous(indices)) {
+        R_xlen_t last = get_first_element_as_length(indices) - size;
+        return reversal_new(source, project_index(window, last), size);
+    }
+
     if (!are_indices_contiguous(indices)) {
     	SEXP translated_indices = translate_indices(indices, window_start, window_size);
         if (are_indices_monotonic(indices)) {
@@ -681,10 +835,23 @@ static SEXP slice_extract_subset(SEXP x, SEXP indices, SEXP call) {
 // R_set_altstring_Elt_method
 // string_elt(SEXP x, R_xlen_t i)
 
+static SEXP slice_coerce(SEXP x, int type) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("slice_coerce\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           type: %s\n", type2char(type));
+    }
+
+    return coerce_view(x, type);
+}
+
 void init_common(R_altrep_class_t cls) {
     R_set_altrep_Duplicate_method(cls, slice_duplicate);
     R_set_altrep_Inspect_method(cls, slice_inspect);
     R_set_altrep_Length_method(cls, slice_length);
+    R_set_altrep_Coerce_method(cls, slice_coerce);
 
     R_set_altvec_Dataptr_method(cls, slice_dataptr);
     R_set_altvec_Dataptr_or_null_method(cls, slice_dataptr_or_null);
@@ -700,6 +867,9 @@ void init_slice_integer_altrep_class(DllInfo * dll) {
 
     R_set_altinteger_Elt_method(cls, slice_integer_element);
     R_set_altinteger_Get_region_method(cls, slice_integer_get_region);
+    R_set_altinteger_Min_method(cls, slice_min);
+    R_set_altinteger_Max_method(cls, slice_max);
+    R_set_altinteger_Sum_method(cls, slice_sum);
 }
 
 void init_slice_logical_altrep_class(DllInfo * dll) {
@@ -710,6 +880,7 @@ void init_slice_logical_altrep_class(DllInfo * dll) {
 
     R_set_altlogical_Elt_method(cls, slice_logical_element);
     R_set_altlogical_Get_region_method(cls, slice_logical_get_region);
+    R_set_altlogical_Sum_method(cls, slice_sum);
 }
 
 void init_slice_numeric_altrep_class(DllInfo * dll) {
@@ -720,6 +891,9 @@ void init_slice_numeric_altrep_class(DllInfo * dll) {
 
     R_set_altreal_Elt_method(cls, slice_numeric_element);
     R_set_altreal_Get_region_method(cls, slice_numeric_get_region);
+    R_set_altreal_Min_method(cls, slice_min);
+    R_set_altreal_Max_method(cls, slice_max);
+    R_set_altreal_Sum_method(cls, slice_sum);
 }
 
 void init_slice_complex_altrep_class(DllInfo * dll) {
@@ -1,7 +1,17 @@
 #pragma once
 
 #include "Rinternals.h"
+#include <stdbool.h>
 
 SEXP/*NILSXP*/ create_slice(SEXP, SEXP/*INTSXP|REALSXP*/ start, SEXP/*INTSXP|REALSXP*/ size);
+SEXP           slice_new(SEXP source, R_xlen_t start, R_xlen_t size);
+bool           slice_is_materialized(SEXP slice);
+bool           slice_window(SEXP x, SEXP *source, R_xlen_t *start, R_xlen_t *size);
+void           slice_move(SEXP slice, R_xlen_t start); // Only for slices nothing else holds on to
+
+// Windows describe a contiguous region of a source by its start and size.
+SEXP/*INTSXP*/ write_start_and_size(R_xlen_t start, R_xlen_t size);
+void           read_start_and_size (SEXP/*INTSXP*/ window, R_xlen_t *start, R_xlen_t *size);
+R_xlen_t       project_index       (SEXP/*INTSXP*/ window, R_xlen_t index);
 
 void init_slice_altrep_class(DllInfo *dll);
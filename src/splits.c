@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+
+#include "debug.h"
+#include "helpers.h"
+
+#include "splits.h"
+#include "slices.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// Keys are scanned in blocks, each block producing a word with one bit per
+// element, set if the key changes value at that element. The loops producing
+// the words are branch-free so that the compiler can vectorize them, and the
+// words are mostly zero for long runs, so boundaries are found by ctz.
+#define how_many_keys_in_block 64
+
+static inline uint64_t integer_key_changes(const int *keys, R_xlen_t from, int count) {
+    uint64_t changes = 0;
+    for (int j = 0; j < count; j++) {
+        changes |= ((uint64_t) (keys[from + j] != keys[from + j - 1])) << j;
+    }
+    return changes;
+}
+
+static inline uint64_t numeric_key_changes(const double *keys, R_xlen_t from, int count) {
+    uint64_t changes = 0;
+    for (int j = 0; j < count; j++) {
+        double current  = keys[from + j];
+        double previous = keys[from + j - 1];
+        // NaN never compares equal to anything, so all NA keys are lumped into one run.
+        int both_NaN = (current != current) & (previous != previous);
+        changes |= ((uint64_t) ((current != previous) & !both_NaN)) << j;
+    }
+    return changes;
+}
+
+static inline uint64_t string_key_changes(const SEXP *keys, R_xlen_t from, int count) {
+    uint64_t changes = 0;
+    for (int j = 0; j < count; j++) {
+        // CHARSXPs are cached, so pointer equality is string equality.
+        changes |= ((uint64_t) (keys[from + j] != keys[from + j - 1])) << j;
+    }
+    return changes;
+}
+
+static inline uint64_t key_changes(SEXPTYPE type, const void *keys, R_xlen_t from, int count) { // @suppress("No return")
+    switch (type) {
+        case INTSXP:
+        case LGLSXP:  return integer_key_changes((const int *)    keys, from, count);
+        case REALSXP: return numeric_key_changes((const double *) keys, from, count);
+        case STRSXP:  return string_key_changes ((const SEXP *)   keys, from, count);
+        default:      Rf_error("Runs can be detected in integer, numeric, logical, or character keys, but found: %s\n",
+                               type2char(type));
+    }
+}
+
+R_xlen_t count_runs(SEXP/*INTSXP|REALSXP|LGLSXP|STRSXP*/ key) {
+    R_xlen_t size = XLENGTH(key);
+    if (size == 0) {
+        return 0;
+    }
+
+    SEXPTYPE type = TYPEOF(key);
+    const void *keys = DATAPTR_RO(key);
+
+    R_xlen_t runs = 1;
+    for (R_xlen_t from = 1; from < size; from += how_many_keys_in_block) {
+        int count = (size - from) < how_many_keys_in_block ? (int) (size - from) : how_many_keys_in_block;
+        runs += __builtin_popcountll(key_changes(type, keys, from, count));
+    }
+    return runs;
+}
+
+SEXP/*VECSXP*/ split_into_runs(SEXP source, SEXP/*INTSXP|REALSXP|LGLSXP|STRSXP*/ key) {
+    make_sure(XLENGTH(source) == XLENGTH(key), Rf_error, "key must be the same length as source");
+
+    R_xlen_t size = XLENGTH(key);
+    R_xlen_t runs = count_runs(key);
+
+    SEXP/*VECSXP*/ slices = PROTECT(allocVector(VECSXP, runs));
+    if (runs == 0) {
+        UNPROTECT(1);
+        return slices;
+    }
+
+    SEXPTYPE type = TYPEOF(key);
+    const void *keys = DATAPTR_RO(key);
+
+    R_xlen_t run = 0;
+    R_xlen_t run_start = 0;
+    for (R_xlen_t from = 1; from < size; from += how_many_keys_in_block) {
+        int count = (size - from) < how_many_keys_in_block ? (int) (size - from) : how_many_keys_in_block;
+        uint64_t changes = key_changes(type, keys, from, count);
+        while (changes != 0) {
+            R_xlen_t boundary = from + __builtin_ctzll(changes);
+            SET_VECTOR_ELT(slices, run, slice_new(source, run_start, boundary - run_start));
+            run_start = boundary;
+            run++;
+            changes &= changes - 1;
+        }
+    }
+    SET_VECTOR_ELT(slices, run, slice_new(source, run_start, size - run_start));
+    run++;
+
+    make_sure(run == runs, Rf_error, "the number of created slices is different than the number of runs");
+
+    UNPROTECT(1);
+    return slices;
+}
+
+// NAs are expected at the end of a sorted vector, so they compare as greater than any value.
+static inline bool precedes(SEXP/*INTSXP|REALSXP*/ sorted, R_xlen_t index, double value, bool inclusive) {
+    double element;
+    if (TYPEOF(sorted) == INTSXP) {
+        int integer_element = INTEGER_ELT(sorted, index);
+        if (integer_element == NA_INTEGER) {
+            return false;
+        }
+        element = (double) integer_element;
+    } else {
+        element = REAL_ELT(sorted, index);
+        if (ISNAN(element)) {
+            return false;
+        }
+    }
+    return inclusive ? element <= value : element < value;
+}
+
+// Index of the first element for which precedes(...) is false.
+R_xlen_t partition_point(SEXP/*INTSXP|REALSXP*/ sorted, double value, bool inclusive) {
+    R_xlen_t low  = 0;
+    R_xlen_t high = XLENGTH(sorted);
+    while (low < high) {
+        R_xlen_t middle = low + (high - low) / 2;
+        if (precedes(sorted, middle, value, inclusive)) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static inline bool is_known_to_be_unsorted(SEXP/*INTSXP|REALSXP*/ sorted) {
+    int sortedness = (TYPEOF(sorted) == INTSXP) ? INTEGER_IS_SORTED(sorted) : REAL_IS_SORTED(sorted);
+    return sortedness != UNKNOWN_SORTEDNESS
+        && sortedness != SORTED_INCR
+        && sortedness != SORTED_INCR_NALAST;
+}
+
+SEXP/*VECSXP*/ create_split_sorted(SEXP source, SEXP/*INTSXP|REALSXP|LGLSXP|STRSXP*/ key) {
+    SEXPTYPE key_type = TYPEOF(key);
+    make_sure(key_type == INTSXP || key_type == REALSXP || key_type == LGLSXP || key_type == STRSXP, Rf_error,
+              "type of key must be one of INTSXP, REALSXP, LGLSXP, or STRSXP");
+
+    if (XLENGTH(source) != XLENGTH(key)) {
+        Rf_error("Key must be the same length as the vector being split");
+    }
+
+    if (get_debug_mode()) {
+        Rprintf("create split sorted\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("            key: %p\n", key);
+        Rprintf("       key type: %s\n", type2char(key_type));
+    }
+
+    return split_into_runs(source, key);
+}
+
+SEXP create_range_view(SEXP/*INTSXP|REALSXP*/ sorted, SEXP/*INTSXP|REALSXP*/ lower_sexp, SEXP/*INTSXP|REALSXP*/ upper_sexp) {
+    make_sure(TYPEOF(sorted) == INTSXP || TYPEOF(sorted) == REALSXP, Rf_error,
+              "type of sorted must be either INTSXP or REALSXP");
+    make_sure(TYPEOF(lower_sexp) == INTSXP || TYPEOF(lower_sexp) == REALSXP, Rf_error,
+              "type of lower must be either INTSXP or REALSXP");
+    make_sure(TYPEOF(upper_sexp) == INTSXP || TYPEOF(upper_sexp) == REALSXP, Rf_error,
+              "type of upper must be either INTSXP or REALSXP");
+    make_sure(XLENGTH(lower_sexp) > 0, Rf_error, "lower cannot be a zero-length vector");
+    make_sure(XLENGTH(upper_sexp) > 0, Rf_error, "upper cannot be a zero-length vector");
+
+    if (is_known_to_be_unsorted(sorted)) {
+        Rf_error("Range views can only be created over vectors sorted in increasing order");
+    }
+
+    double lower = asReal(lower_sexp);
+    double upper = asReal(upper_sexp);
+    if (ISNAN(lower) || ISNAN(upper)) {
+        Rf_error("The bounds of a range view cannot be NA");
+    }
+
+    R_xlen_t start = partition_point(sorted, lower, false);
+    R_xlen_t end   = partition_point(sorted, upper, true);
+
+    if (get_debug_mode()) {
+        Rprintf("create range view\n");
+        Rprintf("           SEXP: %p\n", sorted);
+        Rprintf("          lower: %f\n", lower);
+        Rprintf("          upper: %f\n", upper);
+        Rprintf("          start: %li\n", start);
+        Rprintf("            end: %li\n", end);
+    }
+
+    if (end <= start) {
+        return allocVector(TYPEOF(sorted), 0);
+    }
+
+    return slice_new(sorted, start, end - start);
+}
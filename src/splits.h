@@ -0,0 +1,6 @@
+#pragma once
+
+#include "Rinternals.h"
+
+SEXP/*VECSXP*/ create_split_sorted(SEXP source, SEXP/*INTSXP|REALSXP|LGLSXP|STRSXP*/ key);
+SEXP           create_range_view(SEXP/*INTSXP|REALSXP*/ sorted, SEXP/*INTSXP|REALSXP*/ lower, SEXP/*INTSXP|REALSXP*/ upper);
@@ -0,0 +1,598 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+#include <R_ext/Altrep.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "common.h"
+
+#include "submatrices.h"
+#include "coercions.h"
+#include "slices.h"
+#include "aggregates.h"
+#include "zonemaps.h"
+#include "prefixsums.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// A submatrix is a block of contiguous rows and contiguous columns of a
+// column-major source matrix. Each of its columns is a window of the
+// corresponding column of the source, so the whole block is a set of windows
+// of the same size spaced source_rows apart. Blocks spanning all the rows of
+// the source are a single window, and those are simply slices.
+static R_altrep_class_t submatrix_integer_altrep;
+static R_altrep_class_t submatrix_numeric_altrep;
+static R_altrep_class_t submatrix_logical_altrep;
+static R_altrep_class_t submatrix_complex_altrep;
+static R_altrep_class_t submatrix_raw_altrep;
+
+static inline R_altrep_class_t class_from_sexp_type(SEXPTYPE type) { // @suppress("No return")
+    switch (type) {
+        case INTSXP:  return submatrix_integer_altrep;
+        case REALSXP: return submatrix_numeric_altrep;
+        case LGLSXP:  return submatrix_logical_altrep;
+        case CPLXSXP: return submatrix_complex_altrep;
+        case RAWSXP:  return submatrix_raw_altrep;
+        default:      Rf_error("No ALTREP submatrix class for vector of type %s", type2str(type));
+    }
+}
+
+typedef struct {
+    R_xlen_t source_rows; // Stride between columns
+    R_xlen_t first_row;
+    R_xlen_t rows;
+    R_xlen_t first_column;
+    R_xlen_t columns;
+} block_t;
+
+#define how_many_block_fields 5
+
+static SEXP/*REALSXP*/ write_block(const block_t *block) {
+    SEXP/*REALSXP*/ description = allocVector(REALSXP, how_many_block_fields);
+    double *fields = REAL(description);
+    fields[0] = (double) block->source_rows;
+    fields[1] = (double) block->first_row;
+    fields[2] = (double) block->rows;
+    fields[3] = (double) block->first_column;
+    fields[4] = (double) block->columns;
+    return description;
+}
+
+static inline void read_block(SEXP x, block_t *block) {
+    const double *fields = REAL_RO(R_altrep_data1(x));
+    block->source_rows  = (R_xlen_t) fields[0];
+    block->first_row    = (R_xlen_t) fields[1];
+    block->rows         = (R_xlen_t) fields[2];
+    block->first_column = (R_xlen_t) fields[3];
+    block->columns      = (R_xlen_t) fields[4];
+}
+
+static void set_dimensions(SEXP x, R_xlen_t rows, R_xlen_t columns) {
+    SEXP/*INTSXP*/ dimensions = PROTECT(allocVector(INTSXP, 2));
+    SET_INTEGER_ELT(dimensions, 0, (int) rows);
+    SET_INTEGER_ELT(dimensions, 1, (int) columns);
+    setAttrib(x, R_DimSymbol, dimensions);
+    UNPROTECT(1);
+}
+
+static SEXP submatrix_new(SEXP source, const block_t *block) {
+    make_sure(TYPEOF(source) == INTSXP || TYPEOF(source) == REALSXP || TYPEOF(source) == CPLXSXP
+           || TYPEOF(source) == LGLSXP || TYPEOF(source) == RAWSXP, Rf_error,
+              "type of source should be one of INTSXP, REALSXP, CPLXSXP, LGLSXP, or RAWSXP");
+    make_sure(block->first_row + block->rows <= block->source_rows, Rf_error, "rows must fit within the source");
+    make_sure((block->first_column + block->columns) * block->source_rows <= XLENGTH(source), Rf_error,
+              "columns must fit within the source");
+
+    if (get_debug_mode()) {
+        Rprintf("submatrix_new\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("    source rows: %li\n", block->source_rows);
+        Rprintf("      first row: %li\n", block->first_row);
+        Rprintf("           rows: %li\n", block->rows);
+        Rprintf("   first column: %li\n", block->first_column);
+        Rprintf("        columns: %li\n", block->columns);
+    }
+
+    SEXP/*REALSXP*/ description = PROTECT(write_block(block));
+
+    SEXP/*LISTSXP*/ data = PROTECT(allocSExp(LISTSXP));
+    SETCAR (data, source);     // The original matrix
+    SET_TAG(data, R_NilValue); // Starts as R_NilValue, becomes a vector if it the submatrix is written to
+    SETCDR (data, R_NilValue); // Nothing here
+
+    SEXP submatrix = R_new_altrep(class_from_sexp_type(TYPEOF(source)), description, data);
+    UNPROTECT(2);
+    return submatrix;
+}
+
+static inline SEXP get_source(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return CAR(cell);
+}
+
+static inline SEXP get_materialized_data(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell);
+}
+
+static inline void set_materialized_data(SEXP x, SEXP data) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    SET_TAG(cell, data);
+}
+
+static inline bool is_materialized(SEXP x) {
+    SEXP/*LISTSXP*/ cell =  R_altrep_data2(x);
+    return TAG(cell) != R_NilValue;
+}
+
+// Position in the source of the first element of a column of the block.
+static inline R_xlen_t column_start(const block_t *block, R_xlen_t column) {
+    return (block->first_column + column) * block->source_rows + block->first_row;
+}
+
+static inline R_xlen_t project_block_index(SEXP x, R_xlen_t i) {
+    block_t block;
+    read_block(x, &block);
+    return column_start(&block, i / block.rows) + i % block.rows;
+}
+
+static SEXP submatrix_duplicate(SEXP x, Rboolean deep) {
+
+    if (get_debug_mode()) {
+        Rprintf("submatrix_duplicate\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           deep: %i\n", deep);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    block_t block;
+    read_block(x, &block);
+
+    SEXP submatrix = PROTECT(submatrix_new(get_source(x), &block));
+    if (is_materialized(x)) {
+        SEXP data = get_materialized_data(x);
+        set_materialized_data(submatrix, deep ? duplicate(data) : data);
+    }
+    UNPROTECT(1);
+    return submatrix;
+}
+
+static Rboolean submatrix_inspect(SEXP x, int pre, int deep, int pvec, void (*inspect_subtree)(SEXP, int, int, int)) {
+
+    Rprintf("submatrix_altrep %s\n", type2char(TYPEOF(x)));
+
+    inspect_subtree(R_altrep_data1(x), pre, deep, pvec);
+    inspect_subtree(R_altrep_data2(x), pre, deep, pvec);
+
+    return FALSE;
+}
+
+static R_xlen_t submatrix_length(SEXP x) {
+    if (get_debug_mode()) {
+        Rprintf("submatrix_length\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    block_t block;
+    read_block(x, &block);
+    return block.rows * block.columns;
+}
+
+// Copies a region of the block one run per column it touches.
+static R_xlen_t copy_block_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    SEXP source = get_source(x);
+    size_t element_size = __get_element_size(TYPEOF(source));
+
+    block_t block;
+    read_block(x, &block);
+
+    R_xlen_t length = block.rows * block.columns;
+    R_xlen_t size   = (length - i < n) ? length - i : n;
+
+    R_xlen_t copied = 0;
+    while (copied < size) {
+        R_xlen_t position = i + copied;
+        R_xlen_t column   = position / block.rows;
+        R_xlen_t row      = position % block.rows;
+        R_xlen_t run      = block.rows - row;
+        R_xlen_t count    = (size - copied < run) ? size - copied : run;
+        copy_region(source, column_start(&block, column) + row, count, (char *) buf + copied * element_size);
+        copied += count;
+    }
+    return size;
+}
+
+static SEXP materialize(SEXP x) {
+    R_xlen_t size = submatrix_length(x);
+    SEXP data = PROTECT(allocVector(TYPEOF(get_source(x)), size));
+    copy_block_region(x, 0, size, DATAPTR(data));
+    UNPROTECT(1);
+    return data;
+}
+
+static void *submatrix_dataptr(SEXP x, Rboolean writeable) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("submatrix_dataptr\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("      writeable: %i\n", writeable);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (!is_materialized(x)) {
+        set_materialized_data(x, materialize(x));
+    }
+
+    SEXP data = get_materialized_data(x);
+    return writeable ? DATAPTR(data) : (void *) DATAPTR_RO(data);
+}
+
+static const void *submatrix_dataptr_or_null(SEXP x) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("submatrix_dataptr_or_null\n");
+        Rprintf("           SEXP: %p\n", x);
+    }
+
+    return is_materialized(x) ? DATAPTR_RO(get_materialized_data(x)) : NULL;
+}
+
+static int submatrix_integer_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("submatrix_integer_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return INTEGER_ELT(get_materialized_data(x), i);
+    }
+
+    return INTEGER_ELT(get_source(x), project_block_index(x, i));
+}
+
+static double submatrix_numeric_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("submatrix_numeric_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return REAL_ELT(get_materialized_data(x), i);
+    }
+
+    return REAL_ELT(get_source(x), project_block_index(x, i));
+}
+
+static int submatrix_logical_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("submatrix_logical_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return LOGICAL_ELT(get_materialized_data(x), i);
+    }
+
+    return LOGICAL_ELT(get_source(x), project_block_index(x, i));
+}
+
+static Rcomplex submatrix_complex_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("submatrix_complex_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return COMPLEX_ELT(get_materialized_data(x), i);
+    }
+
+    return COMPLEX_ELT(get_source(x), project_block_index(x, i));
+}
+
+static Rbyte submatrix_raw_element(SEXP x, R_xlen_t i) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("submatrix_raw_element\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return RAW_ELT(get_materialized_data(x), i);
+    }
+
+    return RAW_ELT(get_source(x), project_block_index(x, i));
+}
+
+static R_xlen_t submatrix_get_region(SEXP x, R_xlen_t i, R_xlen_t n, void *buf) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("submatrix_get_region\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("          index: %li\n", i);
+        Rprintf("           size: %li\n", n);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return copy_region(get_materialized_data(x), i, n, buf);
+    }
+
+    return copy_block_region(x, i, n, buf);
+}
+
+static R_xlen_t submatrix_integer_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    return submatrix_get_region(x, i, n, buf);
+}
+
+static R_xlen_t submatrix_numeric_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+    return submatrix_get_region(x, i, n, buf);
+}
+
+static R_xlen_t submatrix_logical_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+    return submatrix_get_region(x, i, n, buf);
+}
+
+static R_xlen_t submatrix_complex_get_region(SEXP x, R_xlen_t i, R_xlen_t n, Rcomplex *buf) {
+    return submatrix_get_region(x, i, n, buf);
+}
+
+static R_xlen_t submatrix_raw_get_region(SEXP x, R_xlen_t i, R_xlen_t n, Rbyte *buf) {
+    return submatrix_get_region(x, i, n, buf);
+}
+
+// Min, Max, and Sum are combined from the windows of individual columns.
+static void submatrix_extremes(SEXP x, extremes_t *extremes) {
+    SEXP source = get_source(x);
+
+    block_t block;
+    read_block(x, &block);
+
+    extremes_init(extremes);
+    for (R_xlen_t column = 0; column < block.columns; column++) {
+        R_xlen_t start = column_start(&block, column);
+        if (!zone_map_extremes(source, start, block.rows, extremes)) {
+            extremes_of_region(source, start, block.rows, extremes);
+        }
+    }
+}
+
+static SEXP submatrix_min(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("submatrix_min\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    extremes_t extremes;
+    submatrix_extremes(x, &extremes);
+    return extremes_min_as_sexp(TYPEOF(x), &extremes, submatrix_length(x), narm);
+}
+
+static SEXP submatrix_max(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("submatrix_max\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    extremes_t extremes;
+    submatrix_extremes(x, &extremes);
+    return extremes_max_as_sexp(TYPEOF(x), &extremes, submatrix_length(x), narm);
+}
+
+static SEXP submatrix_sum(SEXP x, Rboolean narm) {
+    make_sure(x != NULL && x != R_NilValue, Rf_error, "x cannot be null");
+
+    if (get_debug_mode()) {
+        Rprintf("submatrix_sum\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           narm: %i\n", narm);
+        Rprintf("is_materialized: %i\n", is_materialized(x));
+    }
+
+    if (is_materialized(x)) {
+        return NULL;
+    }
+
+    SEXP source = get_source(x);
+    SEXP/*VECSXP*/ prefix_sums = prefix_sums_get(source);
+
+    block_t block;
+    read_block(x, &block);
+
+    double   sum = 0;
+    R_xlen_t NAs = 0;
+    for (R_xlen_t column = 0; column < block.columns; column++) {
+        R_xlen_t start = column_start(&block, column);
+        double   column_sum = 0;
+        R_xlen_t column_NAs = 0;
+        if (prefix_sums == R_NilValue || !prefix_sums_of_region(prefix_sums, start, block.rows, &column_sum, &column_NAs)) {
+            sum_of_region(source, start, block.rows, &column_sum, &column_NAs);
+        }
+        sum += column_sum;
+        NAs += column_NAs;
+    }
+
+    return sum_as_sexp(TYPEOF(x), sum, NAs, narm);
+}
+
+static SEXP submatrix_coerce(SEXP x, int type) {
+    make_sure(x != NULL, Rf_error, "x must not be null");
+
+    if (get_debug_mode()) {
+        Rprintf("submatrix_coerce\n");
+        Rprintf("           SEXP: %p\n", x);
+        Rprintf("           type: %s\n", type2char(type));
+    }
+
+    return coerce_view(x, type);
+}
+
+static void init_common_submatrix(R_altrep_class_t cls) {
+    R_set_altrep_Duplicate_method(cls, submatrix_duplicate);
+    R_set_altrep_Inspect_method(cls, submatrix_inspect);
+    R_set_altrep_Length_method(cls, submatrix_length);
+    R_set_altrep_Coerce_method(cls, submatrix_coerce);
+
+    R_set_altvec_Dataptr_method(cls, submatrix_dataptr);
+    R_set_altvec_Dataptr_or_null_method(cls, submatrix_dataptr_or_null);
+}
+
+void init_submatrix_integer_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altinteger_class("submatrix_integer_altrep", "viewports", dll);
+    submatrix_integer_altrep = cls;
+
+    init_common_submatrix(cls);
+
+    R_set_altinteger_Elt_method(cls, submatrix_integer_element);
+    R_set_altinteger_Get_region_method(cls, submatrix_integer_get_region);
+    R_set_altinteger_Min_method(cls, submatrix_min);
+    R_set_altinteger_Max_method(cls, submatrix_max);
+    R_set_altinteger_Sum_method(cls, submatrix_sum);
+}
+
+void init_submatrix_numeric_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altreal_class("submatrix_numeric_altrep", "viewports", dll);
+    submatrix_numeric_altrep = cls;
+
+    init_common_submatrix(cls);
+
+    R_set_altreal_Elt_method(cls, submatrix_numeric_element);
+    R_set_altreal_Get_region_method(cls, submatrix_numeric_get_region);
+    R_set_altreal_Min_method(cls, submatrix_min);
+    R_set_altreal_Max_method(cls, submatrix_max);
+    R_set_altreal_Sum_method(cls, submatrix_sum);
+}
+
+void init_submatrix_logical_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altlogical_class("submatrix_logical_altrep", "viewports", dll);
+    submatrix_logical_altrep = cls;
+
+    init_common_submatrix(cls);
+
+    R_set_altlogical_Elt_method(cls, submatrix_logical_element);
+    R_set_altlogical_Get_region_method(cls, submatrix_logical_get_region);
+    R_set_altlogical_Sum_method(cls, submatrix_sum);
+}
+
+void init_submatrix_complex_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altcomplex_class("submatrix_complex_altrep", "viewports", dll);
+    submatrix_complex_altrep = cls;
+
+    init_common_submatrix(cls);
+
+    R_set_altcomplex_Elt_method(cls, submatrix_complex_element);
+    R_set_altcomplex_Get_region_method(cls, submatrix_complex_get_region);
+}
+
+void init_submatrix_raw_altrep_class(DllInfo * dll) {
+    R_altrep_class_t cls = R_make_altraw_class("submatrix_raw_altrep", "viewports", dll);
+    submatrix_raw_altrep = cls;
+
+    init_common_submatrix(cls);
+
+    R_set_altraw_Elt_method(cls, submatrix_raw_element);
+    R_set_altraw_Get_region_method(cls, submatrix_raw_get_region);
+}
+
+void init_submatrix_altrep_class(DllInfo * dll) {
+    init_submatrix_integer_altrep_class(dll);
+    init_submatrix_numeric_altrep_class(dll);
+    init_submatrix_logical_altrep_class(dll);
+    init_submatrix_complex_altrep_class(dll);
+    init_submatrix_raw_altrep_class(dll);
+}
+
+// Reads a contiguous range of 1-based indices into a 0-based start and a size.
+static void read_range(SEXP/*INTSXP|REALSXP*/ indices, R_xlen_t limit, const char *what,
+                       R_xlen_t *start, R_xlen_t *size) {
+    if (XLENGTH(indices) == 0) {
+        Rf_error("The %s of a submatrix cannot be empty", what);
+    }
+    if (!are_indices_contiguous(indices)) {
+        Rf_error("The %s of a submatrix must be a contiguous increasing range", what);
+    }
+    if (!are_indices_in_range(indices, 1, limit)) {
+        Rf_error("The %s of a submatrix must be between 1 and %li", what, limit);
+    }
+    *start = get_first_element_as_length(indices) - 1;
+    *size  = XLENGTH(indices);
+}
+
+SEXP create_submatrix(SEXP source, SEXP/*INTSXP|REALSXP*/ rows, SEXP/*INTSXP|REALSXP*/ columns) {
+    make_sure(TYPEOF(rows) == INTSXP || TYPEOF(rows) == REALSXP, Rf_error,
+              "type of rows must be either INTSXP or REALSXP");
+    make_sure(TYPEOF(columns) == INTSXP || TYPEOF(columns) == REALSXP, Rf_error,
+              "type of columns must be either INTSXP or REALSXP");
+
+    SEXP/*INTSXP*/ dimensions = getAttrib(source, R_DimSymbol);
+    if (TYPEOF(dimensions) != INTSXP || XLENGTH(dimensions) != 2) {
+        Rf_error("Source of a submatrix must be a matrix");
+    }
+
+    block_t block;
+    block.source_rows = INTEGER_ELT(dimensions, 0);
+    read_range(rows,    INTEGER_ELT(dimensions, 0), "rows",    &block.first_row,    &block.rows);
+    read_range(columns, INTEGER_ELT(dimensions, 1), "columns", &block.first_column, &block.columns);
+
+    if (get_debug_mode()) {
+        Rprintf("create submatrix\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("      first row: %li\n", block.first_row);
+        Rprintf("           rows: %li\n", block.rows);
+        Rprintf("   first column: %li\n", block.first_column);
+        Rprintf("        columns: %li\n", block.columns);
+    }
+
+    // A block of whole columns is one contiguous window of the source.
+    SEXP submatrix = (block.rows == block.source_rows)
+                   ? slice_new(source, column_start(&block, 0), block.rows * block.columns)
+                   : submatrix_new(source, &block);
+
+    PROTECT(submatrix);
+    set_dimensions(submatrix, block.rows, block.columns);
+    UNPROTECT(1);
+    return submatrix;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "Rinternals.h"
+
+SEXP create_submatrix(SEXP source, SEXP/*INTSXP|REALSXP*/ rows, SEXP/*INTSXP|REALSXP*/ columns);
+
+void init_submatrix_altrep_class(DllInfo *dll);
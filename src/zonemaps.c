@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#define USE_RINTERNALS
+#include <R.h>
+#include <Rinternals.h>
+
+#include "debug.h"
+#include "helpers.h"
+#include "bitmap_sexp.h"
+
+#include "zonemaps.h"
+#include "indexes.h"
+#include "aggregates.h"
+
+#define MAKE_SURE
+#include "make_sure.h"
+
+// A zone map keeps the smallest and largest non-NA element and the number of
+// NAs of every fixed-size block of the source. Requesting a zone map only
+// records the block size in the source's index slot; the map itself is built
+// the first time it is needed and then replaces the block size in the slot.
+//
+// Built zone maps are a VECSXP: block size, minima, maxima, NA counts.
+#define ZONE_MAP_BLOCK_SIZE 0
+#define ZONE_MAP_MINIMA     1
+#define ZONE_MAP_MAXIMA     2
+#define ZONE_MAP_NAS        3
+
+static inline bool is_built(SEXP zone_map) {
+    return TYPEOF(zone_map) == VECSXP;
+}
+
+SEXP/*VECSXP*/ zone_map_build(SEXP/*INTSXP|REALSXP|LGLSXP*/ source, R_xlen_t block_size) {
+    make_sure(block_size > 0 && block_size % how_many_bits_in_bitmap_word == 0, Rf_error,
+              "block size must be a positive multiple of the size of a bitmap word");
+
+    R_xlen_t size = XLENGTH(source);
+    R_xlen_t how_many_blocks = (size + block_size - 1) / block_size;
+
+    if (get_debug_mode()) {
+        Rprintf("zone_map_build\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("     block size: %li\n", block_size);
+        Rprintf("         blocks: %li\n", how_many_blocks);
+    }
+
+    SEXP/*VECSXP*/ zone_map = PROTECT(allocVector(VECSXP, 4));
+    SET_VECTOR_ELT(zone_map, ZONE_MAP_BLOCK_SIZE, ScalarReal((double) block_size));
+    SET_VECTOR_ELT(zone_map, ZONE_MAP_MINIMA,     allocVector(REALSXP, how_many_blocks));
+    SET_VECTOR_ELT(zone_map, ZONE_MAP_MAXIMA,     allocVector(REALSXP, how_many_blocks));
+    SET_VECTOR_ELT(zone_map, ZONE_MAP_NAS,        allocVector(INTSXP,  how_many_blocks));
+
+    double *minima = REAL(VECTOR_ELT(zone_map, ZONE_MAP_MINIMA));
+    double *maxima = REAL(VECTOR_ELT(zone_map, ZONE_MAP_MAXIMA));
+    int    *NAs    = INTEGER(VECTOR_ELT(zone_map, ZONE_MAP_NAS));
+
+    for (R_xlen_t block = 0; block < how_many_blocks; block++) {
+        R_xlen_t start = block * block_size;
+        R_xlen_t length = size - start < block_size ? size - start : block_size;
+
+        extremes_t extremes;
+        extremes_init(&extremes);
+        extremes_of_region(source, start, length, &extremes);
+
+        minima[block] = extremes.min;
+        maxima[block] = extremes.max;
+        NAs[block]    = (int) extremes.NAs;
+    }
+
+    UNPROTECT(1);
+    return zone_map;
+}
+
+SEXP/*VECSXP*/ zone_map_get(SEXP source) {
+    SEXP zone_map = index_get(source, INDEX_ZONE_MAP);
+    if (zone_map == R_NilValue || is_built(zone_map)) {
+        return zone_map;
+    }
+
+    R_xlen_t block_size = (R_xlen_t) REAL_ELT(zone_map, 0);
+    zone_map = PROTECT(zone_map_build(source, block_size));
+    index_set(source, INDEX_ZONE_MAP, zone_map);
+    UNPROTECT(1);
+    return zone_map;
+}
+
+R_xlen_t zone_map_block_size(SEXP/*VECSXP*/ zone_map) {
+    make_sure(is_built(zone_map), Rf_error, "zone map must be built");
+    return (R_xlen_t) REAL_ELT(VECTOR_ELT(zone_map, ZONE_MAP_BLOCK_SIZE), 0);
+}
+
+void zone_map_block(SEXP/*VECSXP*/ zone_map, R_xlen_t block, extremes_t *extremes) {
+    make_sure(is_built(zone_map), Rf_error, "zone map must be built");
+    make_sure(block < XLENGTH(VECTOR_ELT(zone_map, ZONE_MAP_MINIMA)), Rf_error, "block out of range");
+
+    extremes->min = REAL_ELT   (VECTOR_ELT(zone_map, ZONE_MAP_MINIMA), block);
+    extremes->max = REAL_ELT   (VECTOR_ELT(zone_map, ZONE_MAP_MAXIMA), block);
+    extremes->NAs = INTEGER_ELT(VECTOR_ELT(zone_map, ZONE_MAP_NAS),    block);
+}
+
+bool zone_map_extremes(SEXP source, R_xlen_t start, R_xlen_t size, extremes_t *extremes) {
+    SEXP zone_map = zone_map_get(source);
+    if (zone_map == R_NilValue) {
+        return false;
+    }
+
+    R_xlen_t block_size  = zone_map_block_size(zone_map);
+    R_xlen_t end         = start + size;
+    R_xlen_t first_block = (start + block_size - 1) / block_size; // First block fully inside the region
+    R_xlen_t last_block  = end / block_size;                      // Block after the last one fully inside
+
+    if (first_block >= last_block) {
+        extremes_of_region(source, start, size, extremes);
+        return true;
+    }
+
+    extremes_of_region(source, start, first_block * block_size - start, extremes);
+    for (R_xlen_t block = first_block; block < last_block; block++) {
+        extremes_t block_extremes;
+        zone_map_block(zone_map, block, &block_extremes);
+        extremes_merge(extremes, &block_extremes);
+    }
+    extremes_of_region(source, last_block * block_size, end - last_block * block_size, extremes);
+    return true;
+}
+
+SEXP create_zone_map(SEXP/*INTSXP|REALSXP|LGLSXP*/ source, SEXP/*INTSXP|REALSXP*/ block_size_sexp) {
+    SEXPTYPE type = TYPEOF(source);
+    make_sure(type == INTSXP || type == REALSXP || type == LGLSXP, Rf_error,
+              "type of source must be one of INTSXP, REALSXP, or LGLSXP");
+    make_sure(TYPEOF(block_size_sexp) == INTSXP || TYPEOF(block_size_sexp) == REALSXP, Rf_error,
+              "type of block size must be either INTSXP or REALSXP");
+
+    double block_size = asReal(block_size_sexp);
+    if (ISNAN(block_size) || block_size <= 0 || ((R_xlen_t) block_size) % how_many_bits_in_bitmap_word != 0) {
+        Rf_error("Block size must be a positive multiple of %i", how_many_bits_in_bitmap_word);
+    }
+
+    if (get_debug_mode()) {
+        Rprintf("create zone map\n");
+        Rprintf("           SEXP: %p\n", source);
+        Rprintf("     block size: %li\n", (R_xlen_t) block_size);
+    }
+
+    // Requesting the map again drops the one that was built, so that a source
+    // written to in place can be indexed anew.
+    index_set(source, INDEX_ZONE_MAP, ScalarReal(block_size));
+    return source;
+}
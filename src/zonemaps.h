@@ -0,0 +1,13 @@
+#pragma once
+
+#include "Rinternals.h"
+#include <stdbool.h>
+
+#include "aggregates.h"
+
+SEXP/*VECSXP*/ zone_map_get       (SEXP source);                           // R_NilValue if not requested
+R_xlen_t       zone_map_block_size(SEXP/*VECSXP*/ zone_map);
+void           zone_map_block     (SEXP/*VECSXP*/ zone_map, R_xlen_t block, extremes_t *extremes);
+bool           zone_map_extremes  (SEXP source, R_xlen_t start, R_xlen_t size, extremes_t *extremes);
+
+SEXP create_zone_map(SEXP/*INTSXP|REALSXP|LGLSXP*/ source, SEXP/*INTSXP|REALSXP*/ block_size);